@@ -15,9 +15,26 @@
 #include <limits>
 #include <thread>
 #include <queue>
+#include <deque>
 #include <optional>
-#include <regex>
+#include <string_view>
 #include <stdexcept>
+#include <cstring>
+#include <cassert>
+#include <charconv>
+#include <numeric>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <random>
+#include <condition_variable>
+#include <exception>
+#include <cmath>
+#include <iomanip>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
 
 enum FieldType { INT, FLOAT, STRING };
 
@@ -153,7 +170,7 @@ public:
     size_t getSize() const {
         size_t size = 0;
         for (const auto& field : fields) {
-            size += field->data_length;
+            size += field ? field->data_length : 0;
         }
         return size;
     }
@@ -162,7 +179,8 @@ public:
         std::stringstream buffer;
         buffer << fields.size() << ' ';
         for (const auto& field : fields) {
-            buffer << field->serialize();
+            // A NULL is written with a type Field::deserialize maps back to nullptr
+            buffer << (field ? field->serialize() : "-1 0 ");
         }
         return buffer.str();
     }
@@ -185,7 +203,7 @@ public:
     std::unique_ptr<Tuple> clone() const {
         auto clonedTuple = std::make_unique<Tuple>();
         for (const auto& field : fields) {
-            clonedTuple->addField(field->clone());
+            clonedTuple->addField(field ? field->clone() : nullptr);
         }
         return clonedTuple;
     }
@@ -324,10 +342,25 @@ public:
 
 const std::string database_filename = "buzzdb.dat";
 
+// Creates an empty file for operator spills or a scratch table and
+// returns its name. mkstemp picks a name that no other thread or process
+// sharing the directory gets; the StorageManager using the file removes it.
+std::string temporaryFilename() {
+    std::string filename = database_filename + ".tmp.XXXXXX";
+    int fd = mkstemp(filename.data());
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create a temporary file: " + std::string(std::strerror(errno)));
+    }
+    close(fd);
+    return filename;
+}
+
 class StorageManager {
 public:    
     std::fstream fileStream;
     size_t num_pages = 0;
+    std::string filename = database_filename;
+    bool temporary = false;
 
 public:
     StorageManager(){
@@ -350,14 +383,27 @@ public:
 
     }
 
+    // Creates an empty scratch file that is deleted together with the
+    // manager. Pages are appended with flush().
+    explicit StorageManager(const std::string& scratch_filename)
+        : filename(scratch_filename), temporary(true) {
+        fileStream.open(filename, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!fileStream) {
+            throw std::runtime_error("Unable to create temporary file " + filename);
+        }
+    }
+
     ~StorageManager() {
         if (fileStream.is_open()) {
             fileStream.close();
         }
+        if (temporary) {
+            std::remove(filename.c_str());
+        }
     }
 
     // Read a page from disk
-    std::unique_ptr<SlottedPage> load(uint16_t page_id) {
+    std::unique_ptr<SlottedPage> load(size_t page_id) {
         fileStream.seekg(page_id * PAGE_SIZE, std::ios::beg);
         auto page = std::make_unique<SlottedPage>();
         // Read the content of the file into the page
@@ -372,13 +418,14 @@ public:
     }
 
     // Write a page to disk
-    void flush(uint16_t page_id, const std::unique_ptr<SlottedPage>& page) {
+    void flush(size_t page_id, const std::unique_ptr<SlottedPage>& page) {
         size_t page_offset = page_id * PAGE_SIZE;        
 
         // Move the write pointer
         fileStream.seekp(page_offset, std::ios::beg);
         fileStream.write(page->page_data.get(), PAGE_SIZE);        
         fileStream.flush();
+        num_pages = std::max(num_pages, page_id + 1);
     }
 
     // Extend database file by one page
@@ -471,6 +518,181 @@ public:
 };
 
 constexpr size_t MAX_PAGES_IN_MEMORY = 10;
+// Pages a circular scan holds for the scans attached to it
+constexpr size_t SHARED_SCAN_PAGES = 64;
+// Longest a shared scan waits for a slower one before leaving it behind
+constexpr auto SHARED_SCAN_MAX_WAIT = std::chrono::milliseconds(10);
+
+// Notified of every row inserted into or deleted from a table
+class TableObserver {
+public:
+    virtual ~TableObserver() = default;
+    virtual void onInsert(const Tuple& tuple) = 0;
+    virtual void onDelete(const Tuple& tuple) = 0;
+};
+
+// One circular pass over the pages of a table, shared by all full scans
+// running at the same time. A scan attaches at the oldest page the pass
+// still holds and wraps around to it. Pages stay in a window until every
+// attached scan is past them, so each page is read once however many
+// scans there are. With a full window, the scan reading ahead waits for
+// scans on other threads that still need the oldest page. A scan that
+// keeps it waiting too long, or one on the same thread, is left behind
+// and reads the pages it missed on its own.
+class CircularScan {
+public:
+    using PageReader = std::function<void(int page_id, char* destination)>;
+    using Page = std::shared_ptr<const std::vector<char>>;
+
+private:
+    struct WindowPage {
+        uint64_t version; // Table version the copy was read at
+        Page data;
+    };
+
+    struct Consumer {
+        uint64_t start;        // Tick of the first page
+        uint64_t next;         // Tick of the next page it reads
+        std::thread::id thread;
+        bool left_behind = false;
+    };
+
+    PageReader read_page;
+    size_t capacity;
+    std::mutex mutex;
+    std::condition_variable advanced;
+    // Ticks count pages read by the pass; tick t is page t % num_pages
+    size_t num_pages = 0;
+    uint64_t base = 0; // Tick of window.front()
+    std::deque<WindowPage> window;
+    std::unordered_map<size_t, Consumer> consumers;
+    size_t next_id = 0;
+
+public:
+    CircularScan(PageReader read_page, size_t capacity)
+        : read_page(std::move(read_page)), capacity(std::max<size_t>(1, capacity)) {}
+
+    // Registers a scan over `pages` pages and sets `start_page` to the
+    // first page it reads. Returns nullopt when the scans in progress
+    // cover a different number of pages; the scan then runs on its own.
+    std::optional<size_t> attach(size_t pages, size_t& start_page) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (consumers.empty()) {
+            window.clear();
+            base = 0;
+            num_pages = pages;
+        }
+        if (pages == 0 || pages != num_pages) {
+            return std::nullopt;
+        }
+        size_t id = next_id++;
+        consumers[id] = Consumer{base, base, std::this_thread::get_id()};
+        start_page = base % num_pages;
+        return id;
+    }
+
+    void detach(size_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        consumers.erase(id);
+        trim();
+        advanced.notify_all();
+    }
+
+    // Page `index` of the scan's pass, current as of table `version`
+    Page read(size_t id, size_t index, uint64_t version) {
+        std::unique_lock<std::mutex> lock(mutex);
+        Consumer& consumer = consumers.at(id);
+        uint64_t tick = consumer.start + index;
+        int page_id = static_cast<int>(tick % num_pages);
+        consumer.next = tick + 1;
+
+        Page data;
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        while (!data) {
+            uint64_t end = base + window.size();
+            if (tick < base || tick > end) {
+                // Left behind by the window
+                data = load(page_id);
+            } else if (tick < end) {
+                WindowPage& page = window[tick - base];
+                if (page.version != version) {
+                    page = {version, load(page_id)};
+                }
+                data = page.data;
+            } else if (window.size() >= capacity && waitingFor(consumer.thread)) {
+                // Reading ahead of every attached scan; another scan may
+                // read the page while this one waits
+                if (!deadline) {
+                    deadline = std::chrono::steady_clock::now() + SHARED_SCAN_MAX_WAIT;
+                }
+                if (advanced.wait_until(lock, *deadline) == std::cv_status::timeout) {
+                    leaveBehind();
+                }
+            } else {
+                trim();
+                if (window.size() >= capacity) {
+                    // Scans on this thread cannot move on while it waits
+                    window.pop_front();
+                    base++;
+                }
+                data = load(page_id);
+                window.push_back({version, data});
+            }
+        }
+        trim();
+        advanced.notify_all();
+        return data;
+    }
+
+private:
+    Page load(int page_id) {
+        auto data = std::make_shared<std::vector<char>>(PAGE_SIZE);
+        read_page(page_id, data->data());
+        return data;
+    }
+
+    bool needsFront(const Consumer& consumer) const {
+        return !consumer.left_behind && consumer.next <= base && consumer.next < consumer.start + num_pages;
+    }
+
+    // Whether a scan on another thread still needs the oldest page
+    bool waitingFor(std::thread::id thread) const {
+        return std::any_of(consumers.begin(), consumers.end(), [&](const auto& entry) {
+            return entry.second.thread != thread && needsFront(entry.second);
+        });
+    }
+
+    void leaveBehind() {
+        for (auto& entry : consumers) {
+            if (needsFront(entry.second)) {
+                entry.second.left_behind = true;
+            }
+        }
+    }
+
+    // Drops the oldest pages while no attached scan needs them
+    void trim() {
+        while (!window.empty() &&
+               std::none_of(consumers.begin(), consumers.end(),
+                            [&](const auto& entry) { return needsFront(entry.second); })) {
+            window.pop_front();
+            base++;
+        }
+    }
+};
+
+// Page requests made by one thread: those served from the pool and those
+// that loaded the page. Counting per thread lets EXPLAIN ANALYZE measure
+// its own query while others run.
+struct BufferTraffic {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+BufferTraffic& threadBufferTraffic() {
+    thread_local BufferTraffic traffic;
+    return traffic;
+}
 
 class BufferManager {
 private:
@@ -479,17 +701,90 @@ private:
     StorageManager storage_manager;
     PageMap pageMap;
     std::unique_ptr<Policy> policy;
+    std::mutex mutex;
+    // Version of the table stored in this file, bumped by every insert
+    // and delete; cached query results are valid for one version only
+    std::atomic<uint64_t> table_version{0};
+    std::vector<TableObserver*> observers;
+    CircularScan circular_scan;
 
 public:
     BufferManager(): 
-    policy(std::make_unique<LruPolicy>(MAX_PAGES_IN_MEMORY)) {}
+    policy(std::make_unique<LruPolicy>(MAX_PAGES_IN_MEMORY)),
+    circular_scan([this](int page_id, char* destination) { readPage(page_id, destination); }, SHARED_SCAN_PAGES) {}
+
+    // Table in a scratch file that is deleted with the manager
+    explicit BufferManager(const std::string& scratch_filename):
+    storage_manager(scratch_filename),
+    policy(std::make_unique<LruPolicy>(MAX_PAGES_IN_MEMORY)),
+    circular_scan([this](int page_id, char* destination) { readPage(page_id, destination); }, SHARED_SCAN_PAGES) {}
 
     std::unique_ptr<SlottedPage>& getPage(int page_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return fetchPage(page_id);
+    }
+
+    // Copies the PAGE_SIZE bytes of a page into `destination`. Safe to
+    // call from several threads at once.
+    void readPage(int page_id, char* destination) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::memcpy(destination, fetchPage(page_id)->page_data.get(), PAGE_SIZE);
+    }
+
+    // Shared pass over the pages for scans running at the same time
+    CircularScan& getCircularScan() {
+        return circular_scan;
+    }
+
+    void flushPage(int page_id) {
+        //std::cout << "Flush page " << page_id << "\n";
+        storage_manager.flush(page_id, pageMap[page_id]);
+    }
+
+    void extend(){
+        storage_manager.extend();
+    }
+    
+    size_t getNumPages(){
+        return storage_manager.num_pages;
+    }
+
+    uint64_t getTableVersion() const {
+        return table_version.load();
+    }
+
+    void addObserver(TableObserver* observer) {
+        observers.push_back(observer);
+    }
+
+    void removeObserver(TableObserver* observer) {
+        observers.erase(std::remove(observers.begin(), observers.end(), observer), observers.end());
+    }
+
+    // Called by the insert and delete operators once a row is stored or removed
+    void tupleInserted(const Tuple& tuple) {
+        table_version++;
+        for (auto* observer : observers) {
+            observer->onInsert(tuple);
+        }
+    }
+
+    void tupleDeleted(const Tuple& tuple) {
+        table_version++;
+        for (auto* observer : observers) {
+            observer->onDelete(tuple);
+        }
+    }
+
+private:
+    std::unique_ptr<SlottedPage>& fetchPage(int page_id) {
         auto it = pageMap.find(page_id);
         if (it != pageMap.end()) {
+            threadBufferTraffic().hits++;
             policy->touch(page_id);
             return pageMap.find(page_id)->second;
         }
+        threadBufferTraffic().misses++;
 
         if (pageMap.size() >= MAX_PAGES_IN_MEMORY) {
             auto evictedPageId = policy->evict();
@@ -507,19 +802,6 @@ public:
         return pageMap[page_id];
     }
 
-    void flushPage(int page_id) {
-        //std::cout << "Flush page " << page_id << "\n";
-        storage_manager.flush(page_id, pageMap[page_id]);
-    }
-
-    void extend(){
-        storage_manager.extend();
-    }
-    
-    size_t getNumPages(){
-        return storage_manager.num_pages;
-    }
-
 };
 
 class HashIndex {
@@ -622,6 +904,198 @@ public:
     }
 };
 
+// Number of tuples exchanged per call in the vectorized interface
+static constexpr size_t BATCH_SIZE = 1024;
+
+// A column of values of a single type, stored contiguously. `nulls` is
+// either empty (no NULLs) or holds one flag per row; a NULL row keeps a
+// placeholder value so that the value vectors stay dense.
+class ColumnVector {
+public:
+    FieldType type = INT;
+    std::vector<int> ints;
+    std::vector<float> floats;
+    std::vector<std::string> strings;
+    std::vector<uint8_t> nulls;
+
+    size_t size() const {
+        switch (type) {
+            case INT: return ints.size();
+            case FLOAT: return floats.size();
+            case STRING: return strings.size();
+        }
+        return 0;
+    }
+
+    void clear() {
+        ints.clear();
+        floats.clear();
+        strings.clear();
+        nulls.clear();
+    }
+
+    bool hasNulls() const { return !nulls.empty(); }
+    bool isNull(size_t row) const { return !nulls.empty() && nulls[row]; }
+
+    void setNull(size_t row) {
+        if (nulls.empty()) {
+            nulls.assign(size(), 0);
+        }
+        nulls[row] = 1;
+    }
+
+    // True if no row of `selection` holds a value
+    bool allNull(const std::vector<uint16_t>& selection) const {
+        return std::all_of(selection.begin(), selection.end(), [&](uint16_t row) { return isNull(row); });
+    }
+
+    // The first value appended to a column of only NULLs decides its type
+    void setType(FieldType new_type) {
+        if (type == new_type) {
+            return;
+        }
+        size_t rows = size();
+        if (rows != 0 && std::count(nulls.begin(), nulls.end(), 1) != static_cast<std::ptrdiff_t>(rows)) {
+            throw std::runtime_error("Mixed field types within a column.");
+        }
+        std::vector<uint8_t> flags = std::move(nulls);
+        reset(new_type, rows);
+        nulls = std::move(flags);
+    }
+
+    // Empties the column and sizes it to `rows` values of `new_type`
+    void reset(FieldType new_type, size_t rows) {
+        clear();
+        type = new_type;
+        switch (type) {
+            case INT: ints.resize(rows); break;
+            case FLOAT: floats.resize(rows); break;
+            case STRING: strings.resize(rows); break;
+        }
+    }
+
+    void append(const Field& field) {
+        setType(field.getType());
+        switch (type) {
+            case INT: ints.push_back(field.asInt()); break;
+            case FLOAT: floats.push_back(field.asFloat()); break;
+            case STRING: strings.push_back(field.asString()); break;
+        }
+        if (!nulls.empty()) {
+            nulls.push_back(0);
+        }
+    }
+
+    void appendNull() {
+        size_t row = size();
+        switch (type) {
+            case INT: ints.emplace_back(); break;
+            case FLOAT: floats.emplace_back(); break;
+            case STRING: strings.emplace_back(); break;
+        }
+        if (nulls.empty()) {
+            nulls.assign(row, 0);
+        }
+        nulls.push_back(1);
+    }
+
+    Field getValue(size_t row) const {
+        switch (type) {
+            case INT: return Field(ints[row]);
+            case FLOAT: return Field(floats[row]);
+            case STRING: return Field(strings[row]);
+        }
+        throw std::runtime_error("Unsupported field type in column.");
+    }
+
+    // nullptr for a NULL row
+    std::unique_ptr<Field> getField(size_t row) const {
+        if (isNull(row)) {
+            return nullptr;
+        }
+        return std::make_unique<Field>(getValue(row));
+    }
+};
+
+// Rows of `selection` for which none of `columns` is NULL
+inline std::vector<uint16_t> nonNullRows(const std::vector<uint16_t>& selection,
+                                         std::initializer_list<const ColumnVector*> columns) {
+    std::vector<uint16_t> rows;
+    rows.reserve(selection.size());
+    for (auto row : selection) {
+        bool valid = true;
+        for (const ColumnVector* column : columns) {
+            valid &= !column->isNull(row);
+        }
+        if (valid) {
+            rows.push_back(row);
+        }
+    }
+    return rows;
+}
+
+// Marks a row of `result` NULL wherever one of `inputs` is NULL
+inline void propagateNulls(ColumnVector& result, std::initializer_list<const ColumnVector*> inputs) {
+    for (const ColumnVector* input : inputs) {
+        for (size_t row = 0; row < input->nulls.size(); ++row) {
+            if (input->nulls[row]) {
+                result.setNull(row);
+            }
+        }
+    }
+}
+
+// A set of column vectors plus a selection vector listing the live rows
+class Batch {
+public:
+    std::vector<ColumnVector> columns;
+    std::vector<uint16_t> selection;
+    size_t count = 0; // Number of rows stored in the columns
+
+    void clear() {
+        for (auto& column : columns) {
+            column.clear();
+        }
+        selection.clear();
+        count = 0;
+    }
+
+    bool full() const { return count >= BATCH_SIZE; }
+
+    void selectAll() {
+        selection.resize(count);
+        std::iota(selection.begin(), selection.end(), 0);
+    }
+
+    void appendRow(const std::vector<std::unique_ptr<Field>>& fields) {
+        if (count == 0) {
+            columns.resize(fields.size());
+        }
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (fields[i]) {
+                columns[i].append(*fields[i]);
+            } else {
+                columns[i].appendNull();
+            }
+        }
+        selection.push_back(count++);
+    }
+
+    std::vector<std::unique_ptr<Field>> getRow(size_t row) const {
+        std::vector<std::unique_ptr<Field>> fields;
+        fields.reserve(columns.size());
+        for (const auto& column : columns) {
+            fields.push_back(column.getField(row));
+        }
+        return fields;
+    }
+};
+
+struct SortKey {
+    size_t attr_index;
+    bool descending = false;
+};
+
 class Operator {
     public:
     virtual ~Operator() = default;
@@ -640,6 +1114,25 @@ class Operator {
     /// `next()` returns true, the Fields will contain the values for the
     /// next tuple. Each `Field` pointer in the vector stands for one attribute of the tuple.
     virtual std::vector<std::unique_ptr<Field>> getOutput() = 0;
+
+    /// Vectorized alternative to `next()`/`getOutput()`. Clears `batch` and
+    /// fills it with up to BATCH_SIZE tuples; only the rows listed in
+    /// `batch.selection` are valid. Returns false once the input is exhausted.
+    /// A consumer uses either this or `next()`, never both on the same run.
+    /// The default adapts the tuple-at-a-time interface.
+    virtual bool nextBatch(Batch& batch) {
+        batch.clear();
+        while (!batch.full() && next()) {
+            batch.appendRow(getOutput());
+        }
+        return batch.count > 0;
+    }
+
+    /// The order in which the output is produced, most significant
+    /// attribute first. Empty when the output is unordered.
+    virtual std::vector<SortKey> getOrdering() const {
+        return {};
+    }
 };
 
 class UnaryOperator : public Operator {
@@ -664,88 +1157,54 @@ class BinaryOperator : public Operator {
     ~BinaryOperator() override = default;
 };
 
-class ScanOperator : public Operator {
-private:
-    BufferManager& bufferManager;
-    size_t currentPageIndex = 0;
-    size_t currentSlotIndex = 0;
-    std::unique_ptr<Tuple> currentTuple;
-    size_t tuple_count = 0;
-
-public:
-    ScanOperator(BufferManager& manager) : bufferManager(manager) {}
-
-    void open() override {
-        currentPageIndex = 0;
-        currentSlotIndex = 0;
-        currentTuple.reset(); // Ensure currentTuple is reset
-        loadNextTuple();
-    }
-
-    bool next() override {
-        if (!currentTuple) return false; // No more tuples available
-
-        loadNextTuple();
-        return currentTuple != nullptr;
-    }
-
-    void close() override {
-        std::cout << "Scan Operator tuple_count: " << tuple_count << "\n";
-        currentPageIndex = 0;
-        currentSlotIndex = 0;
-        currentTuple.reset();
+// Helpers for reading the space-separated tuple encoding in place
+inline const char* skipSpaces(const char* pos, const char* end) {
+    while (pos < end && *pos == ' ') {
+        ++pos;
     }
+    return pos;
+}
 
-    std::vector<std::unique_ptr<Field>> getOutput() override {
-        if (currentTuple) {
-            return std::move(currentTuple->fields);
-        }
-        return {}; // Return an empty vector if no tuple is available
+template<typename T>
+const char* parseNumber(const char* pos, const char* end, T& value) {
+    pos = skipSpaces(pos, end);
+    auto result = std::from_chars(pos, end, value);
+    if (result.ec != std::errc()) {
+        throw std::runtime_error("Malformed tuple encoding.");
     }
+    return result.ptr;
+}
 
-private:
-    void loadNextTuple() {
-        while (currentPageIndex < bufferManager.getNumPages()) {
-            auto& currentPage = bufferManager.getPage(currentPageIndex);
-            if (!currentPage || currentSlotIndex >= MAX_SLOTS) {
-                currentSlotIndex = 0; // Reset slot index when moving to a new page
-            }
-
-            char* page_buffer = currentPage->page_data.get();
-            Slot* slot_array = reinterpret_cast<Slot*>(page_buffer);
+class IPredicate {
+public:
+    virtual ~IPredicate() = default;
+    virtual bool check(const std::vector<std::unique_ptr<Field>>& tupleFields) const = 0;
 
-            while (currentSlotIndex < MAX_SLOTS) {
-                if (!slot_array[currentSlotIndex].empty) {
-                    assert(slot_array[currentSlotIndex].offset != INVALID_VALUE);
-                    const char* tuple_data = page_buffer + slot_array[currentSlotIndex].offset;
-                    std::istringstream iss(std::string(tuple_data, slot_array[currentSlotIndex].length));
-                    currentTuple = Tuple::deserialize(iss);
-                    currentSlotIndex++; // Move to the next slot for the next call
-                    tuple_count++;
-                    return; // Tuple loaded successfully
-                }
-                currentSlotIndex++;
+    // Removes the rows of `selection` that do not satisfy the predicate.
+    // The default materializes every selected row and calls check().
+    virtual void filter(const Batch& batch, std::vector<uint16_t>& selection) const {
+        size_t out = 0;
+        for (auto row : selection) {
+            if (check(batch.getRow(row))) {
+                selection[out++] = row;
             }
-
-            // Increment page index after exhausting current page
-            currentPageIndex++;
         }
-
-        // No more tuples are available
-        currentTuple.reset();
+        selection.resize(out);
     }
-};
 
-class IPredicate {
-public:
-    virtual ~IPredicate() = default;
-    virtual bool check(const std::vector<std::unique_ptr<Field>>& tupleFields) const = 0;
+    // Adds the attributes the predicate reads to `attrs`. Returns false if
+    // they are not known, in which case callers must supply every column.
+    virtual bool collectAttributes(std::vector<size_t>&) const { return false; }
 };
 
 void printTuple(const std::vector<std::unique_ptr<Field>>& tupleFields) {
     std::cout << "Tuple: [";
     for (const auto& field : tupleFields) {
-        field->print(); // Assuming `print()` is a method that prints field content
+        if (field) {
+            field->print(); // Assuming `print()` is a method that prints field content
+        } else {
+            std::cout << "NULL";
+        }
         std::cout << " ";
     }
     std::cout << "]";
@@ -757,12 +1216,12 @@ public:
     enum ComparisonOperator { EQ, NE, GT, GE, LT, LE }; // Renamed from PredicateType
 
     struct Operand {
-        std::unique_ptr<Field> directValue;
-        size_t index;
+        std::unique_ptr<Field> directValue = nullptr;
+        size_t index = 0;
         OperandType type;
 
-        Operand(std::unique_ptr<Field> value) : directValue(std::move(value)), type(DIRECT) {}
-        Operand(size_t idx) : index(idx), type(INDIRECT) {}
+        Operand(std::unique_ptr<Field> value) : directValue(std::move(value)), index(0), type(DIRECT) {}
+        Operand(size_t idx) : directValue(nullptr), index(idx), type(INDIRECT) {}
     };
 
     Operand left_operand;
@@ -772,6 +1231,17 @@ public:
     SimplePredicate(Operand left, Operand right, ComparisonOperator op)
         : left_operand(std::move(left)), right_operand(std::move(right)), comparison_operator(op) {}
 
+    // Mirrors the operator so that `constant op column` becomes `column op constant`
+    static ComparisonOperator flip(ComparisonOperator op) {
+        switch (op) {
+            case GT: return LT;
+            case GE: return LE;
+            case LT: return GT;
+            case LE: return GE;
+            default: return op;
+        }
+    }
+
     bool check(const std::vector<std::unique_ptr<Field>>& tupleFields) const {
         const Field* leftField = nullptr;
         const Field* rightField = nullptr;
@@ -788,8 +1258,8 @@ public:
             rightField = tupleFields[right_operand.index].get();
         }
 
+        // A comparison with NULL is unknown, which a filter treats as false
         if (leftField == nullptr || rightField == nullptr) {
-            std::cerr << "Error: Invalid field reference.\n";
             return false;
         }
 
@@ -837,35 +1307,175 @@ private:
             default: std::cerr << "Invalid predicate type\n"; return false;
         }
     }
-};
 
-class ComplexPredicate : public IPredicate {
-public:
-    enum LogicOperator { AND, OR };
+    // Keeps the selected rows for which cmp(row) holds, without branching on the outcome
+    template<typename Compare>
+    static void compact(std::vector<uint16_t>& selection, Compare cmp) {
+        size_t out = 0;
+        for (auto row : selection) {
+            selection[out] = row;
+            out += cmp(row);
+        }
+        selection.resize(out);
+    }
 
-private:
-    std::vector<std::unique_ptr<IPredicate>> predicates;
-    LogicOperator logic_operator;
+    // Dispatches on the comparison once per batch instead of once per row
+    template<typename T>
+    static void filterColumn(const std::vector<T>& values, const T& constant,
+                             ComparisonOperator op, std::vector<uint16_t>& selection) {
+        switch (op) {
+            case EQ: compact(selection, [&](uint16_t row) { return values[row] == constant; }); break;
+            case NE: compact(selection, [&](uint16_t row) { return values[row] != constant; }); break;
+            case GT: compact(selection, [&](uint16_t row) { return values[row] > constant; }); break;
+            case GE: compact(selection, [&](uint16_t row) { return values[row] >= constant; }); break;
+            case LT: compact(selection, [&](uint16_t row) { return values[row] < constant; }); break;
+            case LE: compact(selection, [&](uint16_t row) { return values[row] <= constant; }); break;
+        }
+    }
+
+    template<typename T>
+    static void filterColumns(const std::vector<T>& left, const std::vector<T>& right,
+                              ComparisonOperator op, std::vector<uint16_t>& selection) {
+        switch (op) {
+            case EQ: compact(selection, [&](uint16_t row) { return left[row] == right[row]; }); break;
+            case NE: compact(selection, [&](uint16_t row) { return left[row] != right[row]; }); break;
+            case GT: compact(selection, [&](uint16_t row) { return left[row] > right[row]; }); break;
+            case GE: compact(selection, [&](uint16_t row) { return left[row] >= right[row]; }); break;
+            case LT: compact(selection, [&](uint16_t row) { return left[row] < right[row]; }); break;
+            case LE: compact(selection, [&](uint16_t row) { return left[row] <= right[row]; }); break;
+        }
+    }
+
+public:
+
+    void filter(const Batch& batch, std::vector<uint16_t>& selection) const override {
+        // A comparison with NULL is unknown, which a filter treats as false
+        for (const Operand* operand : {&left_operand, &right_operand}) {
+            if (operand->type == INDIRECT && batch.columns[operand->index].hasNulls()) {
+                selection = nonNullRows(selection, {&batch.columns[operand->index]});
+                if (selection.empty()) {
+                    return;
+                }
+            }
+        }
+
+        // Column compared against a constant, on either side
+        if (left_operand.type != right_operand.type) {
+            bool column_left = left_operand.type == INDIRECT;
+            const ColumnVector& column = batch.columns[column_left ? left_operand.index : right_operand.index];
+            const Field& constant = column_left ? *right_operand.directValue : *left_operand.directValue;
+            ComparisonOperator op = column_left ? comparison_operator : flip(comparison_operator);
+
+            if (column.type != constant.getType()) {
+                std::cerr << "Error: Comparing fields of different types.\n";
+                selection.clear();
+                return;
+            }
+            switch (column.type) {
+                case INT: filterColumn(column.ints, constant.asInt(), op, selection); break;
+                case FLOAT: filterColumn(column.floats, constant.asFloat(), op, selection); break;
+                case STRING: filterColumn(column.strings, constant.asString(), op, selection); break;
+            }
+            return;
+        }
+
+        // Two columns of the same batch
+        if (left_operand.type == INDIRECT) {
+            const ColumnVector& left = batch.columns[left_operand.index];
+            const ColumnVector& right = batch.columns[right_operand.index];
+            if (left.type != right.type) {
+                std::cerr << "Error: Comparing fields of different types.\n";
+                selection.clear();
+                return;
+            }
+            switch (left.type) {
+                case INT: filterColumns(left.ints, right.ints, comparison_operator, selection); break;
+                case FLOAT: filterColumns(left.floats, right.floats, comparison_operator, selection); break;
+                case STRING: filterColumns(left.strings, right.strings, comparison_operator, selection); break;
+            }
+            return;
+        }
+
+        // Two constants: the outcome is the same for every row
+        if (!check({})) {
+            selection.clear();
+        }
+    }
+
+    bool collectAttributes(std::vector<size_t>& attrs) const override {
+        for (const Operand* operand : {&left_operand, &right_operand}) {
+            if (operand->type == INDIRECT) {
+                attrs.push_back(operand->index);
+            }
+        }
+        return true;
+    }
+};
+
+// Children are evaluated in an order learned at runtime. The batch path
+// measures each child's cost per row and pass rate, and every
+// REORDER_INTERVAL batches the children are re-ranked: for AND the
+// cheapest filter per rejected row goes first, for OR the cheapest per
+// accepted row. Statistics are halved after each ranking so the order
+// follows drifting data. Scan workers share one predicate, so statistics
+// are relaxed atomics and the order is one packed word that is always a
+// valid permutation.
+class ComplexPredicate : public IPredicate {
+public:
+    enum LogicOperator { AND, OR };
+
+private:
+    struct ChildStats {
+        std::atomic<uint64_t> rows_in{0};
+        std::atomic<uint64_t> rows_out{0};
+        std::atomic<uint64_t> nanos{0};
+    };
+
+    static constexpr uint64_t REORDER_INTERVAL = 32;
+    // The order holds the positions of the first 16 children, four bits
+    // each; later children always run last, in insertion order
+    static constexpr size_t MAX_REORDERED = 16;
+    static constexpr uint64_t IDENTITY_ORDER = 0xFEDCBA9876543210ull;
+
+    std::vector<std::unique_ptr<IPredicate>> predicates;
+    LogicOperator logic_operator;
+    std::vector<std::unique_ptr<ChildStats>> stats;
+    mutable std::atomic<uint64_t> order{IDENTITY_ORDER};
+    mutable std::atomic<uint64_t> batches{0};
 
 public:
     ComplexPredicate(LogicOperator op) : logic_operator(op) {}
 
     void addPredicate(std::unique_ptr<IPredicate> predicate) {
         predicates.push_back(std::move(predicate));
+        stats.push_back(std::make_unique<ChildStats>());
+    }
+
+    LogicOperator getLogicOperator() const { return logic_operator; }
+    const std::vector<std::unique_ptr<IPredicate>>& getPredicates() const { return predicates; }
+
+    // Child indexes in the order they are currently evaluated
+    std::vector<size_t> getEvaluationOrder() const {
+        uint64_t current = order.load(std::memory_order_relaxed);
+        std::vector<size_t> result;
+        for (size_t i = 0; i < predicates.size(); ++i) {
+            result.push_back(childAt(current, i));
+        }
+        return result;
     }
 
     bool check(const std::vector<std::unique_ptr<Field>>& tupleFields) const {
-        
+        uint64_t current = order.load(std::memory_order_relaxed);
         if (logic_operator == AND) {
-            for (const auto& pred : predicates) {
-                if (!pred->check(tupleFields)) {
+            for (size_t i = 0; i < predicates.size(); ++i) {
+                if (!predicates[childAt(current, i)]->check(tupleFields)) {
                     return false; // If any predicate fails, the AND condition fails
                 }
             }
             return true; // All predicates passed
         } else if (logic_operator == OR) {
-            for (const auto& pred : predicates) {
-                if (pred->check(tupleFields)) {
+            for (size_t i = 0; i < predicates.size(); ++i) {
+                if (predicates[childAt(current, i)]->check(tupleFields)) {
                     return true; // If any predicate passes, the OR condition passes
                 }
             }
@@ -874,412 +1484,7262 @@ public:
         return false;
     }
 
+    void filter(const Batch& batch, std::vector<uint16_t>& selection) const override {
+        uint64_t current = order.load(std::memory_order_relaxed);
+        if (logic_operator == AND) {
+            // Each predicate only looks at the rows that survived the previous ones
+            for (size_t i = 0; i < predicates.size(); ++i) {
+                if (selection.empty()) {
+                    break;
+                }
+                size_t child = childAt(current, i);
+                size_t rows_in = selection.size();
+                auto start = std::chrono::steady_clock::now();
+                predicates[child]->filter(batch, selection);
+                record(child, rows_in, selection.size(), start);
+            }
+            maybeReorder();
+            return;
+        }
+
+        // OR: each predicate only looks at the rows that no previous one accepted
+        std::vector<uint16_t> remaining = selection;
+        std::vector<uint16_t> accepted;
+        for (size_t i = 0; i < predicates.size(); ++i) {
+            if (remaining.empty()) {
+                break;
+            }
+            size_t child = childAt(current, i);
+            std::vector<uint16_t> passed = remaining;
+            auto start = std::chrono::steady_clock::now();
+            predicates[child]->filter(batch, passed);
+            record(child, remaining.size(), passed.size(), start);
+
+            std::vector<uint16_t> merged;
+            std::merge(accepted.begin(), accepted.end(), passed.begin(), passed.end(),
+                       std::back_inserter(merged));
+            accepted.swap(merged);
+
+            std::vector<uint16_t> rest;
+            std::set_difference(remaining.begin(), remaining.end(), passed.begin(), passed.end(),
+                                std::back_inserter(rest));
+            remaining.swap(rest);
+        }
+        selection.swap(accepted);
+        maybeReorder();
+    }
+
+    bool collectAttributes(std::vector<size_t>& attrs) const override {
+        for (const auto& pred : predicates) {
+            if (!pred->collectAttributes(attrs)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static size_t childAt(uint64_t packed, size_t position) {
+        return position < MAX_REORDERED ? (packed >> (4 * position)) & 0xF : position;
+    }
+
+    void record(size_t child, size_t rows_in, size_t rows_out, std::chrono::steady_clock::time_point start) const {
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        ChildStats& child_stats = *stats[child];
+        child_stats.rows_in.fetch_add(rows_in, std::memory_order_relaxed);
+        child_stats.rows_out.fetch_add(rows_out, std::memory_order_relaxed);
+        child_stats.nanos.fetch_add(static_cast<uint64_t>(nanos.count()), std::memory_order_relaxed);
+    }
+
+    void maybeReorder() const {
+        if (batches.fetch_add(1, std::memory_order_relaxed) % REORDER_INTERVAL != REORDER_INTERVAL - 1) {
+            return;
+        }
+        size_t reordered = std::min(predicates.size(), MAX_REORDERED);
+        std::vector<double> rank(reordered);
+        for (size_t child = 0; child < reordered; ++child) {
+            ChildStats& child_stats = *stats[child];
+            uint64_t rows_in = child_stats.rows_in.load(std::memory_order_relaxed);
+            uint64_t rows_out = child_stats.rows_out.load(std::memory_order_relaxed);
+            uint64_t nanos = child_stats.nanos.load(std::memory_order_relaxed);
+            // Unmeasured children go first so they get measured
+            if (rows_in == 0) {
+                rank[child] = 0;
+            } else {
+                double cost = static_cast<double>(nanos + 1) / rows_in;
+                double pass = static_cast<double>(rows_out) / rows_in;
+                double useful = logic_operator == AND ? 1 - pass : pass;
+                rank[child] = cost / std::max(useful, 1e-3);
+            }
+            // Concurrent updates between load and store may be lost; they are only statistics
+            child_stats.rows_in.store(rows_in / 2, std::memory_order_relaxed);
+            child_stats.rows_out.store(rows_out / 2, std::memory_order_relaxed);
+            child_stats.nanos.store(nanos / 2, std::memory_order_relaxed);
+        }
+
+        std::vector<size_t> ranked(reordered);
+        std::iota(ranked.begin(), ranked.end(), 0);
+        std::stable_sort(ranked.begin(), ranked.end(), [&](size_t a, size_t b) { return rank[a] < rank[b]; });
+        uint64_t packed = IDENTITY_ORDER;
+        for (size_t position = 0; position < reordered; ++position) {
+            packed &= ~(uint64_t{0xF} << (4 * position));
+            packed |= static_cast<uint64_t>(ranked[position]) << (4 * position);
+        }
+        order.store(packed, std::memory_order_relaxed);
+    }
+};
+
+
+// Narrows an INT result computed in 64 bits, such as a product or a SUM,
+// failing instead of wrapping around
+int narrowInt(int64_t value) {
+    if (value < std::numeric_limits<int>::min() || value > std::numeric_limits<int>::max()) {
+        throw std::runtime_error("Result " + std::to_string(value) + " does not fit in INT.");
+    }
+    return static_cast<int>(value);
+}
 
+// Vectorized scalar expressions. evaluate() computes the expression for
+// the rows in `selection` of a batch and returns a column indexed like
+// the batch rows; values of unselected rows are unspecified. Nodes that
+// compute something write into `scratch`, column references return the
+// batch column itself, so a tree costs one virtual call per node and batch.
+class Expression {
+public:
+    virtual ~Expression() = default;
+    virtual const ColumnVector& evaluate(const Batch& batch, const std::vector<uint16_t>& selection,
+                                         ColumnVector& scratch) const = 0;
+    // Adds the attributes the expression reads to `attrs`
+    virtual void collectAttributes(std::vector<size_t>& attrs) const = 0;
 };
 
+class ColumnExpression : public Expression {
+private:
+    size_t attr;
+
+public:
+    explicit ColumnExpression(size_t attr) : attr(attr) {}
+
+    size_t getAttribute() const { return attr; }
 
-class SelectOperator : public UnaryOperator {
+    const ColumnVector& evaluate(const Batch& batch, const std::vector<uint16_t>&, ColumnVector&) const override {
+        return batch.columns.at(attr);
+    }
+
+    void collectAttributes(std::vector<size_t>& attrs) const override { attrs.push_back(attr); }
+};
+
+class ConstantExpression : public Expression {
 private:
-    std::unique_ptr<IPredicate> predicate;
-    bool has_next;
-    std::vector<std::unique_ptr<Field>> currentOutput; // Store the current output here
+    Field value;
 
 public:
-    SelectOperator(Operator& input, std::unique_ptr<IPredicate> predicate)
-        : UnaryOperator(input), predicate(std::move(predicate)), has_next(false) {}
+    explicit ConstantExpression(Field value) : value(std::move(value)) {}
+
+    const ColumnVector& evaluate(const Batch& batch, const std::vector<uint16_t>&,
+                                 ColumnVector& scratch) const override {
+        scratch.reset(value.getType(), 0);
+        switch (value.getType()) {
+            case INT: scratch.ints.assign(batch.count, value.asInt()); break;
+            case FLOAT: scratch.floats.assign(batch.count, value.asFloat()); break;
+            case STRING: scratch.strings.assign(batch.count, value.asString()); break;
+        }
+        return scratch;
+    }
 
-    void open() override {
-        input->open();
-        has_next = false;
-        currentOutput.clear(); // Ensure currentOutput is cleared at the beginning
+    void collectAttributes(std::vector<size_t>&) const override {}
+};
+
+// Values of an INT or FLOAT column as floats, for mixed arithmetic
+inline const std::vector<float>& asFloats(const ColumnVector& column, const std::vector<uint16_t>& selection,
+                                          size_t rows, std::vector<float>& converted) {
+    if (column.type == FLOAT) {
+        return column.floats;
+    }
+    if (column.type != INT) {
+        throw std::runtime_error("Expected a numeric value.");
     }
+    converted.resize(rows);
+    for (auto row : selection) {
+        converted[row] = static_cast<float>(column.ints[row]);
+    }
+    return converted;
+}
 
-    bool next() override {
-        while (input->next()) {
-            const auto& output = input->getOutput(); // Temporarily hold the output
-            if (predicate->check(output)) {
-                // If the predicate is satisfied, store the output in the member variable
-                currentOutput.clear(); // Clear previous output
-                for (const auto& field : output) {
-                    // Assuming Field class has a clone method or copy constructor to duplicate fields
-                    currentOutput.push_back(field->clone());
-                }
-                has_next = true;
-                return true;
+enum class ArithmeticOperator { ADD, SUB, MUL, DIV };
+
+// INT op INT stays INT (computed in 64 bits, then narrowed; results out
+// of range throw); any FLOAT operand makes the result FLOAT. Integer
+// division by zero throws.
+class ArithmeticExpression : public Expression {
+private:
+    ArithmeticOperator op;
+    std::unique_ptr<Expression> left;
+    std::unique_ptr<Expression> right;
+
+public:
+    ArithmeticExpression(ArithmeticOperator op, std::unique_ptr<Expression> left, std::unique_ptr<Expression> right)
+        : op(op), left(std::move(left)), right(std::move(right)) {}
+
+    const ColumnVector& evaluate(const Batch& batch, const std::vector<uint16_t>& selection,
+                                 ColumnVector& scratch) const override {
+        ColumnVector left_scratch, right_scratch;
+        const ColumnVector& l = left->evaluate(batch, selection, left_scratch);
+        const ColumnVector& r = right->evaluate(batch, selection, right_scratch);
+        // NULL operands give NULL; only the other rows are computed
+        std::vector<uint16_t> rows = nonNullRows(selection, {&l, &r});
+
+        if (l.type == INT && r.type == INT) {
+            std::vector<int> result(batch.count);
+            switch (op) {
+                case ArithmeticOperator::ADD: apply(rows, l.ints, r.ints, result, std::plus<int64_t>()); break;
+                case ArithmeticOperator::SUB: apply(rows, l.ints, r.ints, result, std::minus<int64_t>()); break;
+                case ArithmeticOperator::MUL: apply(rows, l.ints, r.ints, result, std::multiplies<int64_t>()); break;
+                case ArithmeticOperator::DIV:
+                    for (auto row : rows) {
+                        if (r.ints[row] == 0) {
+                            throw std::runtime_error("Division by zero.");
+                        }
+                    }
+                    apply(rows, l.ints, r.ints, result, std::divides<int64_t>());
+                    break;
             }
+            scratch.reset(INT, 0);
+            scratch.ints.swap(result);
+            propagateNulls(scratch, {&l, &r});
+            return scratch;
         }
-        has_next = false;
-        currentOutput.clear(); // Clear output if no more tuples satisfy the predicate
-        return false;
+
+        std::vector<float> left_converted, right_converted;
+        const std::vector<float>& lf = asFloats(l, rows, batch.count, left_converted);
+        const std::vector<float>& rf = asFloats(r, rows, batch.count, right_converted);
+        std::vector<float> result(batch.count);
+        switch (op) {
+            case ArithmeticOperator::ADD: apply(rows, lf, rf, result, std::plus<float>()); break;
+            case ArithmeticOperator::SUB: apply(rows, lf, rf, result, std::minus<float>()); break;
+            case ArithmeticOperator::MUL: apply(rows, lf, rf, result, std::multiplies<float>()); break;
+            case ArithmeticOperator::DIV: apply(rows, lf, rf, result, std::divides<float>()); break;
+        }
+        scratch.reset(FLOAT, 0);
+        scratch.floats.swap(result);
+        propagateNulls(scratch, {&l, &r});
+        return scratch;
     }
 
-    void close() override {
-        input->close();
-        currentOutput.clear(); // Ensure currentOutput is cleared at the end
+    void collectAttributes(std::vector<size_t>& attrs) const override {
+        left->collectAttributes(attrs);
+        right->collectAttributes(attrs);
     }
 
-    std::vector<std::unique_ptr<Field>> getOutput() override {
-        if (has_next) {
-            // Since currentOutput already holds the desired output, simply return it
-            // Need to create a deep copy to return since we're returning by value
-            std::vector<std::unique_ptr<Field>> outputCopy;
-            for (const auto& field : currentOutput) {
-                outputCopy.push_back(field->clone()); // Clone each field
+private:
+    template<typename In, typename Out, typename Op>
+    static void apply(const std::vector<uint16_t>& selection, const std::vector<In>& l, const std::vector<In>& r,
+                      std::vector<Out>& result, Op fn) {
+        for (auto row : selection) {
+            if constexpr (std::is_same_v<Out, int>) {
+                result[row] = narrowInt(fn(l[row], r[row]));
+            } else {
+                result[row] = static_cast<Out>(fn(l[row], r[row]));
             }
-            return outputCopy;
-        } else {
-            return {}; // Return an empty vector if no matching tuple is found
         }
     }
 };
 
-enum class AggrFuncType { COUNT, MAX, MIN, SUM };
+// CAST(expr AS type); strings are parsed strictly and throw if malformed
+class CastExpression : public Expression {
+private:
+    std::unique_ptr<Expression> input;
+    FieldType target;
 
-struct AggrFunc {
-    AggrFuncType func;
-    size_t attr_index; // Index of the attribute to aggregate
+public:
+    CastExpression(std::unique_ptr<Expression> input, FieldType target) : input(std::move(input)), target(target) {}
+
+    const ColumnVector& evaluate(const Batch& batch, const std::vector<uint16_t>& selection,
+                                 ColumnVector& scratch) const override {
+        // `in` may be `scratch` itself, which is only overwritten at the end
+        const ColumnVector& in = input->evaluate(batch, selection, scratch);
+        if (in.type == target) {
+            return in;
+        }
+        ColumnVector result;
+        result.reset(target, batch.count);
+        for (auto row : nonNullRows(selection, {&in})) {
+            switch (target) {
+                case INT: result.ints[row] = in.type == FLOAT ? static_cast<int>(in.floats[row])
+                                                              : parseString<int>(in.strings[row]); break;
+                case FLOAT: result.floats[row] = in.type == INT ? static_cast<float>(in.ints[row])
+                                                                : parseString<float>(in.strings[row]); break;
+                case STRING: {
+                    std::ostringstream out;
+                    if (in.type == INT) {
+                        out << in.ints[row];
+                    } else {
+                        out << in.floats[row];
+                    }
+                    result.strings[row] = out.str();
+                    break;
+                }
+            }
+        }
+        propagateNulls(result, {&in});
+        scratch = std::move(result);
+        return scratch;
+    }
+
+    void collectAttributes(std::vector<size_t>& attrs) const override { input->collectAttributes(attrs); }
+
+private:
+    template<typename T>
+    static T parseString(const std::string& text) {
+        T value;
+        auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (result.ec != std::errc() || result.ptr != text.data() + text.size()) {
+            throw std::runtime_error("Cannot cast '" + text + "'.");
+        }
+        return value;
+    }
 };
 
-class HashAggregationOperator : public UnaryOperator {
+// CASE WHEN c1 THEN e1 ... ELSE e END. Each row takes the first branch
+// whose condition holds; conditions only see rows no earlier branch took.
+// All branches must produce the same type.
+class CaseExpression : public Expression {
+public:
+    using Branch = std::pair<std::unique_ptr<IPredicate>, std::unique_ptr<Expression>>;
+
 private:
-    std::vector<size_t> group_by_attrs;
-    std::vector<AggrFunc> aggr_funcs;
-    std::vector<Tuple> output_tuples; // Use your Tuple class for output
-    size_t output_tuples_index = 0;
+    std::vector<Branch> branches;
+    std::unique_ptr<Expression> otherwise;
+
+public:
+    CaseExpression(std::vector<Branch> branches, std::unique_ptr<Expression> otherwise)
+        : branches(std::move(branches)), otherwise(std::move(otherwise)) {}
+
+    const ColumnVector& evaluate(const Batch& batch, const std::vector<uint16_t>& selection,
+                                 ColumnVector& scratch) const override {
+        ColumnVector result;
+        bool typed = false;
+        std::vector<uint16_t> remaining = selection;
+        std::vector<uint16_t> null_rows;
+        auto take = [&](const Expression& expression, const std::vector<uint16_t>& rows) {
+            ColumnVector branch_scratch;
+            const ColumnVector& values = expression.evaluate(batch, rows, branch_scratch);
+            for (auto row : rows) {
+                if (values.isNull(row)) {
+                    null_rows.push_back(row);
+                }
+            }
+            if (values.allNull(rows)) {
+                return; // Only NULLs carry no type
+            }
+            if (!typed) {
+                result.reset(values.type, batch.count);
+                typed = true;
+            } else if (values.type != result.type) {
+                throw std::runtime_error("CASE branches have different types.");
+            }
+            for (auto row : rows) {
+                switch (values.type) {
+                    case INT: result.ints[row] = values.ints[row]; break;
+                    case FLOAT: result.floats[row] = values.floats[row]; break;
+                    case STRING: result.strings[row] = values.strings[row]; break;
+                }
+            }
+        };
 
-    struct FieldVectorHasher {
-        std::size_t operator()(const std::vector<Field>& fields) const {
-            std::size_t hash = 0;
-            for (const auto& field : fields) {
-                std::hash<std::string> hasher;
-                std::size_t fieldHash = 0;
+        for (const auto& branch : branches) {
+            std::vector<uint16_t> matched = remaining;
+            branch.first->filter(batch, matched);
+            take(*branch.second, matched);
+            std::vector<uint16_t> rest;
+            std::set_difference(remaining.begin(), remaining.end(), matched.begin(), matched.end(),
+                                std::back_inserter(rest));
+            remaining.swap(rest);
+        }
+        take(*otherwise, remaining);
+        if (!typed) {
+            result.reset(INT, batch.count);
+        }
+        for (auto row : null_rows) {
+            result.setNull(row);
+        }
+        scratch = std::move(result);
+        return scratch;
+    }
 
-                // Depending on the type, hash the corresponding data
-                switch (field.type) {
-                    case INT: {
-                        // Convert integer data to string and hash
-                        int value = *reinterpret_cast<const int*>(field.data.get());
-                        fieldHash = hasher(std::to_string(value));
-                        break;
+    void collectAttributes(std::vector<size_t>& attrs) const override {
+        for (const auto& branch : branches) {
+            branch.first->collectAttributes(attrs);
+            branch.second->collectAttributes(attrs);
+        }
+        otherwise->collectAttributes(attrs);
+    }
+};
+
+// Dates are INT day numbers counted from 1970-01-01, so date arithmetic
+// is integer arithmetic. Conversions follow the proleptic Gregorian calendar.
+inline int daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int year_of_era = year - era * 400;
+    const int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+inline void civilFromDays(int days, int& year, int& month, int& day) {
+    days += 719468;
+    const int era = (days >= 0 ? days : days - 146096) / 146097;
+    const int day_of_era = days - era * 146097;
+    const int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const int shifted_month = (5 * day_of_year + 2) / 153;
+    day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    month = shifted_month + (shifted_month < 10 ? 3 : -9);
+    year = year_of_era + era * 400 + (month <= 2);
+}
+
+// Day number of a "YYYY-MM-DD" literal
+inline int parseDate(const std::string& text) {
+    int year, month, day;
+    char dash1, dash2;
+    std::istringstream in(text);
+    if (!(in >> year >> dash1 >> month >> dash2 >> day) || dash1 != '-' || dash2 != '-' ||
+        month < 1 || month > 12 || day < 1 || day > 31) {
+        throw std::runtime_error("Invalid date '" + text + "'.");
+    }
+    return daysFromCivil(year, month, day);
+}
+
+enum class ScalarFunction { UPPER, LOWER, LENGTH, SUBSTR, CONCAT, ABS, YEAR, MONTH, DAY };
+
+// Built-in functions. SUBSTR(s, start, length) counts from 1; YEAR, MONTH
+// and DAY take a day number.
+class FunctionExpression : public Expression {
+private:
+    ScalarFunction function;
+    std::vector<std::unique_ptr<Expression>> args;
+
+public:
+    FunctionExpression(ScalarFunction function, std::vector<std::unique_ptr<Expression>> args)
+        : function(function), args(std::move(args)) {
+        size_t expected = function == ScalarFunction::SUBSTR ? 3 : function == ScalarFunction::CONCAT ? 2 : 1;
+        if (this->args.size() != expected) {
+            throw std::runtime_error("Wrong number of function arguments.");
+        }
+    }
+
+    const ColumnVector& evaluate(const Batch& batch, const std::vector<uint16_t>& selection,
+                                 ColumnVector& scratch) const override {
+        std::vector<ColumnVector> arg_scratch(args.size());
+        std::vector<const ColumnVector*> values;
+        for (size_t i = 0; i < args.size(); ++i) {
+            values.push_back(&args[i]->evaluate(batch, selection, arg_scratch[i]));
+        }
+        const ColumnVector& first = *values[0];
+        ColumnVector result;
+        // NULL arguments give NULL; only the other rows are computed
+        std::vector<uint16_t> rows = selection;
+        for (const ColumnVector* value : values) {
+            if (value->hasNulls()) {
+                rows = nonNullRows(rows, {value});
+            }
+        }
+        auto expect = [&](const ColumnVector& column, FieldType type) {
+            if (!rows.empty() && column.type != type) {
+                throw std::runtime_error("Function argument has the wrong type.");
+            }
+        };
+
+        switch (function) {
+            case ScalarFunction::UPPER:
+            case ScalarFunction::LOWER: {
+                expect(first, STRING);
+                result.reset(STRING, batch.count);
+                auto convert = function == ScalarFunction::UPPER ? ::toupper : ::tolower;
+                for (auto row : rows) {
+                    std::string& out = result.strings[row];
+                    out = first.strings[row];
+                    for (auto& c : out) {
+                        c = static_cast<char>(convert(static_cast<unsigned char>(c)));
                     }
-                    case FLOAT: {
-                        // Convert float data to string and hash
-                        float value = *reinterpret_cast<const float*>(field.data.get());
-                        fieldHash = hasher(std::to_string(value));
-                        break;
+                }
+                break;
+            }
+            case ScalarFunction::LENGTH:
+                expect(first, STRING);
+                result.reset(INT, batch.count);
+                for (auto row : rows) {
+                    result.ints[row] = static_cast<int>(first.strings[row].size());
+                }
+                break;
+            case ScalarFunction::SUBSTR: {
+                expect(first, STRING);
+                expect(*values[1], INT);
+                expect(*values[2], INT);
+                result.reset(STRING, batch.count);
+                for (auto row : rows) {
+                    const std::string& text = first.strings[row];
+                    size_t start = static_cast<size_t>(std::max(values[1]->ints[row] - 1, 0));
+                    size_t length = static_cast<size_t>(std::max(values[2]->ints[row], 0));
+                    result.strings[row] = start < text.size() ? text.substr(start, length) : std::string();
+                }
+                break;
+            }
+            case ScalarFunction::CONCAT:
+                expect(first, STRING);
+                expect(*values[1], STRING);
+                result.reset(STRING, batch.count);
+                for (auto row : rows) {
+                    result.strings[row] = first.strings[row] + values[1]->strings[row];
+                }
+                break;
+            case ScalarFunction::ABS:
+                result.reset(first.type, batch.count);
+                if (first.type == INT) {
+                    for (auto row : rows) {
+                        result.ints[row] = narrowInt(std::abs(static_cast<int64_t>(first.ints[row])));
                     }
-                    case STRING: {
-                        // Directly hash the string data
-                        std::string value(field.data.get(), field.data_length - 1); // Exclude null-terminator
-                        fieldHash = hasher(value);
-                        break;
+                } else {
+                    expect(first, FLOAT);
+                    for (auto row : rows) {
+                        result.floats[row] = std::fabs(first.floats[row]);
                     }
-                    default:
-                        throw std::runtime_error("Unsupported field type for hashing.");
                 }
+                break;
+            case ScalarFunction::YEAR:
+            case ScalarFunction::MONTH:
+            case ScalarFunction::DAY:
+                expect(first, INT);
+                result.reset(INT, batch.count);
+                for (auto row : rows) {
+                    int year, month, day;
+                    civilFromDays(first.ints[row], year, month, day);
+                    result.ints[row] = function == ScalarFunction::YEAR ? year
+                                       : function == ScalarFunction::MONTH ? month : day;
+                }
+                break;
+        }
+        for (const ColumnVector* value : values) {
+            propagateNulls(result, {value});
+        }
+        scratch = std::move(result);
+        return scratch;
+    }
 
-                // Combine the hash of the current field with the hash so far
-                hash ^= fieldHash + 0x9e3779b9 + (hash << 6) + (hash >> 2);
-            }
-            return hash;
+    void collectAttributes(std::vector<size_t>& attrs) const override {
+        for (const auto& arg : args) {
+            arg->collectAttributes(attrs);
         }
-    };
+    }
+
+};
 
+// Comparison of two expressions. INT and FLOAT operands are compared as
+// floats; comparing a string with a number never matches, as in
+// SimplePredicate.
+class ExpressionPredicate : public IPredicate {
+private:
+    std::unique_ptr<Expression> left;
+    SimplePredicate::ComparisonOperator op;
+    std::unique_ptr<Expression> right;
 
 public:
-    HashAggregationOperator(Operator& input, std::vector<size_t> group_by_attrs, std::vector<AggrFunc> aggr_funcs)
-        : UnaryOperator(input), group_by_attrs(group_by_attrs), aggr_funcs(aggr_funcs) {}
+    ExpressionPredicate(std::unique_ptr<Expression> left, SimplePredicate::ComparisonOperator op,
+                        std::unique_ptr<Expression> right)
+        : left(std::move(left)), op(op), right(std::move(right)) {}
+
+    bool check(const std::vector<std::unique_ptr<Field>>& tupleFields) const override {
+        Batch batch;
+        batch.appendRow(tupleFields);
+        filter(batch, batch.selection);
+        return !batch.selection.empty();
+    }
 
-    void open() override {
-        input->open(); // Ensure the input operator is opened
-        output_tuples_index = 0;
-        output_tuples.clear();
+    void filter(const Batch& batch, std::vector<uint16_t>& selection) const override {
+        ColumnVector left_scratch, right_scratch;
+        const ColumnVector& l = left->evaluate(batch, selection, left_scratch);
+        const ColumnVector& r = right->evaluate(batch, selection, right_scratch);
+        if (l.hasNulls() || r.hasNulls()) {
+            selection = nonNullRows(selection, {&l, &r});
+            if (selection.empty()) {
+                return;
+            }
+        }
+        if (l.type == r.type) {
+            switch (l.type) {
+                case INT: compare(l.ints, r.ints, selection); return;
+                case FLOAT: compare(l.floats, r.floats, selection); return;
+                case STRING: compare(l.strings, r.strings, selection); return;
+            }
+        }
+        if (l.type == STRING || r.type == STRING) {
+            std::cerr << "Error: Comparing fields of different types.\n";
+            selection.clear();
+            return;
+        }
+        std::vector<float> left_converted, right_converted;
+        compare(asFloats(l, selection, batch.count, left_converted),
+                asFloats(r, selection, batch.count, right_converted), selection);
+    }
+
+    bool collectAttributes(std::vector<size_t>& attrs) const override {
+        left->collectAttributes(attrs);
+        right->collectAttributes(attrs);
+        return true;
+    }
 
-        // Assume a hash map to aggregate tuples based on group_by_attrs
-        std::unordered_map<std::vector<Field>, std::vector<Field>, FieldVectorHasher> hash_table;
+private:
+    template<typename T>
+    void compare(const std::vector<T>& l, const std::vector<T>& r, std::vector<uint16_t>& selection) const {
+        size_t out = 0;
+        for (auto row : selection) {
+            bool keep = false;
+            switch (op) {
+                case SimplePredicate::EQ: keep = l[row] == r[row]; break;
+                case SimplePredicate::NE: keep = l[row] != r[row]; break;
+                case SimplePredicate::GT: keep = l[row] > r[row]; break;
+                case SimplePredicate::GE: keep = l[row] >= r[row]; break;
+                case SimplePredicate::LT: keep = l[row] < r[row]; break;
+                case SimplePredicate::LE: keep = l[row] <= r[row]; break;
+            }
+            selection[out] = row;
+            out += keep;
+        }
+        selection.resize(out);
+    }
+};
 
-        while (input->next()) {
-            const auto& tuple = input->getOutput(); // Assume getOutput returns a reference to the current tuple
+// `{attr} op constant` after moving the column to the left
+struct IntComparison {
+    size_t attr;
+    SimplePredicate::ComparisonOperator op;
+    int constant;
+};
+
+// Collects the column-versus-INT-constant comparisons among the
+// conjuncts of `predicate`. Returns true if they make up the whole
+// predicate, false if other conjuncts remain.
+inline bool extractIntComparisons(const IPredicate& predicate, std::vector<IntComparison>& comparisons) {
+    if (auto complex = dynamic_cast<const ComplexPredicate*>(&predicate)) {
+        if (complex->getLogicOperator() != ComplexPredicate::AND) {
+            return false;
+        }
+        bool complete = true;
+        for (const auto& child : complex->getPredicates()) {
+            complete &= extractIntComparisons(*child, comparisons);
+        }
+        return complete;
+    }
+    auto simple = dynamic_cast<const SimplePredicate*>(&predicate);
+    if (!simple) {
+        return false;
+    }
+    const auto& left = simple->left_operand;
+    const auto& right = simple->right_operand;
+    bool column_left = left.type == SimplePredicate::INDIRECT;
+    const auto& column = column_left ? left : right;
+    const auto& constant = column_left ? right : left;
+    if (column.type != SimplePredicate::INDIRECT || constant.type != SimplePredicate::DIRECT ||
+        constant.directValue->getType() != INT) {
+        return false;
+    }
+    auto op = column_left ? simple->comparison_operator : SimplePredicate::flip(simple->comparison_operator);
+    comparisons.push_back({column.index, op, constant.directValue->asInt()});
+    return true;
+}
+
+// Predicate pushed into a scan. INT comparisons of its top-level
+// conjunction are folded into one inclusive range per column and checked
+// on the serialized tuple bytes, so rows outside a range are never
+// decoded. Whatever the ranges cannot express is evaluated on the decoded
+// rows by the original predicate.
+class ScanPredicate {
+private:
+    struct IntRange {
+        size_t attr;
+        int64_t lower;
+        int64_t upper;
+    };
+
+    std::vector<IntRange> ranges; // Sorted by attribute
+    std::unique_ptr<IPredicate> predicate;
+    bool exact = false; // The ranges alone decide
+
+public:
+    explicit ScanPredicate(std::unique_ptr<IPredicate> predicate) : predicate(std::move(predicate)) {
+        refresh();
+    }
+
+    // Derives the ranges from the predicate's constants again, after a
+    // prepared statement bound new values to them
+    void refresh() {
+        ranges.clear();
+        std::vector<IntComparison> comparisons;
+        exact = extractIntComparisons(*predicate, comparisons);
+        for (const auto& comparison : comparisons) {
+            int64_t lower = std::numeric_limits<int>::min();
+            int64_t upper = std::numeric_limits<int>::max();
+            switch (comparison.op) {
+                case SimplePredicate::EQ: lower = upper = comparison.constant; break;
+                case SimplePredicate::GT: lower = int64_t(comparison.constant) + 1; break;
+                case SimplePredicate::GE: lower = comparison.constant; break;
+                case SimplePredicate::LT: upper = int64_t(comparison.constant) - 1; break;
+                case SimplePredicate::LE: upper = comparison.constant; break;
+                case SimplePredicate::NE: exact = false; continue;
+            }
+            auto range = std::find_if(ranges.begin(), ranges.end(),
+                                      [&](const IntRange& r) { return r.attr == comparison.attr; });
+            if (range == ranges.end()) {
+                ranges.push_back({comparison.attr, lower, upper});
+            } else {
+                range->lower = std::max(range->lower, lower);
+                range->upper = std::min(range->upper, upper);
+            }
+        }
+        std::sort(ranges.begin(), ranges.end(),
+                  [](const IntRange& a, const IntRange& b) { return a.attr < b.attr; });
+    }
+
+    // Range check on a serialized tuple. Fields are skipped without
+    // decoding and the check stops at the first range that fails.
+    bool matchesRaw(const char* data, size_t length) const {
+        if (ranges.empty()) {
+            return true;
+        }
+        const char* end = data + length;
+        size_t field_count;
+        data = parseNumber(data, end, field_count);
+        size_t next = 0;
+        for (size_t i = 0; i < field_count; ++i) {
+            int type;
+            size_t field_length;
+            data = parseNumber(data, end, type);
+            data = parseNumber(data, end, field_length);
+            if (i != ranges[next].attr) {
+                data = std::find(skipSpaces(data, end), end, ' ');
+                continue;
+            }
+            if (type != INT) {
+                return false; // Comparing fields of different types never matches
+            }
+            int value;
+            data = parseNumber(data, end, value);
+            if (value < ranges[next].lower || value > ranges[next].upper) {
+                return false;
+            }
+            if (++next == ranges.size()) {
+                return true;
+            }
+        }
+        return false; // A range refers to a missing field
+    }
+
+    bool hasResidual() const { return !exact; }
+
+    // Attributes the residual predicate reads; false if unknown
+    bool residualAttributes(std::vector<size_t>& attrs) const {
+        return exact || predicate->collectAttributes(attrs);
+    }
+
+    // Applies the residual predicate to rows that passed matchesRaw()
+    void filter(const Batch& batch, std::vector<uint16_t>& selection) const {
+        if (!exact && !selection.empty()) {
+            predicate->filter(batch, selection);
+        }
+    }
+
+    bool check(const std::vector<std::unique_ptr<Field>>& fields) const {
+        return exact || predicate->check(fields);
+    }
+};
+
+class ScanOperator : public Operator {
+private:
+    BufferManager& bufferManager;
+    size_t currentPageIndex = 0;
+    size_t currentSlotIndex = 0;
+    std::unique_ptr<Tuple> currentTuple;
+    size_t tuple_count = 0;
+    std::unique_ptr<ScanPredicate> predicate; // May be null
+    std::optional<std::vector<size_t>> pages; // Pages to read; all if unset
+
+    // Reads all pages through the CircularScan of the buffer manager
+    bool shared = false;
+    std::optional<size_t> scan_id; // Set while attached
+    size_t start_page = 0;
+    size_t circular_pages = 0;
+    CircularScan::Page shared_page;
+    size_t shared_page_index = 0;
+    // Copy of the page at buffered_page_index for scans of their own, so
+    // each page is requested from the pool once
+    std::vector<char> page_copy;
+    std::optional<size_t> buffered_page_index;
+
+    // Output columns; empty means every field of the stored tuples
+    std::vector<size_t> projection;
+    // Field -> column maps for decoding; empty means decode every field
+    std::vector<int> output_map;
+    std::vector<int> filter_map;
+    size_t output_width = 0;
+    size_t filter_width = 0;
+    // (column, source column) pairs for attributes projected twice
+    std::vector<std::pair<size_t, size_t>> repeated_columns;
+    Batch filter_batch;
+    std::vector<Slot> candidates;
+
+public:
+    ScanOperator(BufferManager& manager) : bufferManager(manager) {}
+
+    ~ScanOperator() override {
+        detach();
+    }
+
+    // Makes the scan return only the rows satisfying `pushed`
+    void pushPredicate(std::unique_ptr<IPredicate> pushed) {
+        predicate = std::make_unique<ScanPredicate>(std::move(pushed));
+    }
+
+    // Makes the scan return only the given attributes, in this order.
+    // A pushed predicate keeps referring to the stored attributes.
+    void setProjection(std::vector<size_t> attrs) {
+        projection = std::move(attrs);
+    }
+
+    // Restricts the scan to the given pages, read in this order
+    void setPages(std::vector<size_t> page_ids) {
+        pages = std::move(page_ids);
+    }
+
+    // Lets a scan of all pages join the scans in progress, so its rows
+    // come in no particular page order
+    void setShared(bool share) {
+        shared = share;
+    }
+
+    void open() override {
+        currentPageIndex = 0;
+        currentSlotIndex = 0;
+        currentTuple.reset(); // Ensure currentTuple is reset
+        buffered_page_index.reset();
+        detach();
+        if (shared && !pages) {
+            circular_pages = bufferManager.getNumPages();
+            scan_id = bufferManager.getCircularScan().attach(circular_pages, start_page);
+        }
+        if (predicate) {
+            predicate->refresh();
+        }
+
+        output_map = projection.empty() ? std::vector<int>() : columnMap(projection, false);
+        filter_map.clear();
+        std::vector<size_t> filter_attrs;
+        if (predicate && predicate->hasResidual() && predicate->residualAttributes(filter_attrs)) {
+            filter_map = columnMap(filter_attrs, true);
+        }
+        output_width = projection.empty() ? 0 : projection.size();
+        filter_width = mappedColumns(filter_map);
+        repeated_columns.clear();
+        for (size_t i = 0; i < projection.size(); ++i) {
+            size_t source = static_cast<size_t>(output_map[projection[i]]);
+            if (source != i) {
+                repeated_columns.emplace_back(i, source);
+            }
+        }
+    }
+
+    bool next() override {
+        loadNextTuple();
+        return currentTuple != nullptr;
+    }
+
+    bool nextBatch(Batch& batch) override {
+        batch.clear();
+        while (!batch.full() && currentPageIndex < numPages()) {
+            const char* page_buffer = pageData();
+            const Slot* slot_array = reinterpret_cast<const Slot*>(page_buffer);
+
+            // Rows passing the range checks, at most as many as still fit
+            candidates.clear();
+            while (currentSlotIndex < MAX_SLOTS && batch.count + candidates.size() < BATCH_SIZE) {
+                const Slot& slot = slot_array[currentSlotIndex++];
+                if (!slot.empty) {
+                    assert(slot.offset != INVALID_VALUE);
+                    tuple_count++;
+                    if (!predicate || predicate->matchesRaw(page_buffer + slot.offset, slot.length)) {
+                        candidates.push_back(slot);
+                    }
+                }
+            }
+
+            if (predicate && predicate->hasResidual() && !candidates.empty()) {
+                // Late materialization: the residual predicate runs on its own
+                // columns only, and the output columns are decoded for survivors
+                filter_batch.clear();
+                for (const Slot& slot : candidates) {
+                    decode(page_buffer + slot.offset, slot.length, filter_batch, filter_map, filter_width);
+                }
+                filter_batch.selectAll();
+                predicate->filter(filter_batch, filter_batch.selection);
+                for (auto row : filter_batch.selection) {
+                    decode(page_buffer + candidates[row].offset, candidates[row].length, batch, output_map, output_width);
+                }
+            } else {
+                for (const Slot& slot : candidates) {
+                    decode(page_buffer + slot.offset, slot.length, batch, output_map, output_width);
+                }
+            }
+
+            if (currentSlotIndex >= MAX_SLOTS) {
+                currentSlotIndex = 0;
+                currentPageIndex++;
+            }
+        }
+
+        if (batch.count > 0) {
+            for (const auto& [column, source] : repeated_columns) {
+                batch.columns[column] = batch.columns[source];
+            }
+        }
+        batch.selectAll();
+        return batch.count > 0;
+    }
+
+    void close() override {
+        std::cout << "Scan Operator tuple_count: " << tuple_count << "\n";
+        currentPageIndex = 0;
+        currentSlotIndex = 0;
+        currentTuple.reset();
+        buffered_page_index.reset();
+        detach();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        if (currentTuple) {
+            return std::move(currentTuple->fields);
+        }
+        return {}; // Return an empty vector if no tuple is available
+    }
+
+private:
+    size_t numPages() const {
+        return pages ? pages->size() : scan_id ? circular_pages : bufferManager.getNumPages();
+    }
+
+    int pageId(size_t index) const {
+        if (pages) {
+            return static_cast<int>((*pages)[index]);
+        }
+        return static_cast<int>(scan_id ? (start_page + index) % circular_pages : index);
+    }
+
+    // Contents of the page at currentPageIndex
+    const char* pageData() {
+        if (!scan_id) {
+            if (buffered_page_index != currentPageIndex) {
+                page_copy.resize(PAGE_SIZE);
+                bufferManager.readPage(pageId(currentPageIndex), page_copy.data());
+                buffered_page_index = currentPageIndex;
+            }
+            return page_copy.data();
+        }
+        if (!shared_page || shared_page_index != currentPageIndex) {
+            shared_page = bufferManager.getCircularScan().read(*scan_id, currentPageIndex,
+                                                               bufferManager.getTableVersion());
+            shared_page_index = currentPageIndex;
+        }
+        return shared_page->data();
+    }
+
+    void detach() {
+        if (scan_id) {
+            bufferManager.getCircularScan().detach(*scan_id);
+            scan_id.reset();
+        }
+        shared_page.reset();
+    }
+
+    void loadNextTuple() {
+        while (currentPageIndex < numPages()) {
+            const char* page_buffer = pageData();
+            if (currentSlotIndex >= MAX_SLOTS) {
+                currentSlotIndex = 0; // Reset slot index when moving to a new page
+            }
+
+            const Slot* slot_array = reinterpret_cast<const Slot*>(page_buffer);
+
+            while (currentSlotIndex < MAX_SLOTS) {
+                if (!slot_array[currentSlotIndex].empty) {
+                    assert(slot_array[currentSlotIndex].offset != INVALID_VALUE);
+                    const char* tuple_data = page_buffer + slot_array[currentSlotIndex].offset;
+                    size_t tuple_length = slot_array[currentSlotIndex].length;
+                    currentSlotIndex++; // Move to the next slot for the next call
+                    tuple_count++;
+                    if (predicate && !predicate->matchesRaw(tuple_data, tuple_length)) {
+                        continue;
+                    }
+                    std::istringstream iss(std::string(tuple_data, tuple_length));
+                    currentTuple = Tuple::deserialize(iss);
+                    if (predicate && !predicate->check(currentTuple->fields)) {
+                        continue;
+                    }
+                    if (!projection.empty()) {
+                        auto projected = std::make_unique<Tuple>();
+                        for (auto attr : projection) {
+                            projected->addField(currentTuple->fields.at(attr)->clone());
+                        }
+                        currentTuple = std::move(projected);
+                    }
+                    return; // Tuple loaded successfully
+                }
+                currentSlotIndex++;
+            }
+
+            // Increment page index after exhausting current page
+            currentPageIndex++;
+        }
+
+        // No more tuples are available
+        currentTuple.reset();
+    }
+
+public:
+    // Decodes one serialized tuple straight into the batch columns,
+    // avoiding the istringstream and Field allocations of Tuple::deserialize
+    static void parseTuple(const char* data, size_t length, Batch& batch) {
+        const char* end = data + length;
+        size_t field_count;
+        data = parseNumber(data, end, field_count);
+        if (batch.count == 0) {
+            batch.columns.resize(field_count);
+        } else if (batch.columns.size() != field_count) {
+            throw std::runtime_error("Tuples with different arity in one batch.");
+        }
+
+        for (size_t i = 0; i < field_count; ++i) {
+            int type;
+            size_t field_length;
+            data = parseNumber(data, end, type);
+            data = parseNumber(data, end, field_length);
+            data = parseValue(data, end, static_cast<FieldType>(type), batch.columns[i]);
+        }
+        batch.count++;
+    }
+
+    // Decodes only the fields with a column in `column_map` into a batch of
+    // `num_columns` columns; the other fields are skipped
+    static void parseTuple(const char* data, size_t length, Batch& batch,
+                           const std::vector<int>& column_map, size_t num_columns) {
+        const char* end = data + length;
+        size_t field_count;
+        data = parseNumber(data, end, field_count);
+        if (field_count < column_map.size()) {
+            throw std::runtime_error("Tuple is missing a projected field.");
+        }
+        if (batch.count == 0) {
+            batch.columns.resize(num_columns);
+        }
+
+        for (size_t i = 0; i < column_map.size(); ++i) {
+            int type;
+            size_t field_length;
+            data = parseNumber(data, end, type);
+            data = parseNumber(data, end, field_length);
+            if (column_map[i] < 0) {
+                data = std::find(skipSpaces(data, end), end, ' ');
+            } else {
+                data = parseValue(data, end, static_cast<FieldType>(type), batch.columns[column_map[i]]);
+            }
+        }
+        batch.count++;
+    }
+
+    // Field -> column map for decoding `attrs`: to consecutive columns in
+    // the order given, or with `keep_positions` to the attribute's own
+    // index. A repeated attribute maps to its first column only.
+    static std::vector<int> columnMap(const std::vector<size_t>& attrs, bool keep_positions) {
+        std::vector<int> column_map;
+        for (size_t i = 0; i < attrs.size(); ++i) {
+            if (attrs[i] >= column_map.size()) {
+                column_map.resize(attrs[i] + 1, -1);
+            }
+            if (column_map[attrs[i]] < 0) {
+                column_map[attrs[i]] = static_cast<int>(keep_positions ? attrs[i] : i);
+            }
+        }
+        return column_map;
+    }
+
+    // Number of batch columns a column map writes to
+    static size_t mappedColumns(const std::vector<int>& column_map) {
+        int max_column = -1;
+        for (auto column : column_map) {
+            max_column = std::max(max_column, column);
+        }
+        return static_cast<size_t>(max_column + 1);
+    }
+
+private:
+    static const char* parseValue(const char* data, const char* end, FieldType type, ColumnVector& column) {
+        column.setType(type);
+        switch (type) {
+            case INT: {
+                int value;
+                data = parseNumber(data, end, value);
+                column.ints.push_back(value);
+                break;
+            }
+            case FLOAT: {
+                float value;
+                data = parseNumber(data, end, value);
+                column.floats.push_back(value);
+                break;
+            }
+            case STRING: {
+                data = skipSpaces(data, end);
+                const char* token_end = std::find(data, end, ' ');
+                column.strings.emplace_back(data, token_end);
+                data = token_end;
+                break;
+            }
+        }
+        return data;
+    }
+
+    static void decode(const char* data, size_t length, Batch& batch,
+                       const std::vector<int>& column_map, size_t num_columns) {
+        if (column_map.empty()) {
+            parseTuple(data, length, batch);
+        } else {
+            parseTuple(data, length, batch, column_map, num_columns);
+        }
+    }
+};
+
+class SelectOperator : public UnaryOperator {
+private:
+    std::unique_ptr<IPredicate> predicate;
+    bool has_next;
+    std::vector<std::unique_ptr<Field>> currentOutput; // Store the current output here
+
+public:
+    SelectOperator(Operator& input, std::unique_ptr<IPredicate> predicate)
+        : UnaryOperator(input), predicate(std::move(predicate)), has_next(false) {}
+
+    void open() override {
+        input->open();
+        has_next = false;
+        currentOutput.clear(); // Ensure currentOutput is cleared at the beginning
+    }
+
+    bool next() override {
+        while (input->next()) {
+            const auto& output = input->getOutput(); // Temporarily hold the output
+            if (predicate->check(output)) {
+                // If the predicate is satisfied, store the output in the member variable
+                currentOutput.clear(); // Clear previous output
+                for (const auto& field : output) {
+                    // Assuming Field class has a clone method or copy constructor to duplicate fields
+                    currentOutput.push_back(field ? field->clone() : nullptr);
+                }
+                has_next = true;
+                return true;
+            }
+        }
+        has_next = false;
+        currentOutput.clear(); // Clear output if no more tuples satisfy the predicate
+        return false;
+    }
+
+    bool nextBatch(Batch& batch) override {
+        while (input->nextBatch(batch)) {
+            predicate->filter(batch, batch.selection);
+            if (!batch.selection.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<SortKey> getOrdering() const override {
+        return input->getOrdering();
+    }
+
+    void close() override {
+        input->close();
+        currentOutput.clear(); // Ensure currentOutput is cleared at the end
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        if (has_next) {
+            // Since currentOutput already holds the desired output, simply return it
+            // Need to create a deep copy to return since we're returning by value
+            std::vector<std::unique_ptr<Field>> outputCopy;
+            for (const auto& field : currentOutput) {
+                outputCopy.push_back(field ? field->clone() : nullptr); // Clone each field
+            }
+            return outputCopy;
+        } else {
+            return {}; // Return an empty vector if no matching tuple is found
+        }
+    }
+};
+
+// Computes one output column per expression for each input row. Plain
+// attribute lists become column references, which share the input column.
+class ProjectionOperator : public UnaryOperator {
+private:
+    std::vector<std::unique_ptr<Expression>> expressions;
+    std::vector<std::unique_ptr<Field>> currentOutput;
+    Batch input_batch;
+
+public:
+    ProjectionOperator(Operator& input, std::vector<std::unique_ptr<Expression>> expressions)
+        : UnaryOperator(input), expressions(std::move(expressions)) {}
+
+    ProjectionOperator(Operator& input, const std::vector<size_t>& attrs) : UnaryOperator(input) {
+        for (auto attr : attrs) {
+            expressions.push_back(std::make_unique<ColumnExpression>(attr));
+        }
+    }
+
+    void open() override {
+        input->open();
+        currentOutput.clear();
+    }
+
+    bool next() override {
+        currentOutput.clear();
+        if (!input->next()) {
+            return false;
+        }
+        auto output = input->getOutput();
+        std::optional<Batch> row;
+        for (const auto& expression : expressions) {
+            if (auto column = dynamic_cast<const ColumnExpression*>(expression.get())) {
+                const auto& field = output.at(column->getAttribute());
+                currentOutput.push_back(field ? field->clone() : nullptr);
+                continue;
+            }
+            if (!row) {
+                row.emplace();
+                row->appendRow(output);
+            }
+            ColumnVector scratch;
+            currentOutput.push_back(expression->evaluate(*row, row->selection, scratch).getField(0));
+        }
+        return true;
+    }
+
+    bool nextBatch(Batch& batch) override {
+        batch.clear();
+        if (!input->nextBatch(input_batch)) {
+            return false;
+        }
+        batch.columns.resize(expressions.size());
+        for (size_t i = 0; i < expressions.size(); ++i) {
+            ColumnVector& column = batch.columns[i];
+            const ColumnVector& result = expressions[i]->evaluate(input_batch, input_batch.selection, column);
+            if (&result != &column) {
+                column = result;
+            }
+        }
+        batch.selection = input_batch.selection;
+        batch.count = input_batch.count;
+        return true;
+    }
+
+    std::vector<SortKey> getOrdering() const override {
+        // The ordering survives as long as its attributes are projected
+        std::vector<SortKey> ordering;
+        for (const auto& key : input->getOrdering()) {
+            auto it = std::find_if(expressions.begin(), expressions.end(), [&](const auto& expression) {
+                auto column = dynamic_cast<const ColumnExpression*>(expression.get());
+                return column && column->getAttribute() == key.attr_index;
+            });
+            if (it == expressions.end()) {
+                break;
+            }
+            ordering.push_back({static_cast<size_t>(it - expressions.begin()), key.descending});
+        }
+        return ordering;
+    }
+
+    void close() override {
+        input->close();
+        currentOutput.clear();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        std::vector<std::unique_ptr<Field>> outputCopy;
+        for (const auto& field : currentOutput) {
+            outputCopy.push_back(field ? field->clone() : nullptr);
+        }
+        return outputCopy;
+    }
+};
+
+// APPROX_COUNT_DISTINCT and APPROX_QUANTILE are answered from mergeable
+// sketches of bounded size, see ApproxState
+enum class AggrFuncType { COUNT, MAX, MIN, SUM, AVG, APPROX_COUNT_DISTINCT, APPROX_QUANTILE };
+
+struct AggrFunc {
+    AggrFuncType func;
+    size_t attr_index; // Index of the attribute to aggregate
+    double fraction = 0.5; // Requested quantile of APPROX_QUANTILE
+};
+
+// Running state of one aggregate of one group. Integer sums are kept in
+// 64 bits and only narrowed when the result is produced, failing if they
+// do not fit; MIN/MAX of INT and FLOAT inputs are exact as doubles.
+class AggregateState {
+public:
+    FieldType type = INT; // Type of the aggregated attribute
+    int64_t count = 0;
+    int64_t int_sum = 0;
+    double float_sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void updateInt(int value) {
+        type = INT;
+        count++;
+        int_sum += value;
+        min = std::min(min, static_cast<double>(value));
+        max = std::max(max, static_cast<double>(value));
+    }
+
+    void updateFloat(float value) {
+        type = FLOAT;
+        count++;
+        float_sum += value;
+        min = std::min(min, static_cast<double>(value));
+        max = std::max(max, static_cast<double>(value));
+    }
+
+    // Only COUNT is defined on strings
+    void updateString() {
+        type = STRING;
+        count++;
+    }
+
+    // NULLs are skipped
+    void update(const ColumnVector& column, size_t row) {
+        if (column.isNull(row)) {
+            return;
+        }
+        switch (column.type) {
+            case INT: updateInt(column.ints[row]); break;
+            case FLOAT: updateFloat(column.floats[row]); break;
+            case STRING: updateString(); break;
+        }
+    }
+
+    void merge(const AggregateState& other) {
+        if (other.count == 0) {
+            return;
+        }
+        type = other.type;
+        count += other.count;
+        int_sum += other.int_sum;
+        float_sum += other.float_sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    // nullptr (NULL) for anything but COUNT when no value was added
+    std::unique_ptr<Field> result(AggrFuncType func) const {
+        if (func != AggrFuncType::COUNT && count == 0) {
+            return nullptr;
+        }
+        switch (func) {
+            case AggrFuncType::COUNT:
+                return std::make_unique<Field>(narrowInt(count));
+            case AggrFuncType::SUM:
+                checkNumeric();
+                return type == INT ? std::make_unique<Field>(narrowInt(int_sum))
+                                   : std::make_unique<Field>(static_cast<float>(float_sum));
+            case AggrFuncType::MIN:
+                checkNumeric();
+                return type == INT ? std::make_unique<Field>(static_cast<int>(min))
+                                   : std::make_unique<Field>(static_cast<float>(min));
+            case AggrFuncType::MAX:
+                checkNumeric();
+                return type == INT ? std::make_unique<Field>(static_cast<int>(max))
+                                   : std::make_unique<Field>(static_cast<float>(max));
+            case AggrFuncType::AVG: {
+                checkNumeric();
+                double sum = type == INT ? static_cast<double>(int_sum) : float_sum;
+                return std::make_unique<Field>(static_cast<float>(sum / count));
+            }
+            case AggrFuncType::APPROX_COUNT_DISTINCT:
+            case AggrFuncType::APPROX_QUANTILE:
+                break;
+        }
+        throw std::runtime_error("Unsupported aggregation function.");
+    }
+
+private:
+    void checkNumeric() const {
+        if (type == STRING) {
+            throw std::runtime_error("Invalid operation or unsupported Field type.");
+        }
+    }
+};
+
+// HyperLogLog distinct-value estimator over 64-bit hashes. 2^12 one-byte
+// registers give a standard error of about 1.6%; the registers are only
+// allocated on the first insert. Merging takes the register-wise maximum.
+class HyperLogLog {
+public:
+    static constexpr unsigned PRECISION = 12;
+    static constexpr size_t NUM_REGISTERS = size_t{1} << PRECISION;
+
+private:
+    std::vector<uint8_t> registers;
+
+public:
+    void add(uint64_t hash) {
+        if (registers.empty()) {
+            registers.assign(NUM_REGISTERS, 0);
+        }
+        size_t index = hash >> (64 - PRECISION);
+        // Leading zeros of the remaining bits plus one; the guard bit caps the rank
+        uint64_t rest = (hash << PRECISION) | (uint64_t{1} << (PRECISION - 1));
+        uint8_t rank = static_cast<uint8_t>(countLeadingZeros(rest) + 1);
+        registers[index] = std::max(registers[index], rank);
+    }
+
+    void merge(const HyperLogLog& other) {
+        if (other.registers.empty()) {
+            return;
+        }
+        if (registers.empty()) {
+            registers = other.registers;
+            return;
+        }
+        for (size_t i = 0; i < NUM_REGISTERS; ++i) {
+            registers[i] = std::max(registers[i], other.registers[i]);
+        }
+    }
+
+    uint64_t estimate() const {
+        if (registers.empty()) {
+            return 0;
+        }
+        const double m = static_cast<double>(NUM_REGISTERS);
+        double sum = 0;
+        size_t zeros = 0;
+        for (auto value : registers) {
+            sum += std::ldexp(1.0, -value);
+            zeros += value == 0;
+        }
+        double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        // Small cardinalities: linear counting on the empty registers
+        if (estimate <= 2.5 * m && zeros > 0) {
+            estimate = m * std::log(m / static_cast<double>(zeros));
+        }
+        return static_cast<uint64_t>(std::llround(estimate));
+    }
+
+    size_t memoryUsage() const { return registers.capacity(); }
+
+    void serialize(std::string& out) const {
+        uint32_t size = static_cast<uint32_t>(registers.size());
+        out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        out.append(reinterpret_cast<const char*>(registers.data()), registers.size());
+    }
+
+    // Reads what serialize() wrote at `pos` and advances past it
+    void deserialize(const std::string& in, size_t& pos) {
+        uint32_t size;
+        std::memcpy(&size, in.data() + pos, sizeof(size));
+        pos += sizeof(size);
+        registers.assign(in.begin() + pos, in.begin() + pos + size);
+        pos += size;
+    }
+
+private:
+    static unsigned countLeadingZeros(uint64_t value) {
+        unsigned zeros = 0;
+        for (uint64_t bit = uint64_t{1} << 63; bit && !(value & bit); bit >>= 1) {
+            zeros++;
+        }
+        return zeros;
+    }
+};
+
+// KLL quantile sketch. Values enter level 0; a level that exceeds its
+// capacity is sorted and every other value, starting at an alternating
+// offset, moves up one level with twice the weight. Capacities shrink
+// geometrically below the top level, so a sketch holds O(K) values and
+// answers rank queries within about 1.7/K of the input size. Sketches
+// merge by concatenating levels and compacting.
+class QuantileSketch {
+public:
+    static constexpr size_t K = 200;
+
+private:
+    std::vector<std::vector<double>> levels;
+    size_t size = 0; // Values held over all levels
+    bool odd_offset = false;
+
+public:
+    void add(double value) {
+        if (levels.empty()) {
+            levels.emplace_back();
+        }
+        levels[0].push_back(value);
+        size++;
+        compact();
+    }
+
+    void merge(const QuantileSketch& other) {
+        if (levels.size() < other.levels.size()) {
+            levels.resize(other.levels.size());
+        }
+        for (size_t h = 0; h < other.levels.size(); ++h) {
+            levels[h].insert(levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+        }
+        size += other.size;
+        compact();
+    }
+
+    // Value whose rank is about `fraction` of the input
+    double quantile(double fraction) const {
+        std::vector<std::pair<double, uint64_t>> weighted;
+        uint64_t total = 0;
+        for (size_t h = 0; h < levels.size(); ++h) {
+            for (auto value : levels[h]) {
+                weighted.emplace_back(value, uint64_t{1} << h);
+                total += uint64_t{1} << h;
+            }
+        }
+        if (weighted.empty()) {
+            throw std::runtime_error("Quantile of an empty input.");
+        }
+        std::sort(weighted.begin(), weighted.end());
+        double target = std::clamp(fraction, 0.0, 1.0) * static_cast<double>(total);
+        uint64_t seen = 0;
+        for (const auto& [value, weight] : weighted) {
+            seen += weight;
+            if (static_cast<double>(seen) >= target) {
+                return value;
+            }
+        }
+        return weighted.back().first;
+    }
+
+    size_t memoryUsage() const {
+        size_t bytes = levels.capacity() * sizeof(std::vector<double>);
+        for (const auto& level : levels) {
+            bytes += level.capacity() * sizeof(double);
+        }
+        return bytes;
+    }
+
+    void serialize(std::string& out) const {
+        uint32_t num_levels = static_cast<uint32_t>(levels.size());
+        out.append(reinterpret_cast<const char*>(&num_levels), sizeof(num_levels));
+        for (const auto& level : levels) {
+            uint32_t count = static_cast<uint32_t>(level.size());
+            out.append(reinterpret_cast<const char*>(&count), sizeof(count));
+            out.append(reinterpret_cast<const char*>(level.data()), count * sizeof(double));
+        }
+    }
+
+    // Reads what serialize() wrote at `pos` and advances past it
+    void deserialize(const std::string& in, size_t& pos) {
+        uint32_t num_levels;
+        std::memcpy(&num_levels, in.data() + pos, sizeof(num_levels));
+        pos += sizeof(num_levels);
+        levels.assign(num_levels, {});
+        size = 0;
+        for (auto& level : levels) {
+            uint32_t count;
+            std::memcpy(&count, in.data() + pos, sizeof(count));
+            pos += sizeof(count);
+            level.resize(count);
+            std::memcpy(level.data(), in.data() + pos, count * sizeof(double));
+            pos += count * sizeof(double);
+            size += count;
+        }
+    }
+
+private:
+    // Capacity of level `h`: K at the top, shrinking by 2/3 per level below
+    size_t capacity(size_t h) const {
+        double scaled = static_cast<double>(K) * std::pow(2.0 / 3.0, static_cast<double>(levels.size() - 1 - h));
+        return std::max<size_t>(2, static_cast<size_t>(std::ceil(scaled)));
+    }
+
+    void compact() {
+        for (;;) {
+            size_t total_capacity = 0;
+            for (size_t h = 0; h < levels.size(); ++h) {
+                total_capacity += capacity(h);
+            }
+            if (size <= total_capacity) {
+                return;
+            }
+            size_t h = 0;
+            while (levels[h].size() < capacity(h)) {
+                h++;
+            }
+            if (h + 1 == levels.size()) {
+                levels.emplace_back();
+            }
+            auto& level = levels[h];
+            std::sort(level.begin(), level.end());
+            // An odd value out stays behind at this level
+            size_t kept = level.size() % 2;
+            for (size_t i = kept + odd_offset; i < level.size(); i += 2) {
+                levels[h + 1].push_back(level[i]);
+            }
+            size -= (level.size() - kept) / 2;
+            level.resize(kept);
+            odd_offset = !odd_offset;
+        }
+    }
+};
+
+// Sketches of one approximate aggregate of one group
+struct ApproxState {
+    HyperLogLog distinct;
+    QuantileSketch quantiles;
+
+    void merge(const ApproxState& other) {
+        distinct.merge(other.distinct);
+        quantiles.merge(other.quantiles);
+    }
+
+    size_t memoryUsage() const { return distinct.memoryUsage() + quantiles.memoryUsage(); }
+};
+
+// Sequential file of variable-length records on a temporary
+// StorageManager, written and read back one page at a time. Each page
+// starts with the number of bytes in use, followed by length-prefixed
+// records; records larger than a page are chained across pages.
+class SpillFile {
+private:
+    std::unique_ptr<StorageManager> storage;
+    std::unique_ptr<SlottedPage> page = std::make_unique<SlottedPage>();
+    size_t page_id = 0;
+    size_t offset = sizeof(uint16_t);
+    size_t num_records = 0;
+    bool writing = true;
+    bool page_loaded = false;
+
+public:
+    SpillFile() : storage(std::make_unique<StorageManager>(temporaryFilename())) {}
+
+    void append(const std::string& record) {
+        assert(writing);
+        // A record that fits into a page is never split; larger ones fill
+        // the current page and continue in chunks on the following pages
+        size_t needed = sizeof(uint16_t) + record.size();
+        if (offset + needed > PAGE_SIZE && needed <= PAGE_SIZE - sizeof(uint16_t)) {
+            nextPage();
+        }
+        size_t pos = 0;
+        for (;;) {
+            if (offset + sizeof(uint16_t) >= PAGE_SIZE) {
+                nextPage();
+            }
+            size_t chunk = std::min(record.size() - pos, PAGE_SIZE - offset - sizeof(uint16_t));
+            bool last = pos + chunk == record.size();
+            uint16_t header = static_cast<uint16_t>(chunk | (last ? 0 : CONTINUED));
+            std::memcpy(page->page_data.get() + offset, &header, sizeof(header));
+            std::memcpy(page->page_data.get() + offset + sizeof(header), record.data() + pos, chunk);
+            offset += sizeof(header) + chunk;
+            pos += chunk;
+            if (last) {
+                break;
+            }
+        }
+        num_records++;
+    }
+
+    // Switches from writing to reading from the first record
+    void rewind() {
+        if (writing) {
+            if (offset > sizeof(uint16_t)) {
+                flushPage();
+            }
+            writing = false;
+        }
+        page_id = 0;
+        page_loaded = false;
+    }
+
+    bool read(std::string& record) {
+        assert(!writing);
+        record.clear();
+        for (;;) {
+            while (!page_loaded || offset >= usedBytes()) {
+                if (page_loaded) {
+                    page_id++;
+                }
+                if (page_id >= storage->num_pages) {
+                    page_loaded = false;
+                    return false;
+                }
+                page = storage->load(page_id);
+                page_loaded = true;
+                offset = sizeof(uint16_t);
+            }
+            uint16_t header;
+            std::memcpy(&header, page->page_data.get() + offset, sizeof(header));
+            size_t chunk = header & ~CONTINUED;
+            record.append(page->page_data.get() + offset + sizeof(header), chunk);
+            offset += sizeof(header) + chunk;
+            if (!(header & CONTINUED)) {
+                return true;
+            }
+        }
+    }
+
+    size_t getNumRecords() const { return num_records; }
+    size_t getNumPages() const { return storage->num_pages; }
+
+private:
+    // Set in a chunk header when the record continues in the next chunk
+    static constexpr uint16_t CONTINUED = 0x8000;
+
+    void nextPage() {
+        flushPage();
+        page_id++;
+    }
+
+    size_t usedBytes() const {
+        uint16_t used;
+        std::memcpy(&used, page->page_data.get(), sizeof(used));
+        return used;
+    }
+
+    void flushPage() {
+        uint16_t used = static_cast<uint16_t>(offset);
+        std::memcpy(page->page_data.get(), &used, sizeof(used));
+        storage->flush(page_id, page);
+        offset = sizeof(uint16_t);
+    }
+};
+
+// Murmur3 64-bit finalizer
+inline uint64_t mixBits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+    return bits;
+}
+
+// Raw bits of a float key, with -0.0 folded into 0.0
+inline uint32_t floatKeyBits(float value) {
+    if (value == 0.0f) {
+        value = 0.0f;
+    }
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Hash table for grouped aggregation. Group keys made only of INT and
+// FLOAT columns are packed into one 32-bit word per column plus a word of
+// NULL flags; a key with a string column falls back to an encoded string.
+// Keys, hashes and the aggregate states of all groups live in flat
+// arrays, and the states are updated in place. Slots are probed linearly
+// and compared on the stored hash before the key. NULL keys form one
+// group, and NULL inputs are skipped by every aggregate.
+class AggregationHashTable {
+private:
+    static constexpr uint32_t EMPTY = 0;
+    static constexpr size_t NO_SKETCH = std::numeric_limits<size_t>::max();
+    // Key type of a column that held only NULLs so far, and the tag of a
+    // NULL in an encoded key
+    static constexpr FieldType NULL_KEY = static_cast<FieldType>(3);
+    static constexpr uint64_t NULL_KEY_BITS = 0x6e756c6cULL;
+    static constexpr size_t MAX_PACKED_KEYS = 32; // One NULL flag bit each
+
+    std::vector<AggrFunc> funcs;
+    size_t num_aggregates;
+    std::vector<size_t> sketch_slots; // Per aggregate: index among the sketches, or NO_SKETCH
+    size_t num_sketches = 0;
+    size_t sketch_bound = 0; // Upper bound on the sketch bytes of one group
+    bool initialized = false;
+    bool packed = true;
+    std::vector<FieldType> key_types;
+
+    std::vector<uint32_t> packed_keys;    // keyWords() words per group
+    std::vector<std::string> string_keys; // One encoded key per group
+    std::vector<uint64_t> hashes;
+    std::vector<AggregateState> states;   // num_aggregates per group
+    std::vector<ApproxState> sketches;    // num_sketches per group
+    std::vector<uint32_t> slots;          // Group index + 1, or EMPTY
+    size_t mask = 0;
+    size_t string_key_bytes = 0;
+
+    // Per-batch scratch space
+    std::vector<uint64_t> row_hashes;
+    std::vector<uint32_t> row_groups;
+    std::string encoded_key;
+
+public:
+    explicit AggregationHashTable(const std::vector<AggrFunc>& funcs) : funcs(funcs), num_aggregates(funcs.size()) {
+        for (const auto& func : funcs) {
+            bool sketched = func.func == AggrFuncType::APPROX_COUNT_DISTINCT || func.func == AggrFuncType::APPROX_QUANTILE;
+            sketch_slots.push_back(sketched ? num_sketches++ : NO_SKETCH);
+            if (func.func == AggrFuncType::APPROX_COUNT_DISTINCT) {
+                sketch_bound += HyperLogLog::NUM_REGISTERS;
+            } else if (func.func == AggrFuncType::APPROX_QUANTILE) {
+                sketch_bound += 3 * QuantileSketch::K * sizeof(double);
+            }
+        }
+        resizeSlots(16);
+    }
+
+    // Empty table with the same aggregates and key layout as `other`
+    static AggregationHashTable emptyLike(const AggregationHashTable& other) {
+        AggregationHashTable table(other.funcs);
+        if (other.initialized) {
+            table.initialize(other.key_types);
+        }
+        return table;
+    }
+
+    size_t size() const { return hashes.size(); }
+    uint64_t getHash(size_t group) const { return hashes[group]; }
+    AggregateState& getState(size_t group, size_t aggregate) { return states[group * num_aggregates + aggregate]; }
+    const AggregateState& getState(size_t group, size_t aggregate) const { return states[group * num_aggregates + aggregate]; }
+
+    // Final value of an aggregate of a group; nullptr for NULL
+    std::unique_ptr<Field> result(size_t group, size_t aggregate) const {
+        const AggrFunc& func = funcs[aggregate];
+        const AggregateState& state = getState(group, aggregate);
+        if (sketch_slots[aggregate] == NO_SKETCH) {
+            return state.result(func.func);
+        }
+        const ApproxState& sketch = sketches[group * num_sketches + sketch_slots[aggregate]];
+        if (func.func == AggrFuncType::APPROX_COUNT_DISTINCT) {
+            return std::make_unique<Field>(static_cast<int>(sketch.distinct.estimate()));
+        }
+        if (state.count == 0) {
+            return nullptr;
+        }
+        double value = sketch.quantiles.quantile(func.fraction);
+        return state.type == INT ? std::make_unique<Field>(static_cast<int>(value))
+                                 : std::make_unique<Field>(static_cast<float>(value));
+    }
+
+    // Adds the selected rows of `batch`: first hashes the key columns,
+    // then finds or creates each row's group, then updates one aggregate
+    // column at a time
+    void aggregate(const Batch& batch, const std::vector<size_t>& key_attrs, const std::vector<AggrFunc>& funcs) {
+        const auto& selection = batch.selection;
+        if (selection.empty()) {
+            return;
+        }
+        if (!initialized) {
+            std::vector<FieldType> types;
+            for (auto attr : key_attrs) {
+                const ColumnVector& column = batch.columns[attr];
+                types.push_back(column.allNull(selection) ? NULL_KEY : column.type);
+            }
+            initialize(types);
+        }
+
+        const size_t n = selection.size();
+        row_hashes.assign(n, 0);
+        for (size_t k = 0; k < key_attrs.size(); ++k) {
+            const ColumnVector& column = batch.columns[key_attrs[k]];
+            if (column.type != key_types[k] && !column.allNull(selection)) {
+                if (key_types[k] != NULL_KEY) {
+                    throw std::runtime_error("Group key column changed its type.");
+                }
+                key_types[k] = column.type; // Encoded keys carry their own types
+            }
+            if (column.hasNulls()) {
+                for (size_t i = 0; i < n; ++i) {
+                    size_t row = selection[i];
+                    row_hashes[i] = combine(row_hashes[i], column.isNull(row) ? NULL_KEY_BITS : keyBits(column, row));
+                }
+                continue;
+            }
+            switch (column.type) {
+                case INT:
+                    for (size_t i = 0; i < n; ++i) {
+                        row_hashes[i] = combine(row_hashes[i], static_cast<uint32_t>(column.ints[selection[i]]));
+                    }
+                    break;
+                case FLOAT:
+                    for (size_t i = 0; i < n; ++i) {
+                        row_hashes[i] = combine(row_hashes[i], floatKeyBits(column.floats[selection[i]]));
+                    }
+                    break;
+                case STRING:
+                    for (size_t i = 0; i < n; ++i) {
+                        row_hashes[i] = combine(row_hashes[i], std::hash<std::string>()(column.strings[selection[i]]));
+                    }
+                    break;
+            }
+        }
+
+        row_groups.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            row_groups[i] = findOrInsert(batch, key_attrs, selection[i], row_hashes[i]);
+        }
+
+        for (size_t a = 0; a < funcs.size(); ++a) {
+            const ColumnVector& column = batch.columns[funcs[a].attr_index];
+            AggregateState* base = states.data() + a;
+            if (column.hasNulls()) {
+                for (size_t i = 0; i < n; ++i) {
+                    if (!column.isNull(selection[i])) {
+                        base[row_groups[i] * num_aggregates].update(column, selection[i]);
+                    }
+                }
+            } else {
+                switch (column.type) {
+                    case INT:
+                        for (size_t i = 0; i < n; ++i) {
+                            base[row_groups[i] * num_aggregates].updateInt(column.ints[selection[i]]);
+                        }
+                        break;
+                    case FLOAT:
+                        for (size_t i = 0; i < n; ++i) {
+                            base[row_groups[i] * num_aggregates].updateFloat(column.floats[selection[i]]);
+                        }
+                        break;
+                    case STRING:
+                        for (size_t i = 0; i < n; ++i) {
+                            base[row_groups[i] * num_aggregates].updateString();
+                        }
+                        break;
+                }
+            }
+            if (sketch_slots[a] != NO_SKETCH) {
+                updateSketches(column, selection, a);
+            }
+        }
+    }
+
+    // Folds a group of another table with the same key layout into this one
+    void mergeGroup(const AggregationHashTable& other, size_t group) {
+        if (!initialized) {
+            initialize(other.key_types);
+        }
+        mergeEntry(other.hashes[group], other.keyData(group), other.keySize(group),
+                   &other.states[group * num_aggregates], other.sketches.data() + group * num_sketches);
+    }
+
+    // Partial aggregate of one group as a spill record: the hash, the
+    // aggregate states, the sketches and the key bytes
+    void serializeGroup(size_t group, std::string& record) const {
+        record.assign(reinterpret_cast<const char*>(&hashes[group]), sizeof(uint64_t));
+        record.append(reinterpret_cast<const char*>(&states[group * num_aggregates]),
+                      num_aggregates * sizeof(AggregateState));
+        for (size_t s = 0; s < num_sketches; ++s) {
+            const ApproxState& sketch = sketches[group * num_sketches + s];
+            sketch.distinct.serialize(record);
+            sketch.quantiles.serialize(record);
+        }
+        record.append(keyData(group), keySize(group));
+    }
+
+    // Folds a record written by serializeGroup() of a table with the same
+    // key layout into this one
+    void mergeRecord(const std::string& record) {
+        uint64_t hash;
+        std::memcpy(&hash, record.data(), sizeof(hash));
+        const size_t states_size = num_aggregates * sizeof(AggregateState);
+        std::vector<AggregateState> record_states(num_aggregates);
+        std::memcpy(static_cast<void*>(record_states.data()), record.data() + sizeof(hash), states_size);
+        size_t key_offset = sizeof(hash) + states_size;
+        std::vector<ApproxState> record_sketches(num_sketches);
+        for (auto& sketch : record_sketches) {
+            sketch.distinct.deserialize(record, key_offset);
+            sketch.quantiles.deserialize(record, key_offset);
+        }
+        mergeEntry(hash, record.data() + key_offset, record.size() - key_offset, record_states.data(),
+                   record_sketches.data());
+    }
+
+    // Approximate heap footprint of the table; sketches count with their
+    // maximum size
+    size_t memoryUsage() const {
+        return packed_keys.capacity() * sizeof(uint32_t) + string_keys.capacity() * sizeof(std::string) +
+               string_key_bytes + hashes.capacity() * sizeof(uint64_t) +
+               states.capacity() * sizeof(AggregateState) + slots.capacity() * sizeof(uint32_t) +
+               sketches.capacity() * sizeof(ApproxState) + hashes.size() * sketch_bound;
+    }
+
+    // Value of the `key_index`th group attribute of a group; nullptr for NULL
+    std::unique_ptr<Field> getKey(size_t group, size_t key_index) const {
+        if (packed) {
+            const uint32_t* words = &packed_keys[group * keyWords()];
+            if (words[key_types.size()] & (uint32_t(1) << key_index)) {
+                return nullptr;
+            }
+            if (key_types[key_index] == INT) {
+                return std::make_unique<Field>(static_cast<int>(words[key_index]));
+            }
+            float value;
+            std::memcpy(&value, &words[key_index], sizeof(value));
+            return std::make_unique<Field>(value);
+        }
+
+        // Walk the encoded string: a type tag followed by the value bytes
+        const std::string& key = string_keys[group];
+        size_t pos = 0;
+        for (size_t k = 0; ; ++k) {
+            FieldType type = static_cast<FieldType>(key[pos++]);
+            size_t length = sizeof(uint32_t);
+            if (type == NULL_KEY) {
+                if (k == key_index) {
+                    return nullptr;
+                }
+                continue;
+            }
+            if (type == STRING) {
+                uint32_t string_length;
+                std::memcpy(&string_length, key.data() + pos, sizeof(string_length));
+                pos += sizeof(string_length);
+                length = string_length;
+            }
+            if (k == key_index) {
+                switch (type) {
+                    case INT: {
+                        int value;
+                        std::memcpy(&value, key.data() + pos, sizeof(value));
+                        return std::make_unique<Field>(value);
+                    }
+                    case FLOAT: {
+                        float value;
+                        std::memcpy(&value, key.data() + pos, sizeof(value));
+                        return std::make_unique<Field>(value);
+                    }
+                    case STRING:
+                        return std::make_unique<Field>(key.substr(pos, length));
+                }
+            }
+            pos += length;
+        }
+    }
+
+    // Drops all groups and releases their memory; the key layout is kept
+    void clear() {
+        std::vector<uint32_t>().swap(packed_keys);
+        std::vector<std::string>().swap(string_keys);
+        std::vector<uint64_t>().swap(hashes);
+        std::vector<AggregateState>().swap(states);
+        std::vector<ApproxState>().swap(sketches);
+        string_key_bytes = 0;
+        resizeSlots(16);
+    }
+
+private:
+    static uint64_t combine(uint64_t hash, uint64_t bits) {
+        return mixBits(hash ^ (bits + 0x9e3779b97f4a7c15ULL + (hash << 6)));
+    }
+
+    void initialize(const std::vector<FieldType>& types) {
+        key_types = types;
+        packed = types.size() <= MAX_PACKED_KEYS &&
+                 std::none_of(types.begin(), types.end(), [](FieldType type) { return type == STRING || type == NULL_KEY; });
+        initialized = true;
+    }
+
+    // Packed key: one word per column, then the NULL flags
+    size_t keyWords() const { return key_types.size() + 1; }
+
+    void resizeSlots(size_t capacity) {
+        slots.assign(capacity, EMPTY);
+        mask = capacity - 1;
+        for (size_t group = 0; group < hashes.size(); ++group) {
+            size_t slot = hashes[group] & mask;
+            while (slots[slot] != EMPTY) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = static_cast<uint32_t>(group + 1);
+        }
+    }
+
+    // Returns the group with `hash` for which equal(group) holds, or
+    // appends a new one whose key is stored by insert()
+    template<typename Equal, typename Insert>
+    size_t probe(uint64_t hash, Equal equal, Insert insert) {
+        size_t slot = hash & mask;
+        while (slots[slot] != EMPTY) {
+            size_t group = slots[slot] - 1;
+            if (hashes[group] == hash && equal(group)) {
+                return group;
+            }
+            slot = (slot + 1) & mask;
+        }
+
+        size_t group = hashes.size();
+        insert();
+        hashes.push_back(hash);
+        states.resize(states.size() + num_aggregates);
+        sketches.resize(sketches.size() + num_sketches);
+        slots[slot] = static_cast<uint32_t>(group + 1);
+        if (2 * hashes.size() > slots.size()) {
+            resizeSlots(2 * slots.size());
+        }
+        return group;
+    }
+
+    const char* keyData(size_t group) const {
+        return packed ? reinterpret_cast<const char*>(&packed_keys[group * keyWords()])
+                      : string_keys[group].data();
+    }
+
+    size_t keySize(size_t group) const {
+        return packed ? keyWords() * sizeof(uint32_t) : string_keys[group].size();
+    }
+
+    void mergeEntry(uint64_t hash, const char* key, size_t key_size, const AggregateState* entry_states,
+                    const ApproxState* entry_sketches) {
+        size_t target = probe(hash,
+            [&](size_t candidate) {
+                return keySize(candidate) == key_size && std::memcmp(keyData(candidate), key, key_size) == 0;
+            },
+            [&]() {
+                if (packed) {
+                    size_t end = packed_keys.size();
+                    packed_keys.resize(end + keyWords());
+                    std::memcpy(&packed_keys[end], key, key_size);
+                } else {
+                    string_keys.emplace_back(key, key_size);
+                    string_key_bytes += key_size;
+                }
+            });
+        for (size_t a = 0; a < num_aggregates; ++a) {
+            getState(target, a).merge(entry_states[a]);
+        }
+        for (size_t s = 0; s < num_sketches; ++s) {
+            sketches[target * num_sketches + s].merge(entry_sketches[s]);
+        }
+    }
+
+    // Adds the selected values of `column` to the sketches of aggregate `a`
+    void updateSketches(const ColumnVector& column, const std::vector<uint16_t>& selection, size_t a) {
+        ApproxState* base = sketches.data() + sketch_slots[a];
+        const size_t n = selection.size();
+        if (funcs[a].func == AggrFuncType::APPROX_COUNT_DISTINCT) {
+            for (size_t i = 0; i < n; ++i) {
+                size_t row = selection[i];
+                if (!column.isNull(row)) {
+                    base[row_groups[i] * num_sketches].distinct.add(mixBits(keyBits(column, row)));
+                }
+            }
+            return;
+        }
+        if (column.type == STRING && !column.allNull(selection)) {
+            throw std::runtime_error("Invalid operation or unsupported Field type.");
+        }
+        for (size_t i = 0; i < n; ++i) {
+            size_t row = selection[i];
+            if (!column.isNull(row)) {
+                double value = column.type == INT ? column.ints[row] : column.floats[row];
+                base[row_groups[i] * num_sketches].quantiles.add(value);
+            }
+        }
+    }
+
+    // Hash input of a value; keyWord() for INT and FLOAT
+    static uint64_t keyBits(const ColumnVector& column, size_t row) {
+        return column.type == STRING ? std::hash<std::string>()(column.strings[row]) : keyWord(column, row);
+    }
+
+    static uint32_t keyWord(const ColumnVector& column, size_t row) {
+        if (column.isNull(row)) {
+            return 0;
+        }
+        return column.type == INT ? static_cast<uint32_t>(column.ints[row]) : floatKeyBits(column.floats[row]);
+    }
+
+    static uint32_t nullFlags(const Batch& batch, const std::vector<size_t>& key_attrs, size_t row) {
+        uint32_t flags = 0;
+        for (size_t k = 0; k < key_attrs.size(); ++k) {
+            flags |= uint32_t(batch.columns[key_attrs[k]].isNull(row)) << k;
+        }
+        return flags;
+    }
+
+    uint32_t findOrInsert(const Batch& batch, const std::vector<size_t>& key_attrs, size_t row, uint64_t hash) {
+        const size_t width = key_attrs.size();
+        if (packed) {
+            const uint32_t flags = nullFlags(batch, key_attrs, row);
+            return static_cast<uint32_t>(probe(hash,
+                [&](size_t group) {
+                    const uint32_t* words = packed_keys.data() + group * (width + 1);
+                    for (size_t k = 0; k < width; ++k) {
+                        if (words[k] != keyWord(batch.columns[key_attrs[k]], row)) {
+                            return false;
+                        }
+                    }
+                    return words[width] == flags;
+                },
+                [&]() {
+                    for (size_t k = 0; k < width; ++k) {
+                        packed_keys.push_back(keyWord(batch.columns[key_attrs[k]], row));
+                    }
+                    packed_keys.push_back(flags);
+                }));
+        }
+
+        encoded_key.clear();
+        for (auto attr : key_attrs) {
+            const ColumnVector& column = batch.columns[attr];
+            if (column.isNull(row)) {
+                encoded_key.push_back(static_cast<char>(NULL_KEY));
+                continue;
+            }
+            encoded_key.push_back(static_cast<char>(column.type));
+            if (column.type == STRING) {
+                uint32_t length = static_cast<uint32_t>(column.strings[row].size());
+                encoded_key.append(reinterpret_cast<const char*>(&length), sizeof(length));
+                encoded_key.append(column.strings[row]);
+            } else {
+                uint32_t word = keyWord(column, row);
+                encoded_key.append(reinterpret_cast<const char*>(&word), sizeof(word));
+            }
+        }
+        return static_cast<uint32_t>(probe(hash,
+            [&](size_t group) { return string_keys[group] == encoded_key; },
+            [&]() {
+                string_keys.push_back(encoded_key);
+                string_key_bytes += encoded_key.size();
+            }));
+    }
+};
+
+static constexpr size_t DEFAULT_AGGREGATION_MEMORY = 4 * 1024 * 1024;
+// Each spill splits a table into 2^SPILL_PARTITION_BITS partitions
+static constexpr unsigned SPILL_PARTITION_BITS = 4;
+
+// Grouped aggregation bounded by `memory_budget`. When the hash table
+// outgrows the budget, its groups are spilled as partial aggregates into
+// partitions chosen by the top bits of the group hash, and the table
+// starts over. Each partition is then re-aggregated on its own; a
+// partition that still does not fit is split again on the next bits.
+class HashAggregationOperator : public UnaryOperator {
+private:
+    std::vector<size_t> group_by_attrs;
+    std::vector<AggrFunc> aggr_funcs;
+    size_t memory_budget;
+    std::vector<Tuple> output_tuples; // Use your Tuple class for output
+    size_t output_tuples_index = 0;
+    size_t num_spills = 0;
+
+    using SpillPartitions = std::vector<std::unique_ptr<SpillFile>>;
+
+public:
+    HashAggregationOperator(Operator& input, std::vector<size_t> group_by_attrs, std::vector<AggrFunc> aggr_funcs,
+                            size_t memory_budget = DEFAULT_AGGREGATION_MEMORY)
+        : UnaryOperator(input), group_by_attrs(group_by_attrs), aggr_funcs(aggr_funcs),
+          memory_budget(memory_budget) {}
+
+    void open() override {
+        input->open(); // Ensure the input operator is opened
+        output_tuples_index = 0;
+        output_tuples.clear();
+        num_spills = 0;
+
+        // Consume the input a batch at a time
+        AggregationHashTable hash_table(aggr_funcs);
+        SpillPartitions partitions;
+        Batch batch;
+        while (input->nextBatch(batch)) {
+            hash_table.aggregate(batch, group_by_attrs, aggr_funcs);
+            if (hash_table.memoryUsage() > memory_budget) {
+                spill(hash_table, partitions, 0);
+            }
+        }
+        finish(hash_table, partitions, 1);
+        if (group_by_attrs.empty() && output_tuples.empty()) {
+            output_tuples.push_back(makeEmptyOutputTuple(aggr_funcs));
+        }
+    }
+
+    // Number of times a hash table was spilled, including recursive spills
+    size_t getNumSpills() const { return num_spills; }
+
+    // Group key values followed by the aggregate results of one group
+    static Tuple makeOutputTuple(const AggregationHashTable& hash_table, size_t group,
+                                 size_t num_keys, const std::vector<AggrFunc>& aggr_funcs) {
+        Tuple output_tuple;
+        for (size_t k = 0; k < num_keys; ++k) {
+            output_tuple.addField(hash_table.getKey(group, k));
+        }
+        for (size_t i = 0; i < aggr_funcs.size(); ++i) {
+            output_tuple.addField(hash_table.result(group, i));
+        }
+        return output_tuple;
+    }
+
+    // Aggregates without GROUP BY have a row even for empty input: COUNT
+    // and APPROX_COUNT_DISTINCT are 0, the others NULL
+    static Tuple makeEmptyOutputTuple(const std::vector<AggrFunc>& aggr_funcs) {
+        Tuple output_tuple;
+        for (const auto& aggr_func : aggr_funcs) {
+            bool counts = aggr_func.func == AggrFuncType::COUNT || aggr_func.func == AggrFuncType::APPROX_COUNT_DISTINCT;
+            output_tuple.addField(counts ? std::make_unique<Field>(0) : nullptr);
+        }
+        return output_tuple;
+    }
+
+    bool next() override {
+        if (output_tuples_index < output_tuples.size()) {
+            output_tuples_index++;
+            return true;
+        }
+        return false;
+    }
+
+    bool nextBatch(Batch& batch) override {
+        batch.clear();
+        while (!batch.full() && output_tuples_index < output_tuples.size()) {
+            batch.appendRow(output_tuples[output_tuples_index++].fields);
+        }
+        return batch.count > 0;
+    }
+
+    void close() override {
+        input->close();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        std::vector<std::unique_ptr<Field>> outputCopy;
+
+        if (output_tuples_index == 0 || output_tuples_index > output_tuples.size()) {
+            // If there is no current tuple because next() hasn't been called yet or we're past the last tuple,
+            // return an empty vector.
+            return outputCopy; // This will be an empty vector
+        }
+
+        // Assuming that output_tuples stores Tuple objects and each Tuple has a vector of Field objects or similar
+        const auto& currentTuple = output_tuples[output_tuples_index - 1]; // Adjust for 0-based indexing after increment in next()
+
+        // Assuming the Tuple class provides a way to access its fields, e.g., a method or a public member
+        for (const auto& field : currentTuple.fields) {
+            outputCopy.push_back(field ? field->clone() : nullptr); // Use the clone method to create a deep copy of each field
+        }
+
+        return outputCopy;
+    }
+
+private:
+    // Writes every group of `table` to the partition selected by hash bits
+    // of the given level, then empties the table
+    void spill(AggregationHashTable& table, SpillPartitions& partitions, unsigned level) {
+        if (partitions.empty()) {
+            for (size_t p = 0; p < (size_t(1) << SPILL_PARTITION_BITS); ++p) {
+                partitions.push_back(std::make_unique<SpillFile>());
+            }
+        }
+        const unsigned shift = 64 - (level + 1) * SPILL_PARTITION_BITS;
+        const uint64_t mask = (uint64_t(1) << SPILL_PARTITION_BITS) - 1;
+        std::string record;
+        for (size_t group = 0; group < table.size(); ++group) {
+            table.serializeGroup(group, record);
+            partitions[(table.getHash(group) >> shift) & mask]->append(record);
+        }
+        table.clear();
+        num_spills++;
+    }
+
+    // Emits `table` directly if nothing was spilled; otherwise spills the
+    // rest and re-aggregates the partitions one at a time
+    void finish(AggregationHashTable& table, SpillPartitions& partitions, unsigned next_level) {
+        if (partitions.empty()) {
+            for (size_t group = 0; group < table.size(); ++group) {
+                output_tuples.push_back(makeOutputTuple(table, group, group_by_attrs.size(), aggr_funcs));
+            }
+            return;
+        }
+        spill(table, partitions, next_level - 1);
+        for (auto& partition : partitions) {
+            aggregatePartition(*partition, table, next_level);
+            partition.reset();
+        }
+    }
+
+    void aggregatePartition(SpillFile& file, const AggregationHashTable& layout, unsigned level) {
+        AggregationHashTable table = AggregationHashTable::emptyLike(layout);
+        SpillPartitions partitions;
+        // Once the hash bits are used up, colliding groups stay in memory
+        const bool can_spill = (level + 1) * SPILL_PARTITION_BITS <= 64;
+        std::string record;
+        file.rewind();
+        while (file.read(record)) {
+            table.mergeRecord(record);
+            if (can_spill && table.memoryUsage() > memory_budget) {
+                spill(table, partitions, level);
+            }
+        }
+        finish(table, partitions, level + 1);
+    }
+};
+
+// FIXED_PAGES reads a given number of pages chosen uniformly without
+// replacement, so its cost does not grow with the table. BERNOULLI keeps
+// every page independently with a given probability.
+enum class SampleMethod { FIXED_PAGES, BERNOULLI };
+
+// Scan of a random sample of pages. The sampled pages are read in page
+// order through the BufferManager; predicates and projections are pushed
+// into the underlying scan as usual. Each batch holds rows of a single
+// page, and getCurrentPage() tells which, so estimators can treat pages
+// as sampling clusters.
+class SampleScanOperator : public Operator {
+private:
+    BufferManager& bufferManager;
+    SampleMethod method;
+    double size; // Number of pages for FIXED_PAGES, probability for BERNOULLI
+    uint64_t seed;
+    ScanOperator scan;
+
+    std::vector<size_t> sample;
+    size_t total_pages = 0;
+    size_t sample_index = 0;
+    bool page_open = false;
+
+public:
+    SampleScanOperator(BufferManager& manager, SampleMethod method, double size, uint64_t seed = 42)
+        : bufferManager(manager), method(method), size(size), seed(seed), scan(manager) {
+        if (method == SampleMethod::BERNOULLI && (size < 0 || size > 1)) {
+            throw std::runtime_error("Sampling probability must be between 0 and 1.");
+        }
+    }
+
+    void pushPredicate(std::unique_ptr<IPredicate> pushed) { scan.pushPredicate(std::move(pushed)); }
+    void setProjection(std::vector<size_t> attrs) { scan.setProjection(std::move(attrs)); }
+
+    void open() override {
+        total_pages = bufferManager.getNumPages();
+        std::mt19937_64 random(seed);
+        sample.clear();
+        if (method == SampleMethod::FIXED_PAGES) {
+            std::vector<size_t> all(total_pages);
+            std::iota(all.begin(), all.end(), 0);
+            size_t count = std::min(total_pages, static_cast<size_t>(size));
+            std::sample(all.begin(), all.end(), std::back_inserter(sample), count, random);
+        } else {
+            std::bernoulli_distribution keep(size);
+            for (size_t page = 0; page < total_pages; ++page) {
+                if (keep(random)) {
+                    sample.push_back(page);
+                }
+            }
+        }
+        sample_index = 0;
+        page_open = false;
+    }
+
+    bool next() override {
+        for (;;) {
+            if (page_open && scan.next()) {
+                return true;
+            }
+            if (!openNextPage()) {
+                return false;
+            }
+        }
+    }
+
+    bool nextBatch(Batch& batch) override {
+        for (;;) {
+            if (page_open && scan.nextBatch(batch)) {
+                return true;
+            }
+            if (!openNextPage()) {
+                batch.clear();
+                return false;
+            }
+        }
+    }
+
+    void close() override {
+        if (sample_index > 0) {
+            scan.close();
+        }
+        sample.clear();
+        page_open = false;
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        return scan.getOutput();
+    }
+
+    // Page of the rows of the last batch or tuple
+    size_t getCurrentPage() const { return sample.at(sample_index - 1); }
+
+    size_t getNumSampledPages() const { return sample.size(); }
+    size_t getTotalPages() const { return total_pages; }
+    SampleMethod getMethod() const { return method; }
+
+    // Probability of each page to be in the sample
+    double inclusionProbability() const {
+        if (method == SampleMethod::BERNOULLI) {
+            return size;
+        }
+        return total_pages ? static_cast<double>(sample.size()) / total_pages : 1.0;
+    }
+
+private:
+    bool openNextPage() {
+        if (sample_index == sample.size()) {
+            page_open = false;
+            return false;
+        }
+        scan.setPages({sample[sample_index++]});
+        scan.open();
+        page_open = true;
+        return true;
+    }
+};
+
+// Estimate with a two-sided confidence interval
+struct Estimate {
+    double value;
+    double lower;
+    double upper;
+};
+
+// Two-sided standard normal quantile for `confidence`, e.g. 1.96 for 0.95
+inline double normalQuantile(double confidence) {
+    double target = (1 + confidence) / 2;
+    double low = 0, high = 10;
+    for (int i = 0; i < 100; ++i) {
+        double mid = (low + high) / 2;
+        (0.5 * std::erfc(-mid / std::sqrt(2.0)) < target ? low : high) = mid;
+    }
+    return (low + high) / 2;
+}
+
+// Scales COUNT and SUM over a page sample up to the whole table. Pages
+// are the sampling units: per group, the page totals y_i of the sample
+// give the Horvitz-Thompson estimate sum(y_i) / p, with variance
+// (1 - p) / p^2 * sum(y_i^2) for Bernoulli sampling and
+// N^2 (1 - n/N) s_y^2 / n for n of N pages drawn without replacement.
+// Each output row holds the group keys, then the estimate, lower and
+// upper bound of every aggregate.
+class ApproximateAggregationOperator : public Operator {
+private:
+    struct GroupEstimate {
+        std::vector<std::unique_ptr<Field>> key;
+        std::vector<double> sum;    // Per aggregate: sum of page totals
+        std::vector<double> sum_sq; // Per aggregate: sum of squared page totals
+    };
+
+    SampleScanOperator& input;
+    std::vector<size_t> group_by_attrs;
+    std::vector<AggrFunc> aggr_funcs;
+    double confidence;
+
+    std::vector<std::vector<std::unique_ptr<Field>>> output_rows;
+    size_t output_index = 0;
+
+public:
+    ApproximateAggregationOperator(SampleScanOperator& input, std::vector<size_t> group_by_attrs,
+                                   std::vector<AggrFunc> aggr_funcs, double confidence = 0.95)
+        : input(input), group_by_attrs(std::move(group_by_attrs)), aggr_funcs(std::move(aggr_funcs)),
+          confidence(confidence) {
+        for (const auto& func : this->aggr_funcs) {
+            if (func.func != AggrFuncType::COUNT && func.func != AggrFuncType::SUM) {
+                throw std::runtime_error("Only COUNT and SUM can be estimated from a sample.");
+            }
+        }
+    }
+
+    void open() override {
+        input.open();
+        output_rows.clear();
+        output_index = 0;
+
+        std::unordered_map<std::string, GroupEstimate> groups;
+        AggregationHashTable page_table(aggr_funcs);
+        Batch batch;
+        bool have_page = false;
+        size_t page = 0;
+        auto flushPage = [&]() {
+            for (size_t group = 0; group < page_table.size(); ++group) {
+                std::string encoded;
+                std::vector<std::unique_ptr<Field>> key;
+                for (size_t k = 0; k < group_by_attrs.size(); ++k) {
+                    key.push_back(page_table.getKey(group, k));
+                    encoded += key.back() ? key.back()->serialize() : "NULL ";
+                }
+                GroupEstimate& estimate = groups[encoded];
+                if (estimate.sum.empty()) {
+                    estimate.key = std::move(key);
+                    estimate.sum.assign(aggr_funcs.size(), 0);
+                    estimate.sum_sq.assign(aggr_funcs.size(), 0);
+                }
+                for (size_t a = 0; a < aggr_funcs.size(); ++a) {
+                    double total = pageTotal(page_table.getState(group, a), aggr_funcs[a].func);
+                    estimate.sum[a] += total;
+                    estimate.sum_sq[a] += total * total;
+                }
+            }
+            page_table.clear();
+        };
+        while (input.nextBatch(batch)) {
+            if (have_page && input.getCurrentPage() != page) {
+                flushPage();
+            }
+            page = input.getCurrentPage();
+            have_page = true;
+            page_table.aggregate(batch, group_by_attrs, aggr_funcs);
+        }
+        flushPage();
+
+        // An aggregate without grouping has a row even if the sample is empty
+        if (group_by_attrs.empty() && groups.empty()) {
+            groups[""].sum.assign(aggr_funcs.size(), 0);
+            groups[""].sum_sq.assign(aggr_funcs.size(), 0);
+        }
+        double z = normalQuantile(confidence);
+        for (auto& [encoded, estimate] : groups) {
+            std::vector<std::unique_ptr<Field>> row = std::move(estimate.key);
+            for (size_t a = 0; a < aggr_funcs.size(); ++a) {
+                Estimate result = scale(estimate.sum[a], estimate.sum_sq[a], z);
+                row.push_back(std::make_unique<Field>(static_cast<float>(result.value)));
+                row.push_back(std::make_unique<Field>(static_cast<float>(result.lower)));
+                row.push_back(std::make_unique<Field>(static_cast<float>(result.upper)));
+            }
+            output_rows.push_back(std::move(row));
+        }
+    }
+
+    bool next() override {
+        if (output_index >= output_rows.size()) {
+            return false;
+        }
+        output_index++;
+        return true;
+    }
+
+    void close() override {
+        input.close();
+        output_rows.clear();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        std::vector<std::unique_ptr<Field>> outputCopy;
+        for (const auto& field : output_rows.at(output_index - 1)) {
+            outputCopy.push_back(field ? field->clone() : nullptr);
+        }
+        return outputCopy;
+    }
+
+private:
+    static double pageTotal(const AggregateState& state, AggrFuncType func) {
+        if (func == AggrFuncType::COUNT) {
+            return static_cast<double>(state.count);
+        }
+        if (state.type == STRING) {
+            throw std::runtime_error("Invalid operation or unsupported Field type.");
+        }
+        return state.type == INT ? static_cast<double>(state.int_sum) : state.float_sum;
+    }
+
+    Estimate scale(double sum, double sum_sq, double z) const {
+        double p = input.inclusionProbability();
+        if (p <= 0) {
+            return {0, 0, 0};
+        }
+        double value = sum / p;
+        double variance;
+        if (input.getMethod() == SampleMethod::BERNOULLI) {
+            variance = (1 - p) / (p * p) * sum_sq;
+        } else {
+            double n = static_cast<double>(input.getNumSampledPages());
+            double total = static_cast<double>(input.getTotalPages());
+            double spread = n > 1 ? std::max(0.0, (sum_sq - sum * sum / n) / (n - 1)) : 0;
+            variance = total * total * (1 - n / total) * spread / n;
+        }
+        double margin = z * std::sqrt(variance);
+        return {value, value - margin, value + margin};
+    }
+};
+
+// Grouped aggregate over the rows of a table satisfying a predicate,
+// kept up to date as rows are inserted and deleted. Inserts update the
+// group in place; deletes subtract from COUNT and SUM (and so AVG), and
+// because MIN and MAX cannot be undone, a delete that removes a group's
+// current minimum or maximum marks the group stale. Stale groups are
+// recomputed by one scan the next time the rows are read, so a read costs
+// O(groups) unless extremes were deleted.
+class MaterializedAggregate : public TableObserver {
+private:
+    struct Group {
+        std::vector<std::unique_ptr<Field>> key;
+        std::vector<AggregateState> states;
+        int64_t rows = 0;
+        bool stale = false;
+    };
+
+    BufferManager& bufferManager;
+    std::vector<size_t> group_by_attrs;
+    std::vector<AggrFunc> aggr_funcs;
+    std::unique_ptr<IPredicate> predicate; // May be null
+    bool has_extremes = false;
+    std::unordered_map<std::string, Group> groups;
+    size_t num_recomputes = 0;
+
+public:
+    MaterializedAggregate(BufferManager& manager, std::vector<size_t> group_by_attrs,
+                          std::vector<AggrFunc> aggr_funcs, std::unique_ptr<IPredicate> predicate = nullptr)
+        : bufferManager(manager), group_by_attrs(std::move(group_by_attrs)), aggr_funcs(std::move(aggr_funcs)),
+          predicate(std::move(predicate)) {
+        for (const auto& func : this->aggr_funcs) {
+            if (func.func == AggrFuncType::APPROX_COUNT_DISTINCT || func.func == AggrFuncType::APPROX_QUANTILE) {
+                throw std::runtime_error("Approximate aggregates cannot be maintained incrementally.");
+            }
+            has_extremes |= func.func == AggrFuncType::MIN || func.func == AggrFuncType::MAX;
+        }
+        refresh();
+        bufferManager.addObserver(this);
+    }
+
+    ~MaterializedAggregate() override {
+        bufferManager.removeObserver(this);
+    }
+
+    MaterializedAggregate(const MaterializedAggregate&) = delete;
+    MaterializedAggregate& operator=(const MaterializedAggregate&) = delete;
+
+    void onInsert(const Tuple& tuple) override {
+        if (predicate && !predicate->check(tuple.fields)) {
+            return;
+        }
+        std::string encoded = encodeKey(tuple.fields);
+        Group& group = groups[encoded];
+        if (group.states.empty()) {
+            for (auto attr : group_by_attrs) {
+                group.key.push_back(tuple.fields.at(attr)->clone());
+            }
+            group.states.resize(aggr_funcs.size());
+        }
+        group.rows++;
+        for (size_t a = 0; a < aggr_funcs.size(); ++a) {
+            add(group.states[a], *tuple.fields.at(aggr_funcs[a].attr_index));
+        }
+    }
+
+    void onDelete(const Tuple& tuple) override {
+        if (predicate && !predicate->check(tuple.fields)) {
+            return;
+        }
+        auto it = groups.find(encodeKey(tuple.fields));
+        if (it == groups.end()) {
+            return;
+        }
+        Group& group = it->second;
+        if (--group.rows == 0) {
+            groups.erase(it);
+            return;
+        }
+        for (size_t a = 0; a < aggr_funcs.size(); ++a) {
+            AggregateState& state = group.states[a];
+            const Field& field = *tuple.fields.at(aggr_funcs[a].attr_index);
+            state.count--;
+            if (field.getType() == INT) {
+                state.int_sum -= field.asInt();
+            } else if (field.getType() == FLOAT) {
+                state.float_sum -= field.asFloat();
+            }
+            if (has_extremes && field.getType() != STRING) {
+                double value = field.getType() == INT ? field.asInt() : field.asFloat();
+                group.stale |= value <= state.min || value >= state.max;
+            }
+        }
+    }
+
+    // Current result: the group keys followed by the aggregates, per group
+    std::vector<Tuple> getRows() {
+        recomputeStale();
+        std::vector<Tuple> rows;
+        rows.reserve(groups.size());
+        for (const auto& [encoded, group] : groups) {
+            Tuple row;
+            for (const auto& field : group.key) {
+                row.addField(field ? field->clone() : nullptr);
+            }
+            for (size_t a = 0; a < aggr_funcs.size(); ++a) {
+                row.addField(group.states[a].result(aggr_funcs[a].func));
+            }
+            rows.push_back(std::move(row));
+        }
+        if (group_by_attrs.empty() && rows.empty()) {
+            rows.push_back(HashAggregationOperator::makeEmptyOutputTuple(aggr_funcs));
+        }
+        return rows;
+    }
+
+    // Recomputes every group from a full scan
+    void refresh() {
+        groups.clear();
+        ScanOperator scan(bufferManager);
+        scan.open();
+        while (scan.next()) {
+            Tuple tuple;
+            tuple.fields = scan.getOutput();
+            onInsert(tuple);
+        }
+        scan.close();
+    }
+
+    size_t getNumGroups() const { return groups.size(); }
+    size_t getNumRecomputes() const { return num_recomputes; }
+
+private:
+    std::string encodeKey(const std::vector<std::unique_ptr<Field>>& fields) const {
+        std::string encoded;
+        for (auto attr : group_by_attrs) {
+            encoded += fields.at(attr)->serialize();
+        }
+        return encoded;
+    }
+
+    static void add(AggregateState& state, const Field& field) {
+        switch (field.getType()) {
+            case INT: state.updateInt(field.asInt()); break;
+            case FLOAT: state.updateFloat(field.asFloat()); break;
+            case STRING: state.updateString(); break;
+        }
+    }
+
+    // Rebuilds the states of the stale groups in a single scan
+    void recomputeStale() {
+        std::vector<Group*> stale;
+        for (auto& [encoded, group] : groups) {
+            if (group.stale) {
+                group.states.assign(aggr_funcs.size(), AggregateState());
+                stale.push_back(&group);
+            }
+        }
+        if (stale.empty()) {
+            return;
+        }
+        num_recomputes++;
+        ScanOperator scan(bufferManager);
+        scan.open();
+        while (scan.next()) {
+            auto fields = scan.getOutput();
+            if (predicate && !predicate->check(fields)) {
+                continue;
+            }
+            auto it = groups.find(encodeKey(fields));
+            if (it == groups.end() || !it->second.stale) {
+                continue;
+            }
+            for (size_t a = 0; a < aggr_funcs.size(); ++a) {
+                add(it->second.states[a], *fields.at(aggr_funcs[a].attr_index));
+            }
+        }
+        scan.close();
+        for (auto* group : stale) {
+            group->stale = false;
+        }
+    }
+};
+
+// Hashes the raw bits of a field instead of going through a string
+inline size_t hashField(const Field& field) {
+    uint64_t bits = 0;
+    switch (field.getType()) {
+        case INT: {
+            bits = static_cast<uint32_t>(field.asInt());
+            break;
+        }
+        case FLOAT:
+            bits = floatKeyBits(field.asFloat());
+            break;
+        case STRING:
+            return std::hash<std::string>()(std::string(field.data.get(), field.data_length - 1));
+    }
+    return static_cast<size_t>(mixBits(bits));
+}
+
+inline size_t hashFields(const std::vector<std::unique_ptr<Field>>& fields,
+                         const std::vector<size_t>& indexes) {
+    size_t hash = 0;
+    for (auto index : indexes) {
+        hash ^= hashField(*fields[index]) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+enum class JoinType { INNER, LEFT_OUTER, SEMI, ANTI };
+
+// Rows stored back to back: the values of all rows in one array and the
+// characters of all strings in another, so that adding a row allocates
+// nothing once the arrays have grown. Row i holds the values
+// [offsets[i], offsets[i + 1]).
+class FlatRows {
+private:
+    struct Value {
+        FieldType type = INT;
+        bool null = false;
+        int int_value = 0;
+        float float_value = 0;
+        uint32_t string_length = 0;
+        size_t string_offset = 0;
+    };
+
+    std::vector<Value> values;
+    std::vector<size_t> offsets{0};
+    std::vector<char> characters;
+
+public:
+    size_t size() const { return offsets.size() - 1; }
+
+    void append(const std::vector<std::unique_ptr<Field>>& row) {
+        for (const auto& field : row) {
+            Value value;
+            if (!field) {
+                value.null = true;
+            } else {
+                value.type = field->getType();
+                switch (value.type) {
+                    case INT: value.int_value = field->asInt(); break;
+                    case FLOAT: value.float_value = field->asFloat(); break;
+                    case STRING:
+                        value.string_offset = characters.size();
+                        value.string_length = static_cast<uint32_t>(field->data_length - 1);
+                        characters.insert(characters.end(), field->data.get(), field->data.get() + value.string_length);
+                        break;
+                }
+            }
+            values.push_back(value);
+        }
+        offsets.push_back(values.size());
+    }
+
+    // Equals hashFields() of the row as Fields; NULL keys hash to 0
+    size_t hash(size_t row, const std::vector<size_t>& indexes) const {
+        size_t hash = 0;
+        for (auto index : indexes) {
+            hash ^= hashValue(values[offsets[row] + index]) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+        }
+        return hash;
+    }
+
+    // Whether field `index` of `row` equals `field`; NULL equals nothing
+    bool equals(size_t row, size_t index, const Field* field) const {
+        const Value& value = values[offsets[row] + index];
+        if (value.null || !field || field->getType() != value.type) {
+            return false;
+        }
+        switch (value.type) {
+            case INT: return value.int_value == field->asInt();
+            case FLOAT: return value.float_value == field->asFloat();
+            case STRING:
+                return field->data_length - 1 == value.string_length &&
+                       std::memcmp(characters.data() + value.string_offset, field->data.get(), value.string_length) == 0;
+        }
+        return false;
+    }
+
+    // Appends copies of the fields of `row` to `output`
+    void copyTo(size_t row, std::vector<std::unique_ptr<Field>>& output) const {
+        for (size_t i = offsets[row]; i < offsets[row + 1]; ++i) {
+            const Value& value = values[i];
+            if (value.null) {
+                output.push_back(nullptr);
+                continue;
+            }
+            switch (value.type) {
+                case INT: output.push_back(std::make_unique<Field>(value.int_value)); break;
+                case FLOAT: output.push_back(std::make_unique<Field>(value.float_value)); break;
+                case STRING:
+                    output.push_back(std::make_unique<Field>(
+                        std::string(characters.data() + value.string_offset, value.string_length)));
+                    break;
+            }
+        }
+    }
+
+    void clear() {
+        values.clear();
+        offsets.assign(1, 0);
+        characters.clear();
+    }
+
+private:
+    // Same as hashField()
+    size_t hashValue(const Value& value) const {
+        if (value.null) {
+            return 0;
+        }
+        switch (value.type) {
+            case INT: return static_cast<size_t>(mixBits(static_cast<uint32_t>(value.int_value)));
+            case FLOAT: return static_cast<size_t>(mixBits(floatKeyBits(value.float_value)));
+            case STRING:
+                return std::hash<std::string_view>()(std::string_view(characters.data() + value.string_offset,
+                                                                      value.string_length));
+        }
+        return 0;
+    }
+};
+
+// Chained hash table over a fixed set of build rows. Buckets and chains
+// are index arrays sized once from the build cardinality, so inserting
+// an entry never allocates.
+class JoinHashTable {
+public:
+    static constexpr uint32_t END = std::numeric_limits<uint32_t>::max();
+
+private:
+    std::vector<uint32_t> directory; // First entry of each bucket
+    std::vector<uint32_t> chain;     // Next entry in the same bucket
+    std::vector<size_t> hashes;      // Full hash of each entry, checked before the keys
+    size_t mask = 0;
+
+public:
+    // Entry i is the build row with hash entry_hashes[i]
+    void build(std::vector<size_t> entry_hashes) {
+        size_t entries = entry_hashes.size();
+        size_t buckets = 1;
+        while (buckets < entries * 2) {
+            buckets <<= 1;
+        }
+        mask = buckets - 1;
+        directory.assign(buckets, END);
+        chain.assign(entries, END);
+        hashes = std::move(entry_hashes);
+
+        for (size_t i = 0; i < entries; ++i) {
+            size_t hash = hashes[i];
+            chain[i] = directory[hash & mask];
+            directory[hash & mask] = static_cast<uint32_t>(i);
+        }
+    }
+
+    // Returns the first entry whose hash equals `hash`, or END
+    uint32_t first(size_t hash) const {
+        return skip(directory[hash & mask], hash);
+    }
+
+    // Returns the next entry after `entry` whose hash equals `hash`, or END
+    uint32_t next(uint32_t entry, size_t hash) const {
+        return skip(chain[entry], hash);
+    }
+
+    void clear() {
+        directory.clear();
+        chain.clear();
+        hashes.clear();
+    }
+
+private:
+    uint32_t skip(uint32_t entry, size_t hash) const {
+        while (entry != END && hashes[entry] != hash) {
+            entry = chain[entry];
+        }
+        return entry;
+    }
+};
+
+// Equi-join of two inputs. The input that runs out first while both are
+// read alternately becomes the build side, so the hash table is always
+// built on the smaller input. The probe rows read so far are buffered and
+// probed first. Both are kept as FlatRows, so the chains of the hash table
+// index flat storage instead of a heap allocation per row and field. Outer
+// join padding is represented by null Field pointers, `right_arity` of them
+// per unmatched left row. NULL keys match nothing.
+class HashJoinOperator : public BinaryOperator {
+private:
+    using Row = std::vector<std::unique_ptr<Field>>;
+
+    std::vector<size_t> left_keys;
+    std::vector<size_t> right_keys;
+    JoinType join_type;
+
+    bool build_left = false;
+    FlatRows build_rows;
+    std::vector<bool> build_matched;
+    JoinHashTable hash_table;
+    size_t right_arity;
+
+    FlatRows buffered_probe_rows;
+    size_t buffered_probe_index = 0;
+    Row probe_row;
+    size_t probe_hash = 0;
+    bool has_probe_row = false;
+    bool probe_matched = false;
+    uint32_t match_cursor = JoinHashTable::END;
+    size_t unmatched_index = 0;
+
+    Row currentOutput;
+
+public:
+    HashJoinOperator(Operator& input_left, Operator& input_right,
+                     std::vector<size_t> left_keys, std::vector<size_t> right_keys,
+                     JoinType join_type = JoinType::INNER, size_t right_arity = 0)
+        : BinaryOperator(input_left, input_right),
+          left_keys(std::move(left_keys)), right_keys(std::move(right_keys)), join_type(join_type),
+          right_arity(right_arity) {
+        if (this->left_keys.size() != this->right_keys.size() || this->left_keys.empty()) {
+            throw std::runtime_error("Join needs the same, non-zero number of keys on both sides.");
+        }
+    }
+
+    void open() override {
+        input_left->open();
+        input_right->open();
+        resetState();
+
+        // Read both inputs alternately until one of them is exhausted
+        FlatRows left_rows;
+        FlatRows right_rows;
+        bool left_done = false;
+        bool right_done = false;
+        while (!left_done && !right_done) {
+            left_done = !fetch(*input_left, left_rows);
+            if (!left_done) {
+                right_done = !fetch(*input_right, right_rows);
+            }
+        }
+
+        build_left = left_done;
+        if (build_left) {
+            build_rows = std::move(left_rows);
+            buffered_probe_rows = std::move(right_rows);
+        } else {
+            build_rows = std::move(right_rows);
+            buffered_probe_rows = std::move(left_rows);
+        }
+        build_matched.assign(build_rows.size(), false);
+        std::vector<size_t> hashes(build_rows.size());
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            hashes[i] = build_rows.hash(i, buildKeys());
+        }
+        hash_table.build(std::move(hashes));
+    }
+
+    bool next() override {
+        while (true) {
+            if (has_probe_row && emitMatch()) {
+                return true;
+            }
+            if (has_probe_row) {
+                has_probe_row = false;
+                if (emitUnmatchedProbeRow()) {
+                    return true;
+                }
+            }
+            if (!fetchProbeRow()) {
+                break;
+            }
+            bool null_key = std::any_of(probeKeys().begin(), probeKeys().end(),
+                                        [&](size_t key) { return !probe_row[key]; });
+            probe_hash = null_key ? 0 : hashFields(probe_row, probeKeys());
+            match_cursor = null_key ? JoinHashTable::END : hash_table.first(probe_hash);
+            probe_matched = false;
+            has_probe_row = true;
+        }
+
+        // With the left side as build side, outer and anti joins finish
+        // with the build rows that never found a partner
+        if (build_left && (join_type == JoinType::LEFT_OUTER || join_type == JoinType::ANTI)) {
+            while (unmatched_index < build_rows.size()) {
+                size_t index = unmatched_index++;
+                if (!build_matched[index]) {
+                    currentOutput.clear();
+                    build_rows.copyTo(index, currentOutput);
+                    if (join_type == JoinType::LEFT_OUTER) {
+                        currentOutput.resize(currentOutput.size() + right_arity);
+                    }
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void close() override {
+        input_left->close();
+        input_right->close();
+        resetState();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        return std::move(currentOutput);
+    }
+
+private:
+    const std::vector<size_t>& buildKeys() const { return build_left ? left_keys : right_keys; }
+    const std::vector<size_t>& probeKeys() const { return build_left ? right_keys : left_keys; }
+
+    void resetState() {
+        build_rows.clear();
+        build_matched.clear();
+        hash_table.clear();
+        buffered_probe_rows.clear();
+        buffered_probe_index = 0;
+        probe_row.clear();
+        has_probe_row = false;
+        match_cursor = JoinHashTable::END;
+        unmatched_index = 0;
+        currentOutput.clear();
+    }
+
+    static bool fetch(Operator& input, FlatRows& rows) {
+        if (!input.next()) {
+            return false;
+        }
+        rows.append(input.getOutput());
+        return true;
+    }
+
+    bool fetchProbeRow() {
+        if (buffered_probe_index < buffered_probe_rows.size()) {
+            probe_row.clear();
+            buffered_probe_rows.copyTo(buffered_probe_index++, probe_row);
+            return true;
+        }
+        Operator& probe_input = build_left ? *input_right : *input_left;
+        if (!probe_input.next()) {
+            return false;
+        }
+        probe_row = probe_input.getOutput();
+        return true;
+    }
+
+    bool keysEqual(uint32_t entry) const {
+        const auto& build_keys = buildKeys();
+        const auto& probe_keys = probeKeys();
+        for (size_t i = 0; i < build_keys.size(); ++i) {
+            if (!build_rows.equals(entry, build_keys[i], probe_row[probe_keys[i]].get())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Advances through the matches of the current probe row; returns true
+    // when an output row has been produced
+    bool emitMatch() {
+        while (match_cursor != JoinHashTable::END) {
+            uint32_t entry = match_cursor;
+            match_cursor = hash_table.next(entry, probe_hash);
+            if (!keysEqual(entry)) {
+                continue;
+            }
+            probe_matched = true;
+
+            if (build_left) {
+                bool first_match = !build_matched[entry];
+                build_matched[entry] = true;
+                switch (join_type) {
+                    case JoinType::INNER:
+                    case JoinType::LEFT_OUTER:
+                        currentOutput.clear();
+                        build_rows.copyTo(entry, currentOutput);
+                        appendCopy(currentOutput, probe_row);
+                        return true;
+                    case JoinType::SEMI:
+                        if (first_match) {
+                            currentOutput.clear();
+                            build_rows.copyTo(entry, currentOutput);
+                            return true;
+                        }
+                        break;
+                    case JoinType::ANTI:
+                        break;
+                }
+            } else {
+                switch (join_type) {
+                    case JoinType::INNER:
+                    case JoinType::LEFT_OUTER:
+                        currentOutput.clear();
+                        appendCopy(currentOutput, probe_row);
+                        build_rows.copyTo(entry, currentOutput);
+                        return true;
+                    case JoinType::SEMI:
+                        match_cursor = JoinHashTable::END;
+                        currentOutput.clear();
+                        appendCopy(currentOutput, probe_row);
+                        return true;
+                    case JoinType::ANTI:
+                        match_cursor = JoinHashTable::END;
+                        break;
+                }
+            }
+        }
+        return false;
+    }
+
+    // With the right side as build side, a left row without partner still
+    // produces output for outer and anti joins
+    bool emitUnmatchedProbeRow() {
+        if (build_left || probe_matched) {
+            return false;
+        }
+        if (join_type == JoinType::LEFT_OUTER || join_type == JoinType::ANTI) {
+            currentOutput.clear();
+            appendCopy(currentOutput, probe_row);
+            if (join_type == JoinType::LEFT_OUTER) {
+                currentOutput.resize(currentOutput.size() + right_arity);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static void appendCopy(Row& output, const Row& row) {
+        for (const auto& field : row) {
+            output.push_back(field ? field->clone() : nullptr);
+        }
+    }
+};
+
+// Runs fn(thread_id) on `num_threads` threads and waits for all of them
+void parallelFor(size_t num_threads, const std::function<void(size_t)>& fn) {
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_threads; ++t) {
+        threads.emplace_back(fn, t);
+    }
+    fn(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t defaultThreadCount() {
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+static constexpr size_t CACHE_LINE_SIZE = 64;
+static constexpr size_t L2_CACHE_SIZE = 256 * 1024;
+// 2^8 write-combining buffers of one cache line take 16KB, which stays in
+// L1, and 256 output streams stay within the reach of the TLB
+static constexpr unsigned MAX_RADIX_BITS_PER_PASS = 8;
+
+// Radix-partitioned hash join on 32-bit integer keys. Both inputs are
+// partitioned on the low bits of the key hash, one or more passes at a
+// time, until a build partition and its hash table fit in L2. Each pass
+// scatters through cache-line sized software write-combining buffers.
+// Matching partitions are then joined independently by worker threads.
+class RadixJoin {
+public:
+    struct Entry {
+        int32_t key;
+        uint32_t row; // Position of the tuple in its input
+    };
+
+private:
+    static constexpr size_t ENTRIES_PER_LINE = CACHE_LINE_SIZE / sizeof(Entry);
+    static constexpr uint32_t END = std::numeric_limits<uint32_t>::max();
+
+    struct alignas(CACHE_LINE_SIZE) CacheLine {
+        Entry entries[ENTRIES_PER_LINE];
+    };
+
+    // A partitioned copy of one input: partition p lives in [bounds[p], bounds[p + 1])
+    struct Partitioned {
+        std::vector<Entry> entries;
+        std::vector<size_t> bounds;
+    };
+
+    size_t num_threads;
+    std::vector<unsigned> pass_bits;
+    unsigned total_bits = 0;
+
+public:
+    explicit RadixJoin(size_t num_threads = defaultThreadCount())
+        : num_threads(std::max<size_t>(1, num_threads)) {}
+
+    static uint32_t hashKey(int32_t key) {
+        uint32_t h = static_cast<uint32_t>(key);
+        h ^= h >> 16;
+        h *= 0x85ebca6bU;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35U;
+        h ^= h >> 16;
+        return h;
+    }
+
+    // Calls emit(thread_id, build_row, probe_row) for every pair of entries
+    // with equal keys. Calls from different threads may run concurrently.
+    template<typename Emit>
+    void join(const std::vector<Entry>& build, const std::vector<Entry>& probe, Emit emit) {
+        planPasses(build.size());
+        Partitioned build_parts = partition(build);
+        Partitioned probe_parts = partition(probe);
+
+        size_t num_partitions = size_t(1) << total_bits;
+        std::atomic<size_t> next_partition{0};
+        parallelFor(num_threads, [&](size_t thread_id) {
+            std::vector<uint32_t> directory;
+            std::vector<uint32_t> chain;
+            size_t p;
+            while ((p = next_partition.fetch_add(1)) < num_partitions) {
+                joinPartition(thread_id, build_parts, probe_parts, p, directory, chain, emit);
+            }
+        });
+    }
+
+    unsigned getTotalBits() const { return total_bits; }
+    size_t getNumPasses() const { return pass_bits.size(); }
+
+private:
+    // Chooses the number of radix bits so that a build partition plus its
+    // directory and chain fits in L2, spread evenly over as few passes as possible
+    void planPasses(size_t build_size) {
+        const size_t bytes_per_entry = sizeof(Entry) + 3 * sizeof(uint32_t);
+        const size_t rows_per_partition = std::max<size_t>(1, L2_CACHE_SIZE / bytes_per_entry);
+        total_bits = 0;
+        while ((build_size >> total_bits) > rows_per_partition) {
+            total_bits++;
+        }
+        size_t passes = (total_bits + MAX_RADIX_BITS_PER_PASS - 1) / MAX_RADIX_BITS_PER_PASS;
+        pass_bits.clear();
+        unsigned remaining = total_bits;
+        for (size_t pass = 0; pass < passes; ++pass) {
+            unsigned bits = static_cast<unsigned>((remaining + (passes - pass) - 1) / (passes - pass));
+            pass_bits.push_back(bits);
+            remaining -= bits;
+        }
+    }
+
+    Partitioned partition(const std::vector<Entry>& input) {
+        Partitioned current;
+        if (pass_bits.empty()) {
+            current.entries = input;
+            current.bounds = {0, input.size()};
+            return current;
+        }
+
+        current.entries.resize(input.size());
+        firstPass(input, current, 0, pass_bits[0]);
+        unsigned shift = pass_bits[0];
+
+        Partitioned next;
+        for (size_t pass = 1; pass < pass_bits.size(); ++pass) {
+            next.entries.resize(input.size());
+            refinePass(current, next, shift, pass_bits[pass]);
+            std::swap(current, next);
+            shift += pass_bits[pass];
+        }
+        return current;
+    }
+
+    // Splits the whole input with all threads: each thread histograms and
+    // scatters its own chunk into disjoint ranges of every partition
+    void firstPass(const std::vector<Entry>& input, Partitioned& output, unsigned shift, unsigned bits) {
+        const size_t fanout = size_t(1) << bits;
+        const size_t chunk = (input.size() + num_threads - 1) / num_threads;
+        std::vector<std::vector<size_t>> histograms(num_threads, std::vector<size_t>(fanout, 0));
+
+        parallelFor(num_threads, [&](size_t t) {
+            size_t begin = std::min(input.size(), t * chunk);
+            size_t end = std::min(input.size(), begin + chunk);
+            for (size_t i = begin; i < end; ++i) {
+                histograms[t][partitionOf(input[i].key, shift, bits)]++;
+            }
+        });
+
+        // Partition-major prefix sum gives every thread its write cursors
+        std::vector<std::vector<size_t>> cursors(num_threads, std::vector<size_t>(fanout));
+        output.bounds.assign(fanout + 1, 0);
+        size_t offset = 0;
+        for (size_t p = 0; p < fanout; ++p) {
+            output.bounds[p] = offset;
+            for (size_t t = 0; t < num_threads; ++t) {
+                cursors[t][p] = offset;
+                offset += histograms[t][p];
+            }
+        }
+        output.bounds[fanout] = offset;
+
+        parallelFor(num_threads, [&](size_t t) {
+            size_t begin = std::min(input.size(), t * chunk);
+            size_t end = std::min(input.size(), begin + chunk);
+            scatter(input.data() + begin, end - begin, output.entries.data(), cursors[t], shift, bits);
+        });
+    }
+
+    // Splits every existing partition further; partitions are independent
+    // tasks handed out to the threads
+    void refinePass(const Partitioned& input, Partitioned& output, unsigned shift, unsigned bits) {
+        const size_t fanout = size_t(1) << bits;
+        const size_t num_inputs = input.bounds.size() - 1;
+        output.bounds.assign(num_inputs * fanout + 1, 0);
+        output.bounds[num_inputs * fanout] = input.bounds[num_inputs];
+
+        std::atomic<size_t> next_input{0};
+        parallelFor(num_threads, [&](size_t) {
+            std::vector<size_t> cursors(fanout);
+            size_t p;
+            while ((p = next_input.fetch_add(1)) < num_inputs) {
+                size_t begin = input.bounds[p];
+                size_t end = input.bounds[p + 1];
+                std::fill(cursors.begin(), cursors.end(), 0);
+                for (size_t i = begin; i < end; ++i) {
+                    cursors[partitionOf(input.entries[i].key, shift, bits)]++;
+                }
+                size_t offset = begin;
+                for (size_t q = 0; q < fanout; ++q) {
+                    size_t count = cursors[q];
+                    output.bounds[p * fanout + q] = offset;
+                    cursors[q] = offset;
+                    offset += count;
+                }
+                scatter(input.entries.data() + begin, end - begin, output.entries.data(), cursors, shift, bits);
+            }
+        });
+    }
+
+    static size_t partitionOf(int32_t key, unsigned shift, unsigned bits) {
+        return (hashKey(key) >> shift) & ((size_t(1) << bits) - 1);
+    }
+
+    // Software write-combining scatter: entries are staged in one cache
+    // line per partition and written out a full line at a time
+    static void scatter(const Entry* input, size_t count, Entry* output,
+                        std::vector<size_t>& cursors, unsigned shift, unsigned bits) {
+        const size_t fanout = size_t(1) << bits;
+        std::vector<CacheLine> buffers(fanout);
+        std::vector<uint8_t> fill(fanout, 0);
+
+        for (size_t i = 0; i < count; ++i) {
+            size_t p = partitionOf(input[i].key, shift, bits);
+            buffers[p].entries[fill[p]++] = input[i];
+            if (fill[p] == ENTRIES_PER_LINE) {
+                std::memcpy(output + cursors[p], buffers[p].entries, sizeof(CacheLine));
+                cursors[p] += ENTRIES_PER_LINE;
+                fill[p] = 0;
+            }
+        }
+        for (size_t p = 0; p < fanout; ++p) {
+            std::memcpy(output + cursors[p], buffers[p].entries, fill[p] * sizeof(Entry));
+            cursors[p] += fill[p];
+        }
+    }
+
+    template<typename Emit>
+    void joinPartition(size_t thread_id, const Partitioned& build, const Partitioned& probe, size_t p,
+                       std::vector<uint32_t>& directory, std::vector<uint32_t>& chain, Emit& emit) const {
+        size_t build_begin = build.bounds[p];
+        size_t build_size = build.bounds[p + 1] - build_begin;
+        size_t probe_begin = probe.bounds[p];
+        size_t probe_end = probe.bounds[p + 1];
+        if (build_size == 0 || probe_begin == probe_end) {
+            return;
+        }
+
+        // The partition bits are identical within a partition, so the
+        // bucket is taken from the hash bits above them
+        size_t buckets = 1;
+        while (buckets < build_size) {
+            buckets <<= 1;
+        }
+        const size_t mask = buckets - 1;
+        directory.assign(buckets, END);
+        chain.resize(build_size);
+        const Entry* build_entries = build.entries.data() + build_begin;
+        for (size_t i = 0; i < build_size; ++i) {
+            size_t bucket = (hashKey(build_entries[i].key) >> total_bits) & mask;
+            chain[i] = directory[bucket];
+            directory[bucket] = static_cast<uint32_t>(i);
+        }
+
+        for (size_t i = probe_begin; i < probe_end; ++i) {
+            const Entry& probe_entry = probe.entries[i];
+            size_t bucket = (hashKey(probe_entry.key) >> total_bits) & mask;
+            for (uint32_t e = directory[bucket]; e != END; e = chain[e]) {
+                if (build_entries[e].key == probe_entry.key) {
+                    emit(thread_id, build_entries[e].row, probe_entry.row);
+                }
+            }
+        }
+    }
+};
+
+// Inner equi-join on a single INT attribute per side, executed with
+// RadixJoin. Both inputs are materialized; the smaller one is the build side.
+class RadixHashJoinOperator : public BinaryOperator {
+private:
+    using Row = std::vector<std::unique_ptr<Field>>;
+
+    size_t left_key;
+    size_t right_key;
+    size_t num_threads;
+
+    std::vector<Row> left_rows;
+    std::vector<Row> right_rows;
+    std::vector<std::pair<uint32_t, uint32_t>> matches; // (left row, right row)
+    size_t match_index = 0;
+
+public:
+    RadixHashJoinOperator(Operator& input_left, Operator& input_right,
+                          size_t left_key, size_t right_key,
+                          size_t num_threads = defaultThreadCount())
+        : BinaryOperator(input_left, input_right),
+          left_key(left_key), right_key(right_key), num_threads(num_threads) {}
+
+    void open() override {
+        input_left->open();
+        input_right->open();
+        left_rows.clear();
+        right_rows.clear();
+        matches.clear();
+        match_index = 0;
+
+        std::vector<RadixJoin::Entry> left_entries = materialize(*input_left, left_key, left_rows);
+        std::vector<RadixJoin::Entry> right_entries = materialize(*input_right, right_key, right_rows);
+        bool build_left = left_entries.size() <= right_entries.size();
+
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> thread_matches(num_threads);
+        RadixJoin radix_join(num_threads);
+        radix_join.join(build_left ? left_entries : right_entries,
+                        build_left ? right_entries : left_entries,
+                        [&](size_t thread_id, uint32_t build_row, uint32_t probe_row) {
+                            if (build_left) {
+                                thread_matches[thread_id].emplace_back(build_row, probe_row);
+                            } else {
+                                thread_matches[thread_id].emplace_back(probe_row, build_row);
+                            }
+                        });
+        for (auto& local : thread_matches) {
+            matches.insert(matches.end(), local.begin(), local.end());
+        }
+    }
+
+    bool next() override {
+        if (match_index < matches.size()) {
+            match_index++;
+            return true;
+        }
+        return false;
+    }
+
+    void close() override {
+        input_left->close();
+        input_right->close();
+        left_rows.clear();
+        right_rows.clear();
+        matches.clear();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        Row output;
+        if (match_index == 0 || match_index > matches.size()) {
+            return output;
+        }
+        const auto& match = matches[match_index - 1];
+        for (const auto& field : left_rows[match.first]) {
+            output.push_back(field ? field->clone() : nullptr);
+        }
+        for (const auto& field : right_rows[match.second]) {
+            output.push_back(field ? field->clone() : nullptr);
+        }
+        return output;
+    }
+
+private:
+    static std::vector<RadixJoin::Entry> materialize(Operator& input, size_t key, std::vector<Row>& rows) {
+        std::vector<RadixJoin::Entry> entries;
+        while (input.next()) {
+            rows.push_back(input.getOutput());
+            const Field& field = *rows.back()[key];
+            if (field.getType() != INT) {
+                throw std::runtime_error("Radix join requires INT join keys.");
+            }
+            entries.push_back({field.asInt(), static_cast<uint32_t>(rows.size() - 1)});
+        }
+        return entries;
+    }
+};
+
+// Tournament tree of losers for k-way merging. `less(a, b)` compares the
+// current heads of sources a and b; exhausted sources must compare greater
+// than everything else. After the winner's source advances, replay() finds
+// the new winner with log2(k) comparisons.
+template<typename Less>
+class LoserTree {
+private:
+    size_t k;
+    std::vector<size_t> tree; // tree[0] is the winner, tree[1..k-1] the losers
+    Less less;
+
+public:
+    LoserTree(size_t k, Less less) : k(k), tree(std::max<size_t>(k, 1)), less(less) {
+        // Leaves are numbered k..2k-1 in heap order
+        std::vector<size_t> winners(2 * k);
+        for (size_t i = 0; i < k; ++i) {
+            winners[k + i] = i;
+        }
+        for (size_t node = k - 1; node >= 1; --node) {
+            size_t a = winners[2 * node];
+            size_t b = winners[2 * node + 1];
+            if (less(b, a)) {
+                std::swap(a, b);
+            }
+            winners[node] = a;
+            tree[node] = b;
+        }
+        tree[0] = k > 1 ? winners[1] : 0;
+    }
+
+    size_t winner() const { return tree[0]; }
+
+    void replay() {
+        size_t winner = tree[0];
+        for (size_t node = (k + winner) / 2; node >= 1; node /= 2) {
+            if (less(tree[node], winner)) {
+                std::swap(tree[node], winner);
+            }
+        }
+        tree[0] = winner;
+    }
+};
+
+// Encodes the sort attributes of a row into a byte string whose memcmp
+// order is the requested sort order: each component starts with a NULL
+// flag, so NULLs sort after all values, integers and floats become
+// big-endian unsigned images, strings are escaped and terminated, and
+// descending components are inverted
+std::string normalizeSortKey(const std::vector<std::unique_ptr<Field>>& row, const std::vector<SortKey>& keys) {
+    std::string normalized;
+    for (const auto& key : keys) {
+        size_t start = normalized.size();
+        const Field* value = row[key.attr_index].get();
+        normalized.push_back(value ? '\0' : '\1');
+        if (!value) {
+            if (key.descending) {
+                normalized[start] = static_cast<char>(~normalized[start]);
+            }
+            continue;
+        }
+        const Field& field = *value;
+        uint32_t bits = 0;
+        switch (field.getType()) {
+            case INT:
+                bits = static_cast<uint32_t>(field.asInt()) ^ 0x80000000U;
+                break;
+            case FLOAT: {
+                float value = field.asFloat();
+                if (value == 0.0f) {
+                    value = 0.0f;
+                }
+                std::memcpy(&bits, &value, sizeof(bits));
+                bits = (bits & 0x80000000U) ? ~bits : (bits | 0x80000000U);
+                break;
+            }
+            case STRING: {
+                for (size_t i = 0; i + 1 < field.data_length; ++i) {
+                    char c = field.data[i];
+                    normalized.push_back(c);
+                    if (c == '\0') {
+                        normalized.push_back('\xff');
+                    }
+                }
+                normalized.append(2, '\0');
+                break;
+            }
+        }
+        if (field.getType() != STRING) {
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                normalized.push_back(static_cast<char>((bits >> shift) & 0xff));
+            }
+        }
+        if (key.descending) {
+            for (size_t i = start; i < normalized.size(); ++i) {
+                normalized[i] = static_cast<char>(~normalized[i]);
+            }
+        }
+    }
+    return normalized;
+}
+
+static constexpr size_t DEFAULT_SORT_MEMORY = 1024 * 1024;
+
+// External merge sort. Rows are collected until `memory_budget` is
+// exceeded, then sorted and spilled as a run. Runs are merged with a
+// loser tree; if there are more runs than page buffers fit into the
+// budget, they are first merged into longer runs. Comparisons operate
+// on normalized keys, with the first eight bytes kept as an integer.
+class SortOperator : public UnaryOperator {
+private:
+    using Row = std::vector<std::unique_ptr<Field>>;
+
+    struct SortRecord {
+        uint64_t prefix = 0;
+        std::string key;
+        Row row;
+    };
+
+    struct RecordLess {
+        bool operator()(const SortRecord& a, const SortRecord& b) const {
+            if (a.prefix != b.prefix) {
+                return a.prefix < b.prefix;
+            }
+            return a.key < b.key;
+        }
+    };
+
+    // Reads records back from a run during the merge
+    struct RunCursor {
+        std::unique_ptr<SpillFile> run;
+        SortRecord head;
+        bool exhausted = false;
+    };
+
+    struct CursorLess {
+        std::vector<RunCursor>* cursors;
+        bool operator()(size_t a, size_t b) const {
+            const RunCursor& x = (*cursors)[a];
+            const RunCursor& y = (*cursors)[b];
+            if (x.exhausted || y.exhausted) {
+                return !x.exhausted && y.exhausted;
+            }
+            return RecordLess()(x.head, y.head);
+        }
+    };
+
+    std::vector<SortKey> sort_keys;
+    size_t memory_budget;
+
+    std::vector<SortRecord> records;
+    size_t records_bytes = 0;
+    size_t record_index = 0;
+    std::vector<std::unique_ptr<SpillFile>> runs;
+    std::vector<RunCursor> cursors;
+    std::unique_ptr<LoserTree<CursorLess>> loser_tree;
+    bool first_output = true;
+    Row currentOutput;
+
+public:
+    SortOperator(Operator& input, std::vector<SortKey> sort_keys, size_t memory_budget = DEFAULT_SORT_MEMORY)
+        : UnaryOperator(input), sort_keys(std::move(sort_keys)),
+          memory_budget(std::max(memory_budget, 2 * PAGE_SIZE)) {}
+
+    void open() override {
+        input->open();
+        reset();
+
+        while (input->next()) {
+            SortRecord record;
+            record.row = input->getOutput();
+            setKey(record);
+            records_bytes += recordBytes(record);
+            records.push_back(std::move(record));
+            if (records_bytes > memory_budget) {
+                spillRun();
+            }
+        }
+
+        if (runs.empty()) {
+            std::sort(records.begin(), records.end(), RecordLess());
+            return;
+        }
+        if (!records.empty()) {
+            spillRun();
+        }
+
+        // Merge until every remaining run can get a page buffer
+        size_t fan_in = std::max<size_t>(2, memory_budget / PAGE_SIZE);
+        while (runs.size() > fan_in) {
+            std::vector<std::unique_ptr<SpillFile>> merged;
+            for (size_t begin = 0; begin < runs.size(); begin += fan_in) {
+                size_t end = std::min(runs.size(), begin + fan_in);
+                std::vector<std::unique_ptr<SpillFile>> group;
+                for (size_t i = begin; i < end; ++i) {
+                    group.push_back(std::move(runs[i]));
+                }
+                merged.push_back(mergeRuns(std::move(group)));
+            }
+            runs = std::move(merged);
+        }
+        startMerge(std::move(runs));
+        runs.clear();
+    }
+
+    bool next() override {
+        if (!loser_tree) {
+            if (record_index < records.size()) {
+                currentOutput = std::move(records[record_index++].row);
+                return true;
+            }
+            return false;
+        }
+
+        if (!first_output) {
+            advance(loser_tree->winner());
+            loser_tree->replay();
+        }
+        first_output = false;
+        RunCursor& winner = cursors[loser_tree->winner()];
+        if (winner.exhausted) {
+            return false;
+        }
+        currentOutput = std::move(winner.head.row);
+        return true;
+    }
+
+    void close() override {
+        input->close();
+        reset();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        return std::move(currentOutput);
+    }
+
+    std::vector<SortKey> getOrdering() const override {
+        return sort_keys;
+    }
+
+    size_t getNumRuns() const { return cursors.size(); }
+
+private:
+    void reset() {
+        records.clear();
+        records_bytes = 0;
+        record_index = 0;
+        runs.clear();
+        loser_tree.reset();
+        cursors.clear();
+        first_output = true;
+        currentOutput.clear();
+    }
+
+    void setKey(SortRecord& record) const {
+        record.key = normalizeSortKey(record.row, sort_keys);
+        record.prefix = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            uint8_t byte = i < record.key.size() ? static_cast<uint8_t>(record.key[i]) : 0;
+            record.prefix = (record.prefix << 8) | byte;
+        }
+    }
+
+    static size_t recordBytes(const SortRecord& record) {
+        size_t bytes = sizeof(SortRecord) + record.key.capacity();
+        for (const auto& field : record.row) {
+            bytes += sizeof(std::unique_ptr<Field>) + (field ? sizeof(Field) + field->data_length : 0);
+        }
+        return bytes;
+    }
+
+    static std::string encode(SortRecord& record) {
+        Tuple tuple;
+        tuple.fields = std::move(record.row);
+        return tuple.serialize();
+    }
+
+    void decode(const std::string& encoded, SortRecord& record) const {
+        std::istringstream iss(encoded);
+        record.row = std::move(Tuple::deserialize(iss)->fields);
+        setKey(record);
+    }
+
+    void spillRun() {
+        std::sort(records.begin(), records.end(), RecordLess());
+        auto run = std::make_unique<SpillFile>();
+        for (auto& record : records) {
+            run->append(encode(record));
+        }
+        runs.push_back(std::move(run));
+        records.clear();
+        records_bytes = 0;
+    }
+
+    void advance(size_t index) {
+        RunCursor& cursor = cursors[index];
+        std::string encoded;
+        if (cursor.run->read(encoded)) {
+            decode(encoded, cursor.head);
+        } else {
+            cursor.exhausted = true;
+        }
+    }
+
+    void startMerge(std::vector<std::unique_ptr<SpillFile>> inputs) {
+        cursors.clear();
+        cursors.resize(inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            cursors[i].run = std::move(inputs[i]);
+            cursors[i].run->rewind();
+            advance(i);
+        }
+        loser_tree = std::make_unique<LoserTree<CursorLess>>(cursors.size(), CursorLess{&cursors});
+        first_output = true;
+    }
+
+    std::unique_ptr<SpillFile> mergeRuns(std::vector<std::unique_ptr<SpillFile>> inputs) {
+        startMerge(std::move(inputs));
+        auto output = std::make_unique<SpillFile>();
+        while (next()) {
+            SortRecord record;
+            record.row = std::move(currentOutput);
+            output->append(encode(record));
+        }
+        loser_tree.reset();
+        cursors.clear();
+        return output;
+    }
+};
+
+// Admission bound of a TopKOperator, shared with the filter it pushes
+// into its input. Holds a comparison against the first sort attribute of
+// the worst row currently kept, or nothing while the heap is not full.
+// NULLs fail the comparison but are admitted when they sort first.
+struct TopKBound {
+    std::unique_ptr<SimplePredicate> predicate;
+    bool keep_nulls = false;
+};
+
+class TopKBoundPredicate : public IPredicate {
+private:
+    std::shared_ptr<const TopKBound> bound;
+
+public:
+    explicit TopKBoundPredicate(std::shared_ptr<const TopKBound> bound) : bound(std::move(bound)) {}
+
+    bool check(const std::vector<std::unique_ptr<Field>>& tupleFields) const override {
+        if (!bound->predicate) {
+            return true;
+        }
+        if (bound->keep_nulls && !tupleFields[bound->predicate->left_operand.index]) {
+            return true;
+        }
+        return bound->predicate->check(tupleFields);
+    }
+
+    void filter(const Batch& batch, std::vector<uint16_t>& selection) const override {
+        if (!bound->predicate) {
+            return;
+        }
+        const ColumnVector& column = batch.columns[bound->predicate->left_operand.index];
+        if (!bound->keep_nulls || !column.hasNulls()) {
+            bound->predicate->filter(batch, selection);
+            return;
+        }
+        std::vector<uint16_t> nulls;
+        for (auto row : selection) {
+            if (column.isNull(row)) {
+                nulls.push_back(row);
+            }
+        }
+        bound->predicate->filter(batch, selection);
+        std::vector<uint16_t> merged;
+        std::merge(selection.begin(), selection.end(), nulls.begin(), nulls.end(), std::back_inserter(merged));
+        selection.swap(merged);
+    }
+};
+
+// ORDER BY ... LIMIT k: keeps the best k rows in a max-heap on their
+// normalized sort keys. Once the heap is full, the top row is published
+// through `bound`; a TopKBoundPredicate on the same bound placed below
+// this operator then drops rows that can no longer enter the heap.
+class TopKOperator : public UnaryOperator {
+private:
+    using Row = std::vector<std::unique_ptr<Field>>;
+
+    struct HeapEntry {
+        std::string key;
+        Row row;
+    };
+
+    struct HeapLess {
+        bool operator()(const HeapEntry& a, const HeapEntry& b) const { return a.key < b.key; }
+    };
+
+    std::vector<SortKey> sort_keys;
+    size_t k;
+    std::shared_ptr<TopKBound> bound;
+    std::vector<HeapEntry> heap;
+    size_t output_index = 0;
+    Row currentOutput;
+
+public:
+    TopKOperator(Operator& input, std::vector<SortKey> sort_keys, size_t k,
+                 std::shared_ptr<TopKBound> bound = std::make_shared<TopKBound>())
+        : UnaryOperator(input), sort_keys(std::move(sort_keys)), k(k), bound(std::move(bound)) {}
+
+    void open() override {
+        heap.clear();
+        bound->predicate.reset();
+        output_index = 0;
+        input->open();
+
+        if (k > 0) {
+            Batch batch;
+            while (input->nextBatch(batch)) {
+                for (auto row : batch.selection) {
+                    offer(batch.getRow(row));
+                }
+            }
+        }
+
+        std::sort_heap(heap.begin(), heap.end(), HeapLess());
+    }
+
+    bool next() override {
+        if (output_index < heap.size()) {
+            currentOutput = std::move(heap[output_index++].row);
+            return true;
+        }
+        return false;
+    }
+
+    void close() override {
+        input->close();
+        heap.clear();
+        bound->predicate.reset();
+    }
+
+    std::vector<SortKey> getOrdering() const override {
+        return sort_keys;
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        return std::move(currentOutput);
+    }
+
+private:
+    void offer(Row row) {
+        std::string key = normalizeSortKey(row, sort_keys);
+        if (heap.size() == k) {
+            if (!(key < heap.front().key)) {
+                return;
+            }
+            std::pop_heap(heap.begin(), heap.end(), HeapLess());
+            heap.pop_back();
+        }
+        heap.push_back({std::move(key), std::move(row)});
+        std::push_heap(heap.begin(), heap.end(), HeapLess());
+        if (heap.size() == k) {
+            tightenBound();
+        }
+    }
+
+    // Rows must beat the first sort attribute of the heap top; ties are
+    // only admitted when later sort attributes can still decide. A NULL
+    // top gives no bound, as a comparison cannot express IS NULL.
+    void tightenBound() {
+        const SortKey& first = sort_keys.front();
+        const auto& worst = heap.front().row[first.attr_index];
+        if (!worst) {
+            bound->predicate.reset();
+            return;
+        }
+        bool strict = sort_keys.size() == 1;
+        SimplePredicate::ComparisonOperator op = first.descending
+            ? (strict ? SimplePredicate::GT : SimplePredicate::GE)
+            : (strict ? SimplePredicate::LT : SimplePredicate::LE);
+        bound->predicate = std::make_unique<SimplePredicate>(
+            SimplePredicate::Operand(first.attr_index),
+            SimplePredicate::Operand(worst->clone()),
+            op);
+        bound->keep_nulls = first.descending;
+    }
+};
+
+// Passes on the first `limit` rows of its input
+class LimitOperator : public UnaryOperator {
+private:
+    size_t limit;
+    size_t produced = 0;
+
+public:
+    LimitOperator(Operator& input, size_t limit) : UnaryOperator(input), limit(limit) {}
+
+    void open() override {
+        input->open();
+        produced = 0;
+    }
+
+    bool next() override {
+        if (produced >= limit || !input->next()) {
+            return false;
+        }
+        produced++;
+        return true;
+    }
+
+    void close() override {
+        input->close();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        return input->getOutput();
+    }
+
+    std::vector<SortKey> getOrdering() const override {
+        return input->getOrdering();
+    }
+};
+
+// True if `input` produces its rows in ascending order of `attrs`
+bool isOrderedOn(const Operator& input, const std::vector<size_t>& attrs) {
+    std::vector<SortKey> ordering = input.getOrdering();
+    if (attrs.empty() || ordering.size() < attrs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < attrs.size(); ++i) {
+        if (ordering[i].attr_index != attrs[i] || ordering[i].descending) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Equi-join of two inputs that are both sorted ascending on their join
+// attributes. Both sides are streamed; only the right rows of the current
+// key group are buffered, so runs of equal keys on the left reuse them.
+// Unmatched left rows of an outer join get `right_arity` null fields.
+class MergeJoinOperator : public BinaryOperator {
+private:
+    using Row = std::vector<std::unique_ptr<Field>>;
+
+    std::vector<size_t> left_keys;
+    std::vector<size_t> right_keys;
+    std::vector<SortKey> left_sort_keys;
+    std::vector<SortKey> right_sort_keys;
+    JoinType join_type;
+
+    Row left_row;
+    std::string left_key;
+    Row right_row;               // Lookahead on the right input
+    std::string right_key;
+    bool right_exhausted = false;
+    std::vector<Row> group;      // Right rows whose key equals group_key
+    std::string group_key;
+    size_t group_index = 0;
+    bool iterating_group = false;
+    size_t right_arity;
+
+    Row currentOutput;
+
+public:
+    MergeJoinOperator(Operator& input_left, Operator& input_right,
+                      std::vector<size_t> left_keys, std::vector<size_t> right_keys,
+                      JoinType join_type = JoinType::INNER, size_t right_arity = 0)
+        : BinaryOperator(input_left, input_right),
+          left_keys(std::move(left_keys)), right_keys(std::move(right_keys)), join_type(join_type),
+          right_arity(right_arity) {
+        if (this->left_keys.size() != this->right_keys.size() || this->left_keys.empty()) {
+            throw std::runtime_error("Join needs the same, non-zero number of keys on both sides.");
+        }
+        for (auto key : this->left_keys) {
+            left_sort_keys.push_back({key, false});
+        }
+        for (auto key : this->right_keys) {
+            right_sort_keys.push_back({key, false});
+        }
+    }
+
+    void open() override {
+        input_left->open();
+        input_right->open();
+        resetState();
+        advanceRight();
+    }
+
+    bool next() override {
+        while (true) {
+            if (iterating_group && group_index < group.size()) {
+                currentOutput = concat(left_row, &group[group_index++]);
+                return true;
+            }
+            iterating_group = false;
+
+            if (!input_left->next()) {
+                return false;
+            }
+            left_row = input_left->getOutput();
+            left_key = normalizeSortKey(left_row, left_sort_keys);
+
+            if (group.empty() || left_key != group_key) {
+                loadGroup();
+            }
+            bool matched = !group.empty();
+
+            switch (join_type) {
+                case JoinType::INNER:
+                case JoinType::LEFT_OUTER:
+                    if (matched) {
+                        group_index = 0;
+                        iterating_group = true;
+                    } else if (join_type == JoinType::LEFT_OUTER) {
+                        currentOutput = concat(left_row, nullptr);
+                        return true;
+                    }
+                    break;
+                case JoinType::SEMI:
+                    if (matched) {
+                        currentOutput = std::move(left_row);
+                        return true;
+                    }
+                    break;
+                case JoinType::ANTI:
+                    if (!matched) {
+                        currentOutput = std::move(left_row);
+                        return true;
+                    }
+                    break;
+            }
+        }
+    }
+
+    void close() override {
+        input_left->close();
+        input_right->close();
+        resetState();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        return std::move(currentOutput);
+    }
+
+    std::vector<SortKey> getOrdering() const override {
+        return left_sort_keys;
+    }
+
+private:
+    void resetState() {
+        left_row.clear();
+        right_row.clear();
+        right_exhausted = false;
+        group.clear();
+        group_index = 0;
+        iterating_group = false;
+        currentOutput.clear();
+    }
+
+    void advanceRight() {
+        if (input_right->next()) {
+            right_row = input_right->getOutput();
+            right_key = normalizeSortKey(right_row, right_sort_keys);
+        } else {
+            right_exhausted = true;
+            right_row.clear();
+        }
+    }
+
+    // Skips right rows with smaller keys and buffers those equal to left_key
+    void loadGroup() {
+        group.clear();
+        while (!right_exhausted && right_key < left_key) {
+            advanceRight();
+        }
+        while (!right_exhausted && right_key == left_key) {
+            group.push_back(std::move(right_row));
+            advanceRight();
+        }
+        group_key = left_key;
+    }
+
+    Row concat(const Row& left, const Row* right) const {
+        Row output;
+        for (const auto& field : left) {
+            output.push_back(field ? field->clone() : nullptr);
+        }
+        if (right) {
+            for (const auto& field : *right) {
+                output.push_back(field ? field->clone() : nullptr);
+            }
+        } else {
+            output.resize(left.size() + right_arity);
+        }
+        return output;
+    }
+};
+
+// Picks the join algorithm: a merge join when both inputs already arrive
+// sorted on the join attributes, a hash join otherwise
+std::unique_ptr<Operator> makeJoinOperator(Operator& left, Operator& right,
+                                           std::vector<size_t> left_keys, std::vector<size_t> right_keys,
+                                           JoinType join_type = JoinType::INNER, size_t right_arity = 0) {
+    if (isOrderedOn(left, left_keys) && isOrderedOn(right, right_keys)) {
+        return std::make_unique<MergeJoinOperator>(left, right, std::move(left_keys),
+                                                   std::move(right_keys), join_type, right_arity);
+    }
+    return std::make_unique<HashJoinOperator>(left, right, std::move(left_keys),
+                                              std::move(right_keys), join_type, right_arity);
+}
+
+enum class WindowFuncType { ROW_NUMBER, COUNT, MAX, MIN, SUM, AVG };
+
+// ROWS frame relative to the current row within its partition; an empty
+// bound is unbounded. The default frame is the running one: from the
+// start of the partition up to the current row.
+struct WindowFrame {
+    std::optional<size_t> preceding;
+    std::optional<size_t> following = 0;
+};
+
+struct WindowFunc {
+    WindowFuncType func;
+    size_t attr_index = 0; // Ignored by ROW_NUMBER
+    WindowFrame frame;
+};
+
+// Computes window functions over partitions of its input, appending one
+// column per function to each row. Input that is not already ordered on
+// the partition attributes followed by the order keys is sorted first.
+// Frames ending at the current row are computed while streaming, with one
+// running state per function. Other frames buffer the partition and answer
+// each row from a segment tree of partial aggregates in O(log n).
+class WindowOperator : public UnaryOperator {
+private:
+    using Row = std::vector<std::unique_ptr<Field>>;
+
+    std::vector<size_t> partition_by;
+    std::vector<SortKey> order_by;
+    std::vector<WindowFunc> functions;
+    bool streaming; // All frames end at the current row
+
+    std::unique_ptr<SortOperator> sorter;
+    Operator* source = nullptr;
+
+    // Streaming state
+    Row partition_key;
+    std::vector<AggregateState> running;
+    size_t row_number = 0;
+
+    // Buffered state
+    std::vector<Row> partition;
+    size_t partition_index = 0;
+    Row pending; // First row of the next partition
+    std::vector<std::vector<AggregateState>> trees;
+
+    Row currentOutput;
+
+public:
+    WindowOperator(Operator& input, std::vector<size_t> partition_by, std::vector<SortKey> order_by,
+                   std::vector<WindowFunc> functions)
+        : UnaryOperator(input), partition_by(std::move(partition_by)), order_by(std::move(order_by)),
+          functions(std::move(functions)) {
+        streaming = std::all_of(this->functions.begin(), this->functions.end(), [](const WindowFunc& function) {
+            return function.func == WindowFuncType::ROW_NUMBER ||
+                   (!function.frame.preceding && function.frame.following == size_t{0});
+        });
+    }
+
+    void open() override {
+        std::vector<SortKey> required;
+        for (auto attr : partition_by) {
+            required.push_back({attr, false});
+        }
+        required.insert(required.end(), order_by.begin(), order_by.end());
+        source = input;
+        if (!isOrderedBy(required)) {
+            sorter = std::make_unique<SortOperator>(*input, required);
+            source = sorter.get();
+        }
+        source->open();
+
+        partition_key.clear();
+        running.clear();
+        row_number = 0;
+        partition.clear();
+        partition_index = 0;
+        pending.clear();
+        currentOutput.clear();
+    }
+
+    bool next() override {
+        return streaming ? nextStreaming() : nextBuffered();
+    }
+
+    void close() override {
+        source->close();
+        sorter.reset();
+        partition.clear();
+        trees.clear();
+        currentOutput.clear();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        Row outputCopy;
+        for (const auto& field : currentOutput) {
+            outputCopy.push_back(field ? field->clone() : nullptr);
+        }
+        return outputCopy;
+    }
+
+    std::vector<SortKey> getOrdering() const override {
+        std::vector<SortKey> ordering;
+        for (auto attr : partition_by) {
+            ordering.push_back({attr, false});
+        }
+        ordering.insert(ordering.end(), order_by.begin(), order_by.end());
+        return ordering;
+    }
+
+private:
+    bool isOrderedBy(const std::vector<SortKey>& required) const {
+        std::vector<SortKey> ordering = input->getOrdering();
+        if (ordering.size() < required.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < required.size(); ++i) {
+            if (ordering[i].attr_index != required[i].attr_index || ordering[i].descending != required[i].descending) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // NULL keys, which sort next to each other, form one partition
+    bool samePartition(const Row& a, const Row& b) const {
+        for (auto attr : partition_by) {
+            const Field* x = a.at(attr).get();
+            const Field* y = b.at(attr).get();
+            if (x && y ? !(*x == *y) : x != y) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // NULLs are skipped, as by the other aggregates
+    static void accumulate(AggregateState& state, const Field* field) {
+        if (!field) {
+            return;
+        }
+        switch (field->getType()) {
+            case INT: state.updateInt(field->asInt()); break;
+            case FLOAT: state.updateFloat(field->asFloat()); break;
+            case STRING: state.updateString(); break;
+        }
+    }
+
+    static AggrFuncType aggregateOf(WindowFuncType func) {
+        switch (func) {
+            case WindowFuncType::COUNT: return AggrFuncType::COUNT;
+            case WindowFuncType::MAX: return AggrFuncType::MAX;
+            case WindowFuncType::MIN: return AggrFuncType::MIN;
+            case WindowFuncType::SUM: return AggrFuncType::SUM;
+            case WindowFuncType::AVG: return AggrFuncType::AVG;
+            case WindowFuncType::ROW_NUMBER: break;
+        }
+        throw std::runtime_error("ROW_NUMBER is not an aggregate.");
+    }
+
+    bool nextStreaming() {
+        currentOutput.clear();
+        if (!source->next()) {
+            return false;
+        }
+        Row row = source->getOutput();
+        if (partition_key.empty() || !samePartition(row, partition_key)) {
+            partition_key.clear();
+            for (const auto& field : row) {
+                partition_key.push_back(field ? field->clone() : nullptr);
+            }
+            running.assign(functions.size(), AggregateState());
+            row_number = 0;
+        }
+        row_number++;
+        currentOutput = std::move(row);
+        for (size_t i = 0; i < functions.size(); ++i) {
+            const WindowFunc& function = functions[i];
+            if (function.func == WindowFuncType::ROW_NUMBER) {
+                currentOutput.push_back(std::make_unique<Field>(static_cast<int>(row_number)));
+                continue;
+            }
+            accumulate(running[i], currentOutput.at(function.attr_index).get());
+            currentOutput.push_back(running[i].result(aggregateOf(function.func)));
+        }
+        return true;
+    }
+
+    bool nextBuffered() {
+        currentOutput.clear();
+        if (partition_index == partition.size() && !loadPartition()) {
+            return false;
+        }
+        size_t row = partition_index++;
+        size_t rows = partition.size();
+        currentOutput = std::move(partition[row]);
+        for (size_t i = 0; i < functions.size(); ++i) {
+            const WindowFunc& function = functions[i];
+            if (function.func == WindowFuncType::ROW_NUMBER) {
+                currentOutput.push_back(std::make_unique<Field>(static_cast<int>(row + 1)));
+                continue;
+            }
+            const WindowFrame& frame = function.frame;
+            size_t begin = frame.preceding ? row - std::min(row, *frame.preceding) : 0;
+            size_t end = frame.following ? std::min(rows, row + 1 + *frame.following) : rows;
+            AggregateState state = query(trees[i], rows, begin, end);
+            currentOutput.push_back(state.result(aggregateOf(function.func)));
+        }
+        return true;
+    }
+
+    // Reads the next partition and builds one segment tree per aggregate
+    bool loadPartition() {
+        partition.clear();
+        partition_index = 0;
+        if (pending.empty()) {
+            if (!source->next()) {
+                return false;
+            }
+            pending = source->getOutput();
+        }
+        partition.push_back(std::move(pending));
+        pending.clear();
+        while (source->next()) {
+            Row row = source->getOutput();
+            if (!samePartition(row, partition.front())) {
+                pending = std::move(row);
+                break;
+            }
+            partition.push_back(std::move(row));
+        }
+
+        // Leaves are at [n, 2n); node k covers the union of nodes 2k and 2k+1
+        size_t rows = partition.size();
+        trees.assign(functions.size(), {});
+        for (size_t i = 0; i < functions.size(); ++i) {
+            if (functions[i].func == WindowFuncType::ROW_NUMBER) {
+                continue;
+            }
+            auto& tree = trees[i];
+            tree.assign(2 * rows, AggregateState());
+            for (size_t row = 0; row < rows; ++row) {
+                accumulate(tree[rows + row], partition[row].at(functions[i].attr_index).get());
+            }
+            for (size_t node = rows - 1; node > 0; --node) {
+                tree[node] = tree[2 * node];
+                tree[node].merge(tree[2 * node + 1]);
+            }
+        }
+        return true;
+    }
+
+    // Aggregate over the rows in [begin, end)
+    static AggregateState query(const std::vector<AggregateState>& tree, size_t rows, size_t begin, size_t end) {
+        AggregateState state;
+        for (begin += rows, end += rows; begin < end; begin /= 2, end /= 2) {
+            if (begin & 1) {
+                state.merge(tree[begin++]);
+            }
+            if (end & 1) {
+                state.merge(tree[--end]);
+            }
+        }
+        return state;
+    }
+};
+
+// Fixed pool of worker threads executing morsel jobs. A job is a
+// pipeline fragment run once per morsel; its morsels are split into one
+// contiguous range per worker so that each worker scans neighbouring
+// pages, and a worker whose range is empty steals the upper half of
+// another worker's range. Workers rotate over the active jobs one morsel
+// at a time, so concurrent queries share the pool fairly.
+class MorselScheduler {
+public:
+    using MorselFunction = std::function<void(size_t worker_id, size_t morsel)>;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) MorselRange {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    struct Job {
+        MorselFunction fn;
+        size_t num_morsels;
+        std::unique_ptr<MorselRange[]> ranges;
+        // Morsels not handed to a worker yet. A stolen range is in no
+        // MorselRange until the thief publishes it, so empty ranges alone
+        // do not mean that the job may be retired.
+        std::atomic<size_t> unclaimed;
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t finished = 0;
+        std::exception_ptr error;
+        // Page requests of the morsels, charged to the thread running the job
+        BufferTraffic traffic;
+
+        Job(MorselFunction fn, size_t num_morsels, size_t num_workers)
+            : fn(std::move(fn)), num_morsels(num_morsels), ranges(new MorselRange[num_workers]),
+              unclaimed(num_morsels) {
+            for (size_t w = 0; w < num_workers; ++w) {
+                ranges[w].begin = num_morsels * w / num_workers;
+                ranges[w].end = num_morsels * (w + 1) / num_workers;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::vector<std::shared_ptr<Job>> jobs;
+    size_t next_job = 0;
+    bool stopping = false;
+
+public:
+    explicit MorselScheduler(size_t num_workers = defaultThreadCount()) {
+        for (size_t w = 0; w < std::max<size_t>(1, num_workers); ++w) {
+            workers.emplace_back([this, w]() { workerLoop(w); });
+        }
+    }
+
+    ~MorselScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_available.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    size_t getNumWorkers() const { return workers.size(); }
+
+    // Runs fn(worker_id, morsel) for every morsel in [0, num_morsels) on
+    // the pool and waits for completion. The first exception thrown by a
+    // morsel is rethrown here.
+    void run(size_t num_morsels, MorselFunction fn) {
+        if (num_morsels == 0) {
+            return;
+        }
+        auto job = std::make_shared<Job>(std::move(fn), num_morsels, workers.size());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+        }
+        work_available.notify_all();
+
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->done.wait(lock, [&]() { return job->finished == job->num_morsels; });
+        threadBufferTraffic().hits += job->traffic.hits;
+        threadBufferTraffic().misses += job->traffic.misses;
+        if (job->error) {
+            std::rethrow_exception(job->error);
+        }
+    }
+
+private:
+    void workerLoop(size_t worker_id) {
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_available.wait(lock, [&]() { return stopping || !jobs.empty(); });
+                if (stopping) {
+                    return;
+                }
+                job = jobs[next_job++ % jobs.size()];
+            }
+
+            size_t morsel;
+            if (!claim(*job, worker_id, morsel)) {
+                if (job->unclaimed.load() > 0) {
+                    // A thief has yet to publish the range it stole
+                    std::this_thread::yield();
+                    continue;
+                }
+                // Every morsel is taken; retire the job from the rotation
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = std::find(jobs.begin(), jobs.end(), job);
+                if (it != jobs.end()) {
+                    jobs.erase(it);
+                }
+                continue;
+            }
+
+            std::exception_ptr error;
+            BufferTraffic& traffic = threadBufferTraffic();
+            BufferTraffic before = traffic;
+            try {
+                job->fn(worker_id, morsel);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->traffic.hits += traffic.hits - before.hits;
+            job->traffic.misses += traffic.misses - before.misses;
+            if (error && !job->error) {
+                job->error = error;
+            }
+            if (++job->finished == job->num_morsels) {
+                job->done.notify_all();
+            }
+        }
+    }
+
+    // Takes the next morsel of the worker's own range, or steals the upper
+    // half of the first non-empty range of another worker
+    bool claim(Job& job, size_t worker_id, size_t& morsel) {
+        MorselRange& own = job.ranges[worker_id];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.begin < own.end) {
+                morsel = own.begin++;
+                job.unclaimed--;
+                return true;
+            }
+        }
+
+        const size_t num_workers = workers.size();
+        for (size_t i = 1; i < num_workers; ++i) {
+            MorselRange& victim = job.ranges[(worker_id + i) % num_workers];
+            size_t begin, end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.begin >= victim.end) {
+                    continue;
+                }
+                end = victim.end;
+                begin = victim.begin + (victim.end - victim.begin) / 2;
+                victim.end = begin;
+            }
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.begin = begin + 1;
+            own.end = end;
+            morsel = begin;
+            job.unclaimed--;
+            return true;
+        }
+        return false;
+    }
+};
+
+// Process-wide pool shared by all queries
+MorselScheduler& defaultScheduler() {
+    static MorselScheduler scheduler;
+    return scheduler;
+}
+
+// Number of pages handed to a worker at a time
+static constexpr size_t MORSEL_PAGES = 16;
+// Groups a thread-local table holds before it is flushed into partitions
+static constexpr size_t LOCAL_AGGREGATION_GROUPS = 4096;
+
+// Parallel scan -> filter -> aggregate on a MorselScheduler. Each morsel
+// is a range of pages that is filtered by a ScanPredicate and
+// pre-aggregated into a small table owned by the worker. Full tables are flushed into
+// per-worker partitions by group hash; afterwards every partition is
+// merged by one morsel, so the merge runs in parallel without locks.
+class ParallelHashAggregationOperator : public Operator {
+private:
+    struct WorkerState {
+        AggregationHashTable local;
+        std::vector<AggregationHashTable> partitions;
+        std::vector<char> page = std::vector<char>(PAGE_SIZE);
+        Batch batch;
+
+        WorkerState(const std::vector<AggrFunc>& aggr_funcs, size_t num_partitions)
+            : local(aggr_funcs), partitions(num_partitions, AggregationHashTable(aggr_funcs)) {}
+    };
+
+    BufferManager& bufferManager;
+    std::unique_ptr<ScanPredicate> predicate; // May be null
+    std::vector<size_t> group_by_attrs;
+    std::vector<AggrFunc> aggr_funcs;
+    MorselScheduler& scheduler;
+    size_t num_partitions;
+
+    std::vector<Tuple> output_tuples;
+    size_t output_tuples_index = 0;
+
+public:
+    ParallelHashAggregationOperator(BufferManager& manager, std::unique_ptr<IPredicate> predicate,
+                                    std::vector<size_t> group_by_attrs, std::vector<AggrFunc> aggr_funcs,
+                                    MorselScheduler& scheduler = defaultScheduler())
+        : bufferManager(manager),
+          predicate(predicate ? std::make_unique<ScanPredicate>(std::move(predicate)) : nullptr),
+          group_by_attrs(std::move(group_by_attrs)), aggr_funcs(std::move(aggr_funcs)),
+          scheduler(scheduler), num_partitions(4 * scheduler.getNumWorkers()) {}
+
+    void open() override {
+        output_tuples.clear();
+        output_tuples_index = 0;
+        if (predicate) {
+            predicate->refresh();
+        }
+
+        // Only the grouped, aggregated and filtered fields are decoded; they
+        // keep their positions so the attribute indexes stay valid
+        std::vector<size_t> attrs = group_by_attrs;
+        for (const auto& aggr_func : aggr_funcs) {
+            attrs.push_back(aggr_func.attr_index);
+        }
+        std::vector<int> column_map;
+        if (!predicate || predicate->residualAttributes(attrs)) {
+            column_map = ScanOperator::columnMap(attrs, true);
+        }
+        const size_t num_columns = ScanOperator::mappedColumns(column_map);
+
+        // Phase 1: morsel-wise scan and worker-local pre-aggregation
+        const size_t num_workers = scheduler.getNumWorkers();
+        std::vector<WorkerState> workers(num_workers, WorkerState(aggr_funcs, num_partitions));
+        const size_t num_pages = bufferManager.getNumPages();
+        scheduler.run((num_pages + MORSEL_PAGES - 1) / MORSEL_PAGES, [&](size_t worker_id, size_t morsel) {
+            WorkerState& state = workers[worker_id];
+            size_t first = morsel * MORSEL_PAGES;
+            size_t last = std::min(num_pages, first + MORSEL_PAGES);
+            for (size_t page_id = first; page_id < last; ++page_id) {
+                bufferManager.readPage(static_cast<int>(page_id), state.page.data());
+                Batch& batch = state.batch;
+                batch.clear();
+                const Slot* slot_array = reinterpret_cast<const Slot*>(state.page.data());
+                for (size_t slot = 0; slot < MAX_SLOTS; ++slot) {
+                    if (slot_array[slot].empty) {
+                        continue;
+                    }
+                    const char* tuple_data = state.page.data() + slot_array[slot].offset;
+                    if (predicate && !predicate->matchesRaw(tuple_data, slot_array[slot].length)) {
+                        continue;
+                    }
+                    if (column_map.empty()) {
+                        ScanOperator::parseTuple(tuple_data, slot_array[slot].length, batch);
+                    } else {
+                        ScanOperator::parseTuple(tuple_data, slot_array[slot].length, batch, column_map, num_columns);
+                    }
+                }
+                batch.selectAll();
+                if (predicate) {
+                    predicate->filter(batch, batch.selection);
+                }
+                state.local.aggregate(batch, group_by_attrs, aggr_funcs);
+                if (state.local.size() >= LOCAL_AGGREGATION_GROUPS) {
+                    flushLocal(state.local, state.partitions);
+                }
+            }
+        });
+        scheduler.run(num_workers, [&](size_t, size_t worker) {
+            flushLocal(workers[worker].local, workers[worker].partitions);
+        });
+
+        // Phase 2: each partition is merged across workers by one morsel
+        std::vector<std::vector<Tuple>> partition_outputs(num_partitions);
+        scheduler.run(num_partitions, [&](size_t, size_t p) {
+            AggregationHashTable merged(aggr_funcs);
+            for (auto& worker : workers) {
+                AggregationHashTable& partition = worker.partitions[p];
+                for (size_t group = 0; group < partition.size(); ++group) {
+                    merged.mergeGroup(partition, group);
+                }
+                partition.clear();
+            }
+            for (size_t group = 0; group < merged.size(); ++group) {
+                partition_outputs[p].push_back(HashAggregationOperator::makeOutputTuple(
+                    merged, group, group_by_attrs.size(), aggr_funcs));
+            }
+        });
+
+        for (auto& partition_output : partition_outputs) {
+            for (auto& tuple : partition_output) {
+                output_tuples.push_back(std::move(tuple));
+            }
+        }
+        if (group_by_attrs.empty() && output_tuples.empty()) {
+            output_tuples.push_back(HashAggregationOperator::makeEmptyOutputTuple(aggr_funcs));
+        }
+    }
+
+    bool next() override {
+        if (output_tuples_index < output_tuples.size()) {
+            output_tuples_index++;
+            return true;
+        }
+        return false;
+    }
+
+    void close() override {
+        output_tuples.clear();
+        output_tuples_index = 0;
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        std::vector<std::unique_ptr<Field>> outputCopy;
+        if (output_tuples_index == 0 || output_tuples_index > output_tuples.size()) {
+            return outputCopy;
+        }
+        for (const auto& field : output_tuples[output_tuples_index - 1].fields) {
+            outputCopy.push_back(field ? field->clone() : nullptr);
+        }
+        return outputCopy;
+    }
+
+private:
+    // Partitions on the upper hash bits; the tables probe on the lower ones
+    void flushLocal(AggregationHashTable& local, std::vector<AggregationHashTable>& partitions) const {
+        for (size_t group = 0; group < local.size(); ++group) {
+            size_t p = (local.getHash(group) >> 32) % num_partitions;
+            partitions[p].mergeGroup(local, group);
+        }
+        local.clear();
+    }
+};
+
+// Compiled pipelines: scan -> integer filter -> integer aggregate fused
+// into one loop. Filters and aggregates are template parameters, so each
+// supported query shape is instantiated at compile time and the per-row
+// work has no virtual calls and no switches on types or operators.
+// Columns are addressed by a 32-bit mask, so only the first 32 are usable.
+static constexpr size_t MAX_COMPILED_FIELDS = 32;
+
+template<SimplePredicate::ComparisonOperator Op>
+inline bool compareInts(int left, int right) {
+    if constexpr (Op == SimplePredicate::EQ) {
+        return left == right;
+    } else if constexpr (Op == SimplePredicate::NE) {
+        return left != right;
+    } else if constexpr (Op == SimplePredicate::GT) {
+        return left > right;
+    } else if constexpr (Op == SimplePredicate::GE) {
+        return left >= right;
+    } else if constexpr (Op == SimplePredicate::LT) {
+        return left < right;
+    } else {
+        return left <= right;
+    }
+}
+
+// Parses the first `num_fields` fields of a serialized tuple into `row`.
+// Returns the mask of fields that were INT; other fields are skipped.
+inline uint32_t parseIntFields(const char* data, size_t length, int* row, size_t num_fields) {
+    const char* end = data + length;
+    size_t field_count;
+    data = parseNumber(data, end, field_count);
+    num_fields = std::min(num_fields, field_count);
+    uint32_t int_mask = 0;
+    for (size_t i = 0; i < num_fields; ++i) {
+        int type;
+        size_t field_length;
+        data = parseNumber(data, end, type);
+        data = parseNumber(data, end, field_length);
+        if (type == INT) {
+            data = parseNumber(data, end, row[i]);
+            int_mask |= 1u << i;
+        } else {
+            data = std::find(skipSpaces(data, end), end, ' ');
+        }
+    }
+    return int_mask;
+}
+
+struct NoIntFilter {
+    uint32_t columns() const { return 0; }
+    bool operator()(const int*) const { return true; }
+};
+
+// {attr} op constant
+template<SimplePredicate::ComparisonOperator Op>
+struct IntCompareFilter {
+    size_t attr;
+    int constant;
+
+    IntCompareFilter(size_t attr, int constant) : attr(attr), constant(constant) {}
+    uint32_t columns() const { return 1u << attr; }
+    bool operator()(const int* row) const { return compareInts<Op>(row[attr], constant); }
+};
+
+// {attr} LowerOp lower and {attr} UpperOp upper
+template<SimplePredicate::ComparisonOperator LowerOp, SimplePredicate::ComparisonOperator UpperOp>
+struct IntRangeFilter {
+    size_t attr;
+    int lower;
+    int upper;
+
+    IntRangeFilter(size_t attr, int lower, int upper) : attr(attr), lower(lower), upper(upper) {}
+    uint32_t columns() const { return 1u << attr; }
+    bool operator()(const int* row) const {
+        // Both sides are evaluated, so there is one branch per row instead of two
+        return compareInts<LowerOp>(row[attr], lower) & compareInts<UpperOp>(row[attr], upper);
+    }
+};
+
+// COUNT, SUM, MIN or MAX over INT values; results are INT like AggregateState's
+template<AggrFuncType Func>
+struct IntAccumulator {
+    int64_t value = Func == AggrFuncType::MIN   ? std::numeric_limits<int64_t>::max()
+                    : Func == AggrFuncType::MAX ? std::numeric_limits<int64_t>::min()
+                                                : 0;
+
+    void add(int input) {
+        if constexpr (Func == AggrFuncType::COUNT) {
+            value++;
+        } else if constexpr (Func == AggrFuncType::SUM) {
+            value += input;
+        } else if constexpr (Func == AggrFuncType::MIN) {
+            value = std::min<int64_t>(value, input);
+        } else {
+            value = std::max<int64_t>(value, input);
+        }
+    }
+
+    void merge(const IntAccumulator& other) {
+        if constexpr (Func == AggrFuncType::COUNT || Func == AggrFuncType::SUM) {
+            value += other.value;
+        } else if constexpr (Func == AggrFuncType::MIN) {
+            value = std::min(value, other.value);
+        } else {
+            value = std::max(value, other.value);
+        }
+    }
+
+    Field result() const { return Field(narrowInt(value)); }
+};
+
+// Open-addressing map from an INT group key to an accumulator
+template<typename Accumulator>
+class IntGroupTable {
+private:
+    std::vector<int> keys;
+    std::vector<Accumulator> values;
+    std::vector<uint8_t> used;
+    size_t mask;
+    size_t count = 0;
+
+public:
+    IntGroupTable() : keys(16), values(16), used(16, 0), mask(15) {}
+
+    Accumulator& operator[](int key) {
+        size_t slot = mixBits(static_cast<uint32_t>(key)) & mask;
+        while (used[slot]) {
+            if (keys[slot] == key) {
+                return values[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+        if (2 * (count + 1) > keys.size()) {
+            grow();
+            return (*this)[key];
+        }
+        used[slot] = 1;
+        keys[slot] = key;
+        count++;
+        return values[slot];
+    }
+
+    template<typename Fn>
+    void forEach(Fn fn) const {
+        for (size_t slot = 0; slot < keys.size(); ++slot) {
+            if (used[slot]) {
+                fn(keys[slot], values[slot]);
+            }
+        }
+    }
+
+private:
+    void grow() {
+        IntGroupTable bigger;
+        bigger.keys.resize(2 * keys.size());
+        bigger.values.resize(2 * keys.size());
+        bigger.used.assign(2 * keys.size(), 0);
+        bigger.mask = 2 * keys.size() - 1;
+        forEach([&](int key, const Accumulator& value) { bigger[key] = value; });
+        *this = std::move(bigger);
+    }
+};
+
+// Aggregate without GROUP BY; for empty input its row holds 0 for COUNT
+// and NULL otherwise, like HashAggregationOperator
+template<AggrFuncType Func>
+struct IntAggregate {
+    size_t value_attr;
+    IntAccumulator<Func> accumulator;
+    bool empty = true;
+
+    explicit IntAggregate(size_t value_attr) : value_attr(value_attr) {}
+    uint32_t columns() const { return 1u << value_attr; }
+
+    void add(const int* row) {
+        accumulator.add(row[value_attr]);
+        empty = false;
+    }
+
+    void merge(const IntAggregate& other) {
+        accumulator.merge(other.accumulator);
+        empty = empty && other.empty;
+    }
+
+    void emit(std::vector<Tuple>& output) const {
+        Tuple tuple;
+        if (empty && Func != AggrFuncType::COUNT) {
+            tuple.addField(nullptr);
+        } else {
+            tuple.addField(std::make_unique<Field>(accumulator.result()));
+        }
+        output.push_back(std::move(tuple));
+    }
+};
+
+// Aggregate grouped by one INT column
+template<AggrFuncType Func>
+struct GroupedIntAggregate {
+    size_t group_attr;
+    size_t value_attr;
+    IntGroupTable<IntAccumulator<Func>> groups;
+
+    GroupedIntAggregate(size_t group_attr, size_t value_attr) : group_attr(group_attr), value_attr(value_attr) {}
+    uint32_t columns() const { return (1u << group_attr) | (1u << value_attr); }
+
+    void add(const int* row) {
+        groups[row[group_attr]].add(row[value_attr]);
+    }
+
+    void merge(const GroupedIntAggregate& other) {
+        other.groups.forEach([&](int key, const IntAccumulator<Func>& value) { groups[key].merge(value); });
+    }
+
+    void emit(std::vector<Tuple>& output) const {
+        groups.forEach([&](int key, const IntAccumulator<Func>& value) {
+            Tuple tuple;
+            tuple.addField(std::make_unique<Field>(key));
+            tuple.addField(std::make_unique<Field>(value.result()));
+            output.push_back(std::move(tuple));
+        });
+    }
+};
+
+// Interpreted scan -> filter -> aggregate plan of a compiled aggregation,
+// run instead when a column it reads turns out not to be INT
+class AggregationFallback {
+private:
+    ScanOperator scan;
+    HashAggregationOperator aggregation;
+
+public:
+    AggregationFallback(BufferManager& manager, std::unique_ptr<IPredicate> predicate,
+                        std::vector<size_t> group_by_attrs, std::vector<AggrFunc> aggr_funcs)
+        : scan(manager), aggregation(scan, std::move(group_by_attrs), std::move(aggr_funcs)) {
+        if (predicate) {
+            scan.pushPredicate(std::move(predicate));
+        }
+    }
+
+    void run(std::vector<Tuple>& output) {
+        aggregation.open();
+        while (aggregation.next()) {
+            Tuple tuple;
+            tuple.fields = aggregation.getOutput();
+            output.push_back(std::move(tuple));
+        }
+        aggregation.close();
+    }
+};
+
+// Scan, filter and aggregate of one compiled query shape. Morsels of pages
+// run on the scheduler, each worker aggregating into its own copy of the
+// aggregate; the copies are merged at the end. The shape is chosen from
+// the first stored tuple; should a later one have a non-INT column, the
+// fallback computes the result instead.
+template<typename Filter, typename Aggregate>
+class CompiledAggregationOperator : public Operator {
+private:
+    BufferManager& bufferManager;
+    Filter filter;
+    Aggregate prototype;
+    MorselScheduler& scheduler;
+    std::shared_ptr<AggregationFallback> fallback;
+
+    std::vector<Tuple> output_tuples;
+    size_t output_tuples_index = 0;
+
+public:
+    CompiledAggregationOperator(BufferManager& manager, Filter filter, Aggregate aggregate,
+                                MorselScheduler& scheduler, std::shared_ptr<AggregationFallback> fallback)
+        : bufferManager(manager), filter(std::move(filter)), prototype(std::move(aggregate)), scheduler(scheduler),
+          fallback(std::move(fallback)) {}
+
+    void open() override {
+        output_tuples.clear();
+        output_tuples_index = 0;
+
+        const uint32_t needed = filter.columns() | prototype.columns();
+        size_t num_fields = 0;
+        while (num_fields < MAX_COMPILED_FIELDS && (needed >> num_fields) != 0) {
+            num_fields++;
+        }
+
+        const size_t num_workers = scheduler.getNumWorkers();
+        std::vector<Aggregate> partials(num_workers, prototype);
+        std::vector<std::vector<char>> pages(num_workers, std::vector<char>(PAGE_SIZE));
+        const size_t num_pages = bufferManager.getNumPages();
+        std::atomic<bool> not_int{false};
+        scheduler.run((num_pages + MORSEL_PAGES - 1) / MORSEL_PAGES, [&](size_t worker_id, size_t morsel) {
+            if (not_int.load(std::memory_order_relaxed)) {
+                return;
+            }
+            Aggregate& aggregate = partials[worker_id];
+            char* page = pages[worker_id].data();
+            const Slot* slot_array = reinterpret_cast<const Slot*>(page);
+            int row[MAX_COMPILED_FIELDS];
+            size_t last = std::min(num_pages, (morsel + 1) * MORSEL_PAGES);
+            for (size_t page_id = morsel * MORSEL_PAGES; page_id < last; ++page_id) {
+                bufferManager.readPage(static_cast<int>(page_id), page);
+                for (size_t slot = 0; slot < MAX_SLOTS; ++slot) {
+                    if (slot_array[slot].empty) {
+                        continue;
+                    }
+                    uint32_t int_mask = parseIntFields(page + slot_array[slot].offset,
+                                                       slot_array[slot].length, row, num_fields);
+                    if ((int_mask & needed) != needed) {
+                        not_int.store(true, std::memory_order_relaxed);
+                        return;
+                    }
+                    if (filter(row)) {
+                        aggregate.add(row);
+                    }
+                }
+            }
+        });
+
+        if (not_int) {
+            if (!fallback) {
+                throw std::runtime_error("Compiled pipeline column is not INT.");
+            }
+            fallback->run(output_tuples);
+            return;
+        }
+        for (size_t w = 1; w < num_workers; ++w) {
+            partials[0].merge(partials[w]);
+        }
+        partials[0].emit(output_tuples);
+    }
+
+    bool next() override {
+        if (output_tuples_index < output_tuples.size()) {
+            output_tuples_index++;
+            return true;
+        }
+        return false;
+    }
+
+    void close() override {
+        output_tuples.clear();
+        output_tuples_index = 0;
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        std::vector<std::unique_ptr<Field>> outputCopy;
+        if (output_tuples_index == 0 || output_tuples_index > output_tuples.size()) {
+            return outputCopy;
+        }
+        for (const auto& field : output_tuples[output_tuples_index - 1].fields) {
+            outputCopy.push_back(field ? field->clone() : nullptr);
+        }
+        return outputCopy;
+    }
+};
+
+template<typename Filter, AggrFuncType Func>
+std::unique_ptr<Operator> instantiateAggregation(BufferManager& manager, const Filter& filter,
+                                                 const std::vector<size_t>& group_by_attrs, size_t value_attr,
+                                                 MorselScheduler& scheduler,
+                                                 std::shared_ptr<AggregationFallback> fallback) {
+    if (group_by_attrs.empty()) {
+        return std::make_unique<CompiledAggregationOperator<Filter, IntAggregate<Func>>>(
+            manager, filter, IntAggregate<Func>(value_attr), scheduler, std::move(fallback));
+    }
+    return std::make_unique<CompiledAggregationOperator<Filter, GroupedIntAggregate<Func>>>(
+        manager, filter, GroupedIntAggregate<Func>(group_by_attrs[0], value_attr), scheduler, std::move(fallback));
+}
+
+template<typename Filter>
+std::unique_ptr<Operator> instantiateAggregation(BufferManager& manager, const Filter& filter,
+                                                 const std::vector<size_t>& group_by_attrs, const AggrFunc& aggr_func,
+                                                 MorselScheduler& scheduler,
+                                                 std::shared_ptr<AggregationFallback> fallback) {
+    size_t attr = aggr_func.attr_index;
+    switch (aggr_func.func) {
+        case AggrFuncType::COUNT:
+            return instantiateAggregation<Filter, AggrFuncType::COUNT>(manager, filter, group_by_attrs, attr, scheduler, fallback);
+        case AggrFuncType::SUM:
+            return instantiateAggregation<Filter, AggrFuncType::SUM>(manager, filter, group_by_attrs, attr, scheduler, fallback);
+        case AggrFuncType::MIN:
+            return instantiateAggregation<Filter, AggrFuncType::MIN>(manager, filter, group_by_attrs, attr, scheduler, fallback);
+        case AggrFuncType::MAX:
+            return instantiateAggregation<Filter, AggrFuncType::MAX>(manager, filter, group_by_attrs, attr, scheduler, fallback);
+        default:
+            return nullptr;
+    }
+}
+
+// Returns a compiled scan -> filter -> aggregate operator if the query has
+// one of the instantiated shapes: a single COUNT/SUM/MIN/MAX over an INT
+// column, grouped by at most one INT column, filtered by nothing, one
+// comparison, or a two-sided range on one INT column. Returns nullptr
+// otherwise, and the caller builds the interpreted plan.
+std::unique_ptr<Operator> compileAggregation(BufferManager& manager, std::unique_ptr<IPredicate> predicate,
+                                             const std::vector<size_t>& group_by_attrs,
+                                             const std::vector<AggrFunc>& aggr_funcs,
+                                             MorselScheduler& scheduler = defaultScheduler()) {
+    if (aggr_funcs.size() != 1 || group_by_attrs.size() > 1 || aggr_funcs[0].attr_index >= MAX_COMPILED_FIELDS ||
+        (!group_by_attrs.empty() && group_by_attrs[0] >= MAX_COMPILED_FIELDS)) {
+        return nullptr;
+    }
+    std::vector<IntComparison> comparisons;
+    if (predicate && !extractIntComparisons(*predicate, comparisons)) {
+        return nullptr;
+    }
+    for (const auto& comparison : comparisons) {
+        if (comparison.attr >= MAX_COMPILED_FIELDS) {
+            return nullptr;
+        }
+    }
+
+    // The first stored tuple decides whether the used columns are INT;
+    // later tuples that disagree send the query to the fallback
+    uint32_t needed = 1u << aggr_funcs[0].attr_index;
+    for (auto attr : group_by_attrs) {
+        needed |= 1u << attr;
+    }
+    for (const auto& comparison : comparisons) {
+        needed |= 1u << comparison.attr;
+    }
+    if (manager.getNumPages() == 0) {
+        return nullptr;
+    }
+    std::vector<char> page(PAGE_SIZE);
+    manager.readPage(0, page.data());
+    const Slot* slot_array = reinterpret_cast<const Slot*>(page.data());
+    const Slot* first = std::find_if(slot_array, slot_array + MAX_SLOTS, [](const Slot& slot) { return !slot.empty; });
+    int row[MAX_COMPILED_FIELDS];
+    if (first == slot_array + MAX_SLOTS ||
+        (parseIntFields(page.data() + first->offset, first->length, row, MAX_COMPILED_FIELDS) & needed) != needed) {
+        return nullptr;
+    }
+    auto fallback = std::make_shared<AggregationFallback>(manager, std::move(predicate), group_by_attrs, aggr_funcs);
+
+    using Op = SimplePredicate::ComparisonOperator;
+    const AggrFunc& aggr = aggr_funcs[0];
+    if (comparisons.empty()) {
+        return instantiateAggregation(manager, NoIntFilter(), group_by_attrs, aggr, scheduler, fallback);
+    }
+    if (comparisons.size() == 1) {
+        const IntComparison& c = comparisons[0];
+        switch (c.op) {
+            case Op::EQ: return instantiateAggregation(manager, IntCompareFilter<Op::EQ>(c.attr, c.constant), group_by_attrs, aggr, scheduler, fallback);
+            case Op::NE: return instantiateAggregation(manager, IntCompareFilter<Op::NE>(c.attr, c.constant), group_by_attrs, aggr, scheduler, fallback);
+            case Op::GT: return instantiateAggregation(manager, IntCompareFilter<Op::GT>(c.attr, c.constant), group_by_attrs, aggr, scheduler, fallback);
+            case Op::GE: return instantiateAggregation(manager, IntCompareFilter<Op::GE>(c.attr, c.constant), group_by_attrs, aggr, scheduler, fallback);
+            case Op::LT: return instantiateAggregation(manager, IntCompareFilter<Op::LT>(c.attr, c.constant), group_by_attrs, aggr, scheduler, fallback);
+            case Op::LE: return instantiateAggregation(manager, IntCompareFilter<Op::LE>(c.attr, c.constant), group_by_attrs, aggr, scheduler, fallback);
+        }
+    }
+    if (comparisons.size() == 2) {
+        IntComparison lower = comparisons[0];
+        IntComparison upper = comparisons[1];
+        if (lower.op == Op::LT || lower.op == Op::LE) {
+            std::swap(lower, upper);
+        }
+        bool lower_ok = lower.op == Op::GT || lower.op == Op::GE;
+        bool upper_ok = upper.op == Op::LT || upper.op == Op::LE;
+        if (lower.attr == upper.attr && lower_ok && upper_ok) {
+            size_t attr = lower.attr;
+            if (lower.op == Op::GT && upper.op == Op::LT) {
+                return instantiateAggregation(manager, IntRangeFilter<Op::GT, Op::LT>(attr, lower.constant, upper.constant), group_by_attrs, aggr, scheduler, fallback);
+            }
+            if (lower.op == Op::GT) {
+                return instantiateAggregation(manager, IntRangeFilter<Op::GT, Op::LE>(attr, lower.constant, upper.constant), group_by_attrs, aggr, scheduler, fallback);
+            }
+            if (upper.op == Op::LT) {
+                return instantiateAggregation(manager, IntRangeFilter<Op::GE, Op::LT>(attr, lower.constant, upper.constant), group_by_attrs, aggr, scheduler, fallback);
+            }
+            return instantiateAggregation(manager, IntRangeFilter<Op::GE, Op::LE>(attr, lower.constant, upper.constant), group_by_attrs, aggr, scheduler, fallback);
+        }
+    }
+    return nullptr;
+}
+
+// Syntax tree of a WHERE clause. Leaves compare a column with a constant,
+// a ? placeholder or another column; inner nodes combine their children.
+// NOT is resolved while parsing by negating the subtree.
+struct ConditionNode {
+    enum Kind { COMPARISON, AND, OR };
+    Kind kind = COMPARISON;
+    size_t attr = 0;
+    SimplePredicate::ComparisonOperator op = SimplePredicate::EQ;
+    std::unique_ptr<Field> constant;   // Right side, unless other_attr or parameter is set
+    std::optional<size_t> other_attr;
+    std::optional<size_t> parameter;   // Number of the placeholder, counted from 0
+    std::vector<std::unique_ptr<ConditionNode>> children;
+
+    static SimplePredicate::ComparisonOperator negate(SimplePredicate::ComparisonOperator op) {
+        switch (op) {
+            case SimplePredicate::EQ: return SimplePredicate::NE;
+            case SimplePredicate::NE: return SimplePredicate::EQ;
+            case SimplePredicate::GT: return SimplePredicate::LE;
+            case SimplePredicate::GE: return SimplePredicate::LT;
+            case SimplePredicate::LT: return SimplePredicate::GE;
+            case SimplePredicate::LE: return SimplePredicate::GT;
+        }
+        return op;
+    }
+
+    std::unique_ptr<ConditionNode> clone() const {
+        auto copy = std::make_unique<ConditionNode>();
+        copy->kind = kind;
+        copy->attr = attr;
+        copy->op = op;
+        copy->constant = constant ? constant->clone() : nullptr;
+        copy->other_attr = other_attr;
+        copy->parameter = parameter;
+        for (const auto& child : children) {
+            copy->children.push_back(child->clone());
+        }
+        return copy;
+    }
+
+    void collectAttributes(std::vector<size_t>& attrs) const {
+        if (kind == COMPARISON) {
+            attrs.push_back(attr);
+            if (other_attr) {
+                attrs.push_back(*other_attr);
+            }
+        }
+        for (const auto& child : children) {
+            child->collectAttributes(attrs);
+        }
+    }
+
+    // Renumbers every column reference to refer `offset` columns earlier
+    void shiftAttributes(size_t offset) {
+        attr -= kind == COMPARISON ? offset : 0;
+        if (other_attr) {
+            *other_attr -= offset;
+        }
+        for (auto& child : children) {
+            child->shiftAttributes(offset);
+        }
+    }
+
+    // Applies De Morgan's laws down to the comparisons
+    void negateInPlace() {
+        if (kind == COMPARISON) {
+            op = negate(op);
+            return;
+        }
+        kind = kind == AND ? OR : AND;
+        for (auto& child : children) {
+            child->negateInPlace();
+        }
+    }
+
+    std::string toString() const {
+        static const char* const symbols[] = {"=", "!=", ">", ">=", "<", "<="};
+        if (kind == COMPARISON) {
+            std::ostringstream text;
+            text << "{" << attr + 1 << "} " << symbols[op] << " ";
+            if (other_attr) {
+                text << "{" << *other_attr + 1 << "}";
+            } else if (parameter) {
+                text << "?";
+            } else if (constant->getType() == STRING) {
+                text << "'" << constant->asString() << "'";
+            } else if (constant->getType() == INT) {
+                text << constant->asInt();
+            } else {
+                text << constant->asFloat();
+            }
+            return text.str();
+        }
+        std::string text = "(";
+        for (size_t i = 0; i < children.size(); ++i) {
+            text += (i ? (kind == AND ? " AND " : " OR ") : "") + children[i]->toString();
+        }
+        return text + ")";
+    }
+};
+
+// Self-join of the table. ON pairs number the columns of each side
+// within that side; everywhere else columns number the joined row, the
+// left columns followed by the right ones.
+struct JoinClause {
+    JoinType type = JoinType::INNER;
+    std::vector<size_t> left_keys;
+    std::vector<size_t> right_keys;
+};
+
+// Parsed query. Attributes are 0-based here and 1-based ({n}) in the text.
+struct QueryComponents {
+    std::vector<size_t> selectAttributes; // Empty selects every column
+    std::vector<AggrFunc> aggregates;
+    std::vector<size_t> groupByAttributes;
+    std::unique_ptr<ConditionNode> where;
+    std::optional<JoinClause> join;
+    std::vector<SortKey> orderBy; // Stored attributes; output columns of an aggregation
+    int limit = -1;
+    size_t numParameters = 0; // ? placeholders in the WHERE clause
+    bool explain = false; // EXPLAIN: print the plan instead of running it
+    bool explainAnalyze = false; // EXPLAIN ANALYZE: run it and print the plan with measurements
+    bool analyze = false; // ANALYZE: collect table statistics
+
+    bool isAggregation() const { return !aggregates.empty() || !groupByAttributes.empty(); }
+};
+
+struct Token {
+    enum Type { END, IDENTIFIER, INTEGER, FLOAT, STRING, COLUMN, SYMBOL };
+    Type type;
+    std::string_view text; // Contents without quotes or braces
+    size_t position;
+};
+
+// Recursive-descent parser for the query language:
+//
+//   statement  := ANALYZE | [EXPLAIN [ANALYZE]] query
+//   query      := [SELECT] [item {[,] item}] {clause}
+//   item       := {n} | aggregate ( {n} | '(' ({n} | '*') [, number] ')' )
+//   clause     := WHERE or_cond | GROUP BY {n} {, {n}}
+//               | ORDER BY {n} [ASC|DESC] {, ...} | LIMIT integer
+//               | [INNER | LEFT [OUTER] | SEMI | ANTI] JOIN ON {n} = {n} {AND ...}
+//   or_cond    := and_cond {OR and_cond}
+//   and_cond   := not_cond {AND not_cond}
+//   not_cond   := NOT not_cond | '(' or_cond ')' | {n} BETWEEN value AND value
+//               | operand (= | != | <> | < | <= | > | >=) operand
+//   operand    := {n} | value
+//   value      := literal | ?
+//
+// Keywords are case-insensitive and clauses may come in any order, each
+// at most once. Errors throw std::runtime_error with the offset.
+class QueryParser {
+private:
+    std::string_view query;
+    std::vector<Token> tokens;
+    size_t current = 0;
+    size_t parameters = 0;
+
+public:
+    explicit QueryParser(std::string_view query) : query(query) {
+        tokenize();
+    }
+
+    QueryComponents parse() {
+        QueryComponents components;
+        if (acceptKeyword("ANALYZE")) {
+            components.analyze = true;
+            if (peek().type != Token::END) {
+                error("ANALYZE takes no arguments");
+            }
+            return components;
+        }
+        components.explain = acceptKeyword("EXPLAIN");
+        components.explainAnalyze = components.explain && acceptKeyword("ANALYZE");
+        acceptKeyword("SELECT");
+        parseSelectList(components);
+        bool where = false, group_by = false, order_by = false, limit = false;
+        while (peek().type != Token::END) {
+            if (acceptKeyword("WHERE")) {
+                once(where, "WHERE");
+                components.where = parseOr();
+                components.numParameters = parameters;
+            } else if (acceptKeyword("GROUP")) {
+                once(group_by, "GROUP BY");
+                expectKeyword("BY");
+                do {
+                    components.groupByAttributes.push_back(parseColumn());
+                } while (acceptSymbol(","));
+            } else if (acceptKeyword("ORDER")) {
+                once(order_by, "ORDER BY");
+                expectKeyword("BY");
+                do {
+                    SortKey key{parseColumn()};
+                    key.descending = acceptKeyword("DESC");
+                    if (!key.descending) {
+                        acceptKeyword("ASC");
+                    }
+                    components.orderBy.push_back(key);
+                } while (acceptSymbol(","));
+            } else if (acceptKeyword("LIMIT")) {
+                once(limit, "LIMIT");
+                components.limit = static_cast<int>(parseInteger(0, std::numeric_limits<int>::max()));
+            } else if (isJoinStart()) {
+                if (components.join) {
+                    error("Only one JOIN is supported");
+                }
+                components.join = parseJoin();
+            } else {
+                error("Unexpected '" + std::string(peek().text) + "'");
+            }
+        }
+
+        for (auto attr : components.selectAttributes) {
+            if (components.isAggregation() &&
+                std::find(components.groupByAttributes.begin(), components.groupByAttributes.end(), attr) ==
+                    components.groupByAttributes.end()) {
+                throw std::runtime_error("Parse error: {" + std::to_string(attr + 1) +
+                                         "} is selected but neither grouped nor aggregated");
+            }
+        }
+        if (components.isAggregation()) {
+            // An aggregation outputs its group keys followed by its aggregates
+            components.selectAttributes.clear();
+        }
+        return components;
+    }
+
+private:
+    void tokenize() {
+        size_t i = 0;
+        while (true) {
+            while (i < query.size() && std::isspace(static_cast<unsigned char>(query[i]))) {
+                i++;
+            }
+            if (i == query.size()) {
+                tokens.push_back({Token::END, {}, i});
+                return;
+            }
+            size_t start = i;
+            char c = query[i];
+            if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+                while (i < query.size() && (std::isalnum(static_cast<unsigned char>(query[i])) || query[i] == '_')) {
+                    i++;
+                }
+                tokens.push_back({Token::IDENTIFIER, query.substr(start, i - start), start});
+            } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+                       (c == '.' && i + 1 < query.size() && std::isdigit(static_cast<unsigned char>(query[i + 1])))) {
+                bool is_float = false;
+                while (i < query.size() && (std::isdigit(static_cast<unsigned char>(query[i])) || query[i] == '.')) {
+                    is_float |= query[i] == '.';
+                    i++;
+                }
+                tokens.push_back({is_float ? Token::FLOAT : Token::INTEGER, query.substr(start, i - start), start});
+            } else if (c == '{') {
+                while (++i < query.size() && std::isdigit(static_cast<unsigned char>(query[i]))) {
+                }
+                if (i == start + 1 || i == query.size() || query[i] != '}') {
+                    throw std::runtime_error("Parse error at " + std::to_string(start) + ": expected {n}");
+                }
+                tokens.push_back({Token::COLUMN, query.substr(start + 1, i - start - 1), start});
+                i++;
+            } else if (c == '\'') {
+                while (++i < query.size() && query[i] != '\'') {
+                }
+                if (i == query.size()) {
+                    throw std::runtime_error("Parse error at " + std::to_string(start) + ": unterminated string");
+                }
+                tokens.push_back({Token::STRING, query.substr(start + 1, i - start - 1), start});
+                i++;
+            } else {
+                size_t length = 1;
+                if (i + 1 < query.size()) {
+                    char n = query[i + 1];
+                    if ((c == '<' && (n == '=' || n == '>')) || ((c == '>' || c == '!') && n == '=')) {
+                        length = 2;
+                    }
+                }
+                if (length == 1 && std::strchr(",()*=<>-?", c) == nullptr) {
+                    throw std::runtime_error("Parse error at " + std::to_string(start) + ": unexpected character '" +
+                                             std::string(1, c) + "'");
+                }
+                i += length;
+                tokens.push_back({Token::SYMBOL, query.substr(start, length), start});
+            }
+        }
+    }
+
+    const Token& peek(size_t ahead = 0) const {
+        return tokens[std::min(current + ahead, tokens.size() - 1)];
+    }
+
+    [[noreturn]] void error(const std::string& message) const {
+        throw std::runtime_error("Parse error at " + std::to_string(peek().position) + ": " + message);
+    }
+
+    static bool equalsIgnoreCase(std::string_view text, const char* keyword) {
+        size_t i = 0;
+        for (; i < text.size() && keyword[i]; ++i) {
+            if (std::toupper(static_cast<unsigned char>(text[i])) != keyword[i]) {
+                return false;
+            }
+        }
+        return i == text.size() && !keyword[i];
+    }
+
+    bool isKeyword(const char* keyword, size_t ahead = 0) const {
+        const Token& token = peek(ahead);
+        return token.type == Token::IDENTIFIER && equalsIgnoreCase(token.text, keyword);
+    }
+
+    bool acceptKeyword(const char* keyword) {
+        if (!isKeyword(keyword)) {
+            return false;
+        }
+        current++;
+        return true;
+    }
+
+    void expectKeyword(const char* keyword) {
+        if (!acceptKeyword(keyword)) {
+            error(std::string("expected ") + keyword);
+        }
+    }
+
+    bool acceptSymbol(std::string_view symbol) {
+        if (peek().type != Token::SYMBOL || peek().text != symbol) {
+            return false;
+        }
+        current++;
+        return true;
+    }
+
+    void expectSymbol(std::string_view symbol) {
+        if (!acceptSymbol(symbol)) {
+            error("expected '" + std::string(symbol) + "'");
+        }
+    }
+
+    void once(bool& seen, const char* clause) {
+        if (seen) {
+            error(std::string("duplicate ") + clause);
+        }
+        seen = true;
+    }
+
+    static int64_t toInteger(std::string_view digits) {
+        int64_t value = 0;
+        auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+        if (ec != std::errc() || end != digits.data() + digits.size()) {
+            return -1;
+        }
+        return value;
+    }
+
+    int64_t parseInteger(int64_t min, int64_t max) {
+        if (peek().type != Token::INTEGER) {
+            error("expected an integer");
+        }
+        int64_t value = toInteger(peek().text);
+        if (value < min || value > max) {
+            error("integer out of range");
+        }
+        current++;
+        return value;
+    }
+
+    size_t parseColumn() {
+        if (peek().type != Token::COLUMN) {
+            error("expected {n}");
+        }
+        int64_t column = toInteger(peek().text);
+        if (column < 1 || column > std::numeric_limits<int>::max()) {
+            error("columns are numbered from {1}");
+        }
+        current++;
+        return static_cast<size_t>(column - 1);
+    }
+
+    bool isValueStart() const {
+        return isLiteralStart() || (peek().type == Token::SYMBOL && peek().text == "?");
+    }
+
+    // Sets the constant or the placeholder of a comparison
+    void parseValue(ConditionNode& node) {
+        if (acceptSymbol("?")) {
+            node.parameter = parameters++;
+        } else {
+            node.constant = parseLiteral();
+        }
+    }
+
+    bool isLiteralStart() const {
+        Token::Type type = peek().type;
+        return type == Token::INTEGER || type == Token::FLOAT || type == Token::STRING ||
+               (peek().type == Token::SYMBOL && peek().text == "-" &&
+                (peek(1).type == Token::INTEGER || peek(1).type == Token::FLOAT));
+    }
+
+    std::unique_ptr<Field> parseLiteral() {
+        bool negative = acceptSymbol("-");
+        const Token& token = peek();
+        std::unique_ptr<Field> value;
+        if (token.type == Token::INTEGER) {
+            int64_t number = toInteger(token.text);
+            if (number < 0 || number > static_cast<int64_t>(std::numeric_limits<int>::max()) + negative) {
+                error("integer out of range");
+            }
+            value = std::make_unique<Field>(static_cast<int>(negative ? -number : number));
+        } else if (token.type == Token::FLOAT) {
+            float number = std::stof(std::string(token.text));
+            value = std::make_unique<Field>(negative ? -number : number);
+        } else if (token.type == Token::STRING && !negative) {
+            value = std::make_unique<Field>(std::string(token.text));
+        } else {
+            error("expected a literal");
+        }
+        current++;
+        return value;
+    }
+
+    std::optional<AggrFuncType> aggregateFunction(size_t ahead = 0) const {
+        static const std::pair<const char*, AggrFuncType> functions[] = {
+            {"SUM", AggrFuncType::SUM}, {"COUNT", AggrFuncType::COUNT}, {"MIN", AggrFuncType::MIN},
+            {"MAX", AggrFuncType::MAX}, {"AVG", AggrFuncType::AVG},
+            {"APPROX_COUNT_DISTINCT", AggrFuncType::APPROX_COUNT_DISTINCT},
+            {"APPROX_QUANTILE", AggrFuncType::APPROX_QUANTILE}};
+        for (const auto& [name, func] : functions) {
+            if (isKeyword(name, ahead)) {
+                return func;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void parseSelectList(QueryComponents& components) {
+        if (acceptSymbol("*")) {
+            return;
+        }
+        while (true) {
+            if (peek().type == Token::COLUMN) {
+                components.selectAttributes.push_back(parseColumn());
+            } else if (auto func = aggregateFunction()) {
+                current++;
+                AggrFunc aggr{*func, 0};
+                if (!acceptSymbol("(")) {
+                    aggr.attr_index = parseColumn(); // SUM{n}
+                } else {
+                    if (*func == AggrFuncType::COUNT && acceptSymbol("*")) {
+                        aggr.attr_index = 0;
+                    } else {
+                        aggr.attr_index = parseColumn();
+                    }
+                    if (*func == AggrFuncType::APPROX_QUANTILE && acceptSymbol(",")) {
+                        if (peek().type != Token::FLOAT && peek().type != Token::INTEGER) {
+                            error("expected a quantile");
+                        }
+                        aggr.fraction = std::stod(std::string(peek().text));
+                        if (aggr.fraction > 1) {
+                            error("quantile must be between 0 and 1");
+                        }
+                        current++;
+                    }
+                    expectSymbol(")");
+                }
+                components.aggregates.push_back(aggr);
+            } else {
+                return;
+            }
+            acceptSymbol(",");
+        }
+    }
+
+    bool isJoinStart() const {
+        if (isKeyword("JOIN")) {
+            return true;
+        }
+        if (isKeyword("LEFT")) {
+            return isKeyword("JOIN", 1) || (isKeyword("OUTER", 1) && isKeyword("JOIN", 2));
+        }
+        return (isKeyword("INNER") || isKeyword("SEMI") || isKeyword("ANTI")) && isKeyword("JOIN", 1);
+    }
+
+    JoinClause parseJoin() {
+        JoinClause join;
+        if (acceptKeyword("LEFT")) {
+            acceptKeyword("OUTER");
+            join.type = JoinType::LEFT_OUTER;
+        } else if (acceptKeyword("SEMI")) {
+            join.type = JoinType::SEMI;
+        } else if (acceptKeyword("ANTI")) {
+            join.type = JoinType::ANTI;
+        } else {
+            acceptKeyword("INNER");
+        }
+        expectKeyword("JOIN");
+        expectKeyword("ON");
+        do {
+            join.left_keys.push_back(parseColumn());
+            expectSymbol("=");
+            join.right_keys.push_back(parseColumn());
+        } while (acceptKeyword("AND"));
+        return join;
+    }
+
+    // Appends `child` to a node of `kind`, flattening nested nodes of the same kind
+    static std::unique_ptr<ConditionNode> combine(std::unique_ptr<ConditionNode> node, ConditionNode::Kind kind,
+                                                  std::unique_ptr<ConditionNode> child) {
+        if (node->kind != kind) {
+            auto parent = std::make_unique<ConditionNode>();
+            parent->kind = kind;
+            parent->children.push_back(std::move(node));
+            node = std::move(parent);
+        }
+        if (child->kind == kind) {
+            for (auto& grandchild : child->children) {
+                node->children.push_back(std::move(grandchild));
+            }
+        } else {
+            node->children.push_back(std::move(child));
+        }
+        return node;
+    }
+
+    std::unique_ptr<ConditionNode> parseOr() {
+        auto node = parseAnd();
+        while (acceptKeyword("OR")) {
+            node = combine(std::move(node), ConditionNode::OR, parseAnd());
+        }
+        return node;
+    }
+
+    std::unique_ptr<ConditionNode> parseAnd() {
+        auto node = parseNot();
+        while (acceptKeyword("AND")) {
+            node = combine(std::move(node), ConditionNode::AND, parseNot());
+        }
+        return node;
+    }
+
+    std::unique_ptr<ConditionNode> parseNot() {
+        if (acceptKeyword("NOT")) {
+            auto node = parseNot();
+            node->negateInPlace();
+            return node;
+        }
+        if (acceptSymbol("(")) {
+            auto node = parseOr();
+            expectSymbol(")");
+            return node;
+        }
+        return parseComparison();
+    }
+
+    std::unique_ptr<ConditionNode> parseComparison() {
+        auto node = std::make_unique<ConditionNode>();
+        bool value_left = isValueStart();
+        if (value_left) {
+            parseValue(*node);
+        } else {
+            node->attr = parseColumn();
+            if (acceptKeyword("BETWEEN")) {
+                auto lower = std::make_unique<ConditionNode>();
+                lower->attr = node->attr;
+                lower->op = SimplePredicate::GE;
+                parseValue(*lower);
+                expectKeyword("AND");
+                auto upper = std::make_unique<ConditionNode>();
+                upper->attr = node->attr;
+                upper->op = SimplePredicate::LE;
+                parseValue(*upper);
+                node->kind = ConditionNode::AND;
+                node->children.push_back(std::move(lower));
+                node->children.push_back(std::move(upper));
+                return node;
+            }
+        }
+
+        static const std::pair<const char*, SimplePredicate::ComparisonOperator> operators[] = {
+            {"=", SimplePredicate::EQ}, {"!=", SimplePredicate::NE}, {"<>", SimplePredicate::NE},
+            {"<", SimplePredicate::LT}, {"<=", SimplePredicate::LE}, {">", SimplePredicate::GT},
+            {">=", SimplePredicate::GE}};
+        std::optional<SimplePredicate::ComparisonOperator> op;
+        for (const auto& [symbol, comparison_operator] : operators) {
+            if (acceptSymbol(symbol)) {
+                op = comparison_operator;
+                break;
+            }
+        }
+        if (!op) {
+            error("expected a comparison operator");
+        }
+        node->op = *op;
+
+        if (value_left) {
+            // `value op column` is stored as `column op' value`
+            node->attr = parseColumn();
+            node->op = SimplePredicate::flip(*op);
+        } else if (isValueStart()) {
+            parseValue(*node);
+        } else if (peek().type == Token::COLUMN) {
+            node->other_attr = parseColumn();
+        } else {
+            error("expected a column or a value");
+        }
+        return node;
+    }
+};
+
+QueryComponents parseQuery(const std::string& query) {
+    return QueryParser(query).parse();
+}
+
+void prettyPrint(const QueryComponents& components) {
+    static const char* const aggregateNames[] = {"COUNT", "MAX", "MIN", "SUM", "AVG",
+                                                 "APPROX_COUNT_DISTINCT", "APPROX_QUANTILE"};
+    auto columns = [](const std::vector<size_t>& attrs) {
+        std::string text;
+        for (auto attr : attrs) {
+            text += "{" + std::to_string(attr + 1) + "} "; // Convert back to 1-based indexing for display
+        }
+        return text;
+    };
+    std::cout << "Query Components:\n";
+    std::cout << "  Selected Attributes: " << columns(components.selectAttributes);
+    std::cout << "\n  Aggregates: ";
+    for (const auto& aggr : components.aggregates) {
+        std::cout << aggregateNames[static_cast<int>(aggr.func)] << "{" << aggr.attr_index + 1 << "} ";
+    }
+    std::cout << "\n  GROUP BY: " << columns(components.groupByAttributes);
+    std::cout << "\n  JOIN: " << (components.join ? "Yes" : "No");
+    if (components.join) {
+        for (size_t i = 0; i < components.join->left_keys.size(); ++i) {
+            std::cout << " {" << components.join->left_keys[i] + 1 << "} = {" << components.join->right_keys[i] + 1 << "}";
+        }
+    }
+    std::cout << "\n  WHERE Condition: " << (components.where ? components.where->toString() : "No");
+    std::cout << "\n  ORDER BY: ";
+    for (const auto& key : components.orderBy) {
+        std::cout << "{" << key.attr_index + 1 << "}" << (key.descending ? " DESC " : " ASC ");
+    }
+    std::cout << "\n  LIMIT: " << (components.limit >= 0 ? std::to_string(components.limit) : "No");
+    std::cout << std::endl;
+}
+
+// Placeholders become comparisons with a dummy constant, listed in
+// `parameters` so that binding a value replaces it; without
+// `parameters` they are an error
+std::unique_ptr<IPredicate> makePredicate(const ConditionNode& node,
+                                          std::vector<std::vector<SimplePredicate*>>* parameters = nullptr) {
+    if (node.kind == ConditionNode::COMPARISON) {
+        if (node.other_attr) {
+            return std::make_unique<SimplePredicate>(SimplePredicate::Operand(node.attr),
+                                                     SimplePredicate::Operand(*node.other_attr), node.op);
+        }
+        if (node.parameter) {
+            if (!parameters) {
+                throw std::runtime_error("Queries with ? placeholders must be prepared.");
+            }
+            auto predicate = std::make_unique<SimplePredicate>(SimplePredicate::Operand(node.attr),
+                                                               SimplePredicate::Operand(std::make_unique<Field>(0)), node.op);
+            if (parameters->size() <= *node.parameter) {
+                parameters->resize(*node.parameter + 1);
+            }
+            (*parameters)[*node.parameter].push_back(predicate.get());
+            return predicate;
+        }
+        return std::make_unique<SimplePredicate>(SimplePredicate::Operand(node.attr),
+                                                 SimplePredicate::Operand(node.constant->clone()), node.op);
+    }
+    auto complexPredicate = std::make_unique<ComplexPredicate>(
+        node.kind == ConditionNode::AND ? ComplexPredicate::LogicOperator::AND : ComplexPredicate::LogicOperator::OR);
+    for (const auto& child : node.children) {
+        complexPredicate->addPredicate(makePredicate(*child, parameters));
+    }
+    return complexPredicate;
+}
+
+// The WHERE clause as a predicate, or null without one
+std::unique_ptr<IPredicate> makeWherePredicate(const QueryComponents& components) {
+    return components.where ? makePredicate(*components.where) : nullptr;
+}
+
+// Statistics of one stored column, collected by ANALYZE
+struct ColumnStats {
+    FieldType type = INT;
+    size_t distinct = 0;           // HyperLogLog estimate
+    double min = 0;                // INT and FLOAT columns
+    double max = 0;
+    bool sorted = true;            // Non-decreasing in storage order (INT columns)
+    std::vector<double> histogram; // Equi-depth bucket bounds of INT columns
+};
+
+// Table statistics as of `table_version`. Row counts, distinct counts and
+// histograms remain useful estimates after the table changes; the zone
+// maps and sort orders are only trusted while the version is current.
+struct TableStats {
+    static constexpr size_t HISTOGRAM_BUCKETS = 32;
+    static constexpr size_t HISTOGRAM_SAMPLE = 8192;
+
+    uint64_t table_version = 0;
+    size_t rows = 0;
+    size_t pages = 0;
+    std::vector<ColumnStats> columns;
+    // Zone maps: (min, max) of each INT column on each page, (INT_MAX,
+    // INT_MIN) on pages without rows and the full range on other columns
+    std::vector<std::vector<std::pair<int, int>>> page_ranges;
+};
+
+// ANALYZE: one pass over the table collecting TableStats. Each call to
+// next() then emits the statistics of one column as (column, type,
+// distinct values, min, max).
+class AnalyzeOperator : public Operator {
+private:
+    BufferManager& manager;
+    TableStats stats;
+    size_t column_index = 0;
+
+public:
+    explicit AnalyzeOperator(BufferManager& manager) : manager(manager) {}
+
+    void open() override {
+        stats = TableStats();
+        stats.table_version = manager.getTableVersion();
+        stats.pages = manager.getNumPages();
+        column_index = 0;
+
+        std::vector<HyperLogLog> sketches;
+        std::vector<bool> int_columns;
+        std::vector<std::vector<int>> samples; // Reservoir of each INT column
+        std::mt19937_64 gen(42);
+        std::vector<char> page(PAGE_SIZE);
+
+        for (size_t page_id = 0; page_id < stats.pages; ++page_id) {
+            manager.readPage(static_cast<int>(page_id), page.data());
+            const Slot* slot_array = reinterpret_cast<const Slot*>(page.data());
+            std::vector<std::pair<int, int>> ranges(stats.columns.size(),
+                {std::numeric_limits<int>::max(), std::numeric_limits<int>::min()});
+            for (size_t slot = 0; slot < MAX_SLOTS; ++slot) {
+                if (slot_array[slot].empty) {
+                    continue;
+                }
+                std::istringstream iss(std::string(page.data() + slot_array[slot].offset, slot_array[slot].length));
+                auto tuple = Tuple::deserialize(iss);
+                const auto& fields = tuple->fields;
+                for (size_t c = stats.columns.size(); c < fields.size(); ++c) {
+                    // A column first seen now; earlier rows lack it
+                    stats.columns.emplace_back();
+                    stats.columns.back().type = fields[c]->getType();
+                    sketches.emplace_back();
+                    int_columns.push_back(fields[c]->getType() == INT && stats.rows == 0);
+                    samples.emplace_back();
+                    ranges.emplace_back(std::numeric_limits<int>::max(), std::numeric_limits<int>::min());
+                }
+                for (size_t c = 0; c < fields.size(); ++c) {
+                    ColumnStats& column = stats.columns[c];
+                    const Field& field = *fields[c];
+                    if (field.getType() != column.type) {
+                        int_columns[c] = false;
+                        continue;
+                    }
+                    if (field.getType() == STRING) {
+                        sketches[c].add(mixBits(std::hash<std::string>()(field.asString())));
+                        continue;
+                    }
+                    double value = field.getType() == INT ? field.asInt() : field.asFloat();
+                    bool first = stats.rows == 0;
+                    column.sorted &= first || value >= column.max || !int_columns[c];
+                    column.min = first ? value : std::min(column.min, value);
+                    column.max = first ? value : std::max(column.max, value);
+                    if (field.getType() == FLOAT) {
+                        sketches[c].add(mixBits(floatKeyBits(field.asFloat())));
+                        continue;
+                    }
+                    int v = field.asInt();
+                    sketches[c].add(mixBits(static_cast<uint32_t>(v)));
+                    ranges[c].first = std::min(ranges[c].first, v);
+                    ranges[c].second = std::max(ranges[c].second, v);
+                    if (samples[c].size() < TableStats::HISTOGRAM_SAMPLE) {
+                        samples[c].push_back(v);
+                    } else {
+                        size_t replace = gen() % (stats.rows + 1);
+                        if (replace < TableStats::HISTOGRAM_SAMPLE) {
+                            samples[c][replace] = v;
+                        }
+                    }
+                }
+                stats.rows++;
+            }
+            stats.page_ranges.push_back(std::move(ranges));
+        }
+
+        for (size_t c = 0; c < stats.columns.size(); ++c) {
+            ColumnStats& column = stats.columns[c];
+            column.distinct = static_cast<size_t>(sketches[c].estimate());
+            column.sorted &= int_columns[c];
+            if (!int_columns[c]) {
+                // Zone maps cannot describe this column
+                for (auto& ranges : stats.page_ranges) {
+                    ranges.resize(stats.columns.size(), {std::numeric_limits<int>::max(), std::numeric_limits<int>::min()});
+                    ranges[c] = {std::numeric_limits<int>::min(), std::numeric_limits<int>::max()};
+                }
+                continue;
+            }
+            auto& sample = samples[c];
+            std::sort(sample.begin(), sample.end());
+            for (size_t b = 0; b <= TableStats::HISTOGRAM_BUCKETS && !sample.empty(); ++b) {
+                size_t position = std::min(sample.size() - 1, b * sample.size() / TableStats::HISTOGRAM_BUCKETS);
+                column.histogram.push_back(sample[position]);
+            }
+        }
+        for (auto& ranges : stats.page_ranges) {
+            ranges.resize(stats.columns.size(), {std::numeric_limits<int>::max(), std::numeric_limits<int>::min()});
+        }
+    }
+
+    bool next() override {
+        if (column_index >= stats.columns.size()) {
+            return false;
+        }
+        column_index++;
+        return true;
+    }
+
+    void close() override {}
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        static const char* const typeNames[] = {"INT", "FLOAT", "STRING"};
+        const ColumnStats& column = stats.columns[column_index - 1];
+        std::vector<std::unique_ptr<Field>> output;
+        output.push_back(std::make_unique<Field>(static_cast<int>(column_index)));
+        output.push_back(std::make_unique<Field>(std::string(typeNames[column.type])));
+        output.push_back(std::make_unique<Field>(static_cast<int>(column.distinct)));
+        output.push_back(std::make_unique<Field>(static_cast<float>(column.min)));
+        output.push_back(std::make_unique<Field>(static_cast<float>(column.max)));
+        return output;
+    }
+
+    const TableStats& getStats() const { return stats; }
+};
+
+// What one operator did during a run, as measured by ProfiledOperator.
+// Times and buffer traffic include the operator's inputs.
+struct OperatorProfile {
+    uint64_t rows = 0;
+    uint64_t open_nanos = 0;
+    uint64_t next_nanos = 0;
+    uint64_t close_nanos = 0;
+    uint64_t buffer_hits = 0;
+    uint64_t buffer_misses = 0;
+
+    uint64_t totalNanos() const { return open_nanos + next_nanos + close_nanos; }
+};
+
+// Forwards every call to `op` and records rows produced, time spent in
+// open/next/close and the buffer pool traffic caused meanwhile. The
+// planner only puts it into plans run by EXPLAIN ANALYZE, so ordinary
+// queries pay nothing.
+class ProfiledOperator : public Operator {
+private:
+    Operator& op;
+    BufferManager& manager;
+    OperatorProfile profile;
+
+    // Charges the time and page requests of one call to `nanos`
+    class Measurement {
+    private:
+        ProfiledOperator& owner;
+        uint64_t& nanos;
+        std::chrono::steady_clock::time_point start;
+        uint64_t hits;
+        uint64_t misses;
+
+    public:
+        Measurement(ProfiledOperator& owner, uint64_t& nanos)
+            : owner(owner), nanos(nanos), start(std::chrono::steady_clock::now()),
+              hits(threadBufferTraffic().hits), misses(threadBufferTraffic().misses) {}
+
+        ~Measurement() {
+            nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            owner.profile.buffer_hits += threadBufferTraffic().hits - hits;
+            owner.profile.buffer_misses += threadBufferTraffic().misses - misses;
+        }
+    };
+
+public:
+    ProfiledOperator(Operator& op, BufferManager& manager) : op(op), manager(manager) {}
+
+    void open() override {
+        profile = OperatorProfile();
+        Measurement measurement(*this, profile.open_nanos);
+        op.open();
+    }
+
+    bool next() override {
+        Measurement measurement(*this, profile.next_nanos);
+        bool has_next = op.next();
+        profile.rows += has_next;
+        return has_next;
+    }
+
+    bool nextBatch(Batch& batch) override {
+        Measurement measurement(*this, profile.next_nanos);
+        bool has_next = op.nextBatch(batch);
+        profile.rows += has_next ? batch.selection.size() : 0;
+        return has_next;
+    }
+
+    void close() override {
+        Measurement measurement(*this, profile.close_nanos);
+        op.close();
+    }
+
+    std::vector<std::unique_ptr<Field>> getOutput() override {
+        Measurement measurement(*this, profile.next_nanos);
+        return op.getOutput();
+    }
+
+    std::vector<SortKey> getOrdering() const override {
+        return op.getOrdering();
+    }
+
+    const OperatorProfile& getProfile() const { return profile; }
+};
+
+// Node of a physical plan as printed by EXPLAIN
+struct PlanNode {
+    std::string description;
+    double rows = 0; // Estimated output rows
+    double cost = 0; // Estimated cost of the subtree
+    std::vector<std::unique_ptr<PlanNode>> children;
+    // Measurements of the operator under EXPLAIN ANALYZE, null otherwise
+    const OperatorProfile* profile = nullptr;
+
+    void print(std::ostream& out, size_t depth = 0) const {
+        std::ostringstream estimates;
+        estimates << std::fixed << std::setprecision(0) << " (rows=" << rows
+                  << std::setprecision(1) << " cost=" << cost << ")";
+        if (profile) {
+            estimates << " " << actuals();
+        }
+        out << std::string(2 * depth, ' ') << (depth ? "-> " : "") << description << estimates.str() << "\n";
+        for (const auto& child : children) {
+            child->print(out, depth + 1);
+        }
+    }
+
+private:
+    // Rows in are the rows of the children. Self time and buffer traffic
+    // leave out the children's, which the profile includes.
+    std::string actuals() const {
+        uint64_t rows_in = 0;
+        uint64_t child_nanos = 0;
+        uint64_t child_hits = 0;
+        uint64_t child_misses = 0;
+        for (const auto& child : children) {
+            if (child->profile) {
+                rows_in += child->profile->rows;
+                child_nanos += child->profile->totalNanos();
+                child_hits += child->profile->buffer_hits;
+                child_misses += child->profile->buffer_misses;
+            }
+        }
+        auto millis = [](uint64_t nanos) { return nanos / 1e6; };
+        auto self = [](uint64_t total, uint64_t children) { return total > children ? total - children : 0; };
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3) << "(actual rows=" << profile->rows;
+        if (!children.empty()) {
+            out << " in=" << rows_in;
+        }
+        out << " open=" << millis(profile->open_nanos) << "ms next=" << millis(profile->next_nanos)
+            << "ms close=" << millis(profile->close_nanos) << "ms self="
+            << millis(self(profile->totalNanos(), child_nanos)) << "ms"
+            << " hits=" << self(profile->buffer_hits, child_hits)
+            << " misses=" << self(profile->buffer_misses, child_misses) << ")";
+        return out.str();
+    }
+};
+
+// Operators of a planned query. Each operator only refers to operators
+// created before it, so the list also keeps them alive in a safe order.
+struct QueryPlan {
+    std::vector<std::unique_ptr<Operator>> operators;
+    Operator* root = nullptr;
+    std::unique_ptr<PlanNode> explain;
+    // Comparisons holding the value of each ? placeholder
+    std::vector<std::vector<SimplePredicate*>> parameters;
+    // Relies on zone maps or sort orders, which hold for one table version
+    bool version_dependent = false;
+};
+
+// Cost model, in units of reading one page
+constexpr double PAGE_COST = 1.0;
+constexpr double ROW_COST = 0.01;           // Decoding and filtering a row in the interpreted engine
+constexpr double COMPILED_ROW_COST = 0.002; // The same in a fused, compiled pipeline
+constexpr double HASH_ROW_COST = 0.02;      // Inserting into or probing a hash table
+constexpr double MERGE_ROW_COST = 0.005;    // Advancing a merge join
+constexpr double SORT_ROW_COST = 0.005;     // Per row and level of a comparison sort
+
+// Builds the physical plan of a query. Cardinalities come from ANALYZE
+// statistics when available and from System R style default
+// selectivities otherwise. The planner chooses
+// - a zone map scan, reading only pages whose min/max can satisfy the
+//   WHERE clause, over a full scan;
+// - the compiled, parallel or interpreted aggregation;
+// - for joins, which WHERE conjuncts to evaluate below the join on each
+//   side, and a hash, radix or merge join;
+// - a top-K heap over a full sort under ORDER BY ... LIMIT.
+class QueryPlanner {
+private:
+    static constexpr double DEFAULT_ROWS_PER_PAGE = 100;
+    static constexpr double DEFAULT_DISTINCT = 10;
+    static constexpr double DEFAULT_RANGE_SELECTIVITY = 1.0 / 3;
+
+    BufferManager& manager;
+    const TableStats* stats; // May be null
+    bool fresh;              // Stats describe the current table
+    bool profile;            // Put a ProfiledOperator above every operator
+    QueryPlan plan;
+    const OperatorProfile* last_profile = nullptr;
+
+public:
+    QueryPlanner(BufferManager& manager, const TableStats* stats, bool profile = false)
+        : manager(manager), stats(stats), fresh(stats && stats->table_version == manager.getTableVersion()),
+          profile(profile) {}
+
+    QueryPlan build(const QueryComponents& components) {
+        checkColumns(components);
+        plan = QueryPlan();
+        std::unique_ptr<PlanNode> node;
+        bool aggregated = components.isAggregation();
+        std::vector<SortKey> sortKeys = components.orderBy;
+        std::vector<size_t> outputColumns;
+
+        if (components.join) {
+            node = planJoin(components);
+            if (!aggregated && !components.selectAttributes.empty()) {
+                // Joined rows are projected after sorting
+                outputColumns = components.selectAttributes;
+            }
+        } else if (!aggregated) {
+            // The scan decodes only the selected fields, plus the ORDER BY
+            // fields, which are dropped again after sorting
+            std::vector<size_t> scanAttrs = components.selectAttributes;
+            if (!scanAttrs.empty()) {
+                for (auto& key : sortKeys) {
+                    auto it = std::find(scanAttrs.begin(), scanAttrs.end(), key.attr_index);
+                    if (it == scanAttrs.end()) {
+                        scanAttrs.push_back(key.attr_index);
+                        it = scanAttrs.end() - 1;
+                    }
+                    key.attr_index = static_cast<size_t>(it - scanAttrs.begin());
+                }
+                if (scanAttrs.size() > components.selectAttributes.size()) {
+                    outputColumns.resize(components.selectAttributes.size());
+                    std::iota(outputColumns.begin(), outputColumns.end(), 0);
+                }
+            }
+            node = planScan(components.where.get(), scanAttrs);
+        }
+
+        if (aggregated) {
+            node = planAggregation(components, std::move(node));
+        }
+
+        // ORDER BY on the output columns; with a LIMIT only the best rows
+        // are kept instead of sorting everything
+        double rows = node->rows;
+        if (!sortKeys.empty()) {
+            std::string keys = describeSortKeys(components.orderBy);
+            if (components.limit >= 0) {
+                auto bound = std::make_shared<TopKBound>();
+                double kept = std::min(rows, static_cast<double>(components.limit));
+                if (!aggregated) {
+                    // The input rows are the ranked rows, so the heap bound can
+                    // reject them before they reach the heap
+                    add<SelectOperator>(*plan.root, std::make_unique<TopKBoundPredicate>(bound));
+                }
+                add<TopKOperator>(*plan.root, sortKeys, static_cast<size_t>(components.limit), bound);
+                node = wrap(std::move(node), "TopK " + std::to_string(components.limit) + " by " + keys, kept,
+                            rows * std::log2(kept + 2) * SORT_ROW_COST);
+            } else {
+                add<SortOperator>(*plan.root, sortKeys);
+                node = wrap(std::move(node), "Sort by " + keys, rows, sortCost(rows));
+            }
+        } else if (components.limit >= 0) {
+            add<LimitOperator>(*plan.root, static_cast<size_t>(components.limit));
+            node = wrap(std::move(node), "Limit " + std::to_string(components.limit),
+                        std::min(rows, static_cast<double>(components.limit)), 0);
+        }
+
+        if (!outputColumns.empty()) {
+            add<ProjectionOperator>(*plan.root, outputColumns);
+            double projected = node->rows;
+            node = wrap(std::move(node), "Project " + describeColumns(components.selectAttributes), projected, 0);
+        }
+        plan.explain = std::move(node);
+        return std::move(plan);
+    }
+
+private:
+    // Creates an operator and makes it the root of the plan
+    template<typename T, typename... Args>
+    T& add(Args&&... args) {
+        plan.operators.push_back(std::make_unique<T>(std::forward<Args>(args)...));
+        T& op = static_cast<T&>(*plan.operators.back());
+        place(op);
+        return op;
+    }
+
+    // Makes `op` the root, behind a ProfiledOperator when profiling
+    void place(Operator& op) {
+        if (!profile) {
+            plan.root = &op;
+            return;
+        }
+        auto profiled = std::make_unique<ProfiledOperator>(op, manager);
+        last_profile = &profiled->getProfile();
+        plan.root = profiled.get();
+        plan.operators.push_back(std::move(profiled));
+    }
+
+    // Plan nodes are created right after their operator is placed
+    std::unique_ptr<PlanNode> makeNode(std::string description, double rows, double cost) const {
+        auto node = std::make_unique<PlanNode>();
+        node->description = std::move(description);
+        node->rows = rows;
+        node->cost = cost;
+        node->profile = last_profile;
+        return node;
+    }
+
+    // A parent of `child`; `cost` is the parent's own share
+    std::unique_ptr<PlanNode> wrap(std::unique_ptr<PlanNode> child, std::string description, double rows, double cost) {
+        auto node = makeNode(std::move(description), rows, child->cost + cost);
+        node->children.push_back(std::move(child));
+        return node;
+    }
+
+    static std::string describeColumns(const std::vector<size_t>& attrs) {
+        std::string text;
+        for (auto attr : attrs) {
+            text += (text.empty() ? "{" : " {") + std::to_string(attr + 1) + "}";
+        }
+        return text;
+    }
+
+    static std::string describeSortKeys(const std::vector<SortKey>& keys) {
+        std::string text;
+        for (const auto& key : keys) {
+            text += (text.empty() ? "{" : ", {") + std::to_string(key.attr_index + 1) + "}" + (key.descending ? " DESC" : "");
+        }
+        return text;
+    }
+
+    static double sortCost(double rows) {
+        return rows * std::log2(std::max(rows, 2.0)) * SORT_ROW_COST;
+    }
+
+    double tableRows() const {
+        double pages = static_cast<double>(manager.getNumPages());
+        if (stats && stats->pages > 0) {
+            return stats->rows * pages / stats->pages;
+        }
+        return pages * DEFAULT_ROWS_PER_PAGE;
+    }
+
+    const ColumnStats* columnStats(size_t attr) const {
+        return stats && attr < stats->columns.size() ? &stats->columns[attr] : nullptr;
+    }
 
-            // Extract group keys and initialize aggregation values
-            std::vector<Field> group_keys;
-            for (auto& index : group_by_attrs) {
-                group_keys.push_back(*tuple[index]); // Deep copy the Field object for group key
-            }
+    double distinct(size_t attr) const {
+        const ColumnStats* column = columnStats(attr);
+        return column ? std::max<double>(1, column->distinct) : DEFAULT_DISTINCT;
+    }
 
-            // Process aggregation functions
-            if (!hash_table.count(group_keys)) {
-                // Initialize aggregate values for a new group
-                std::vector<Field> aggr_values(aggr_funcs.size(), Field(0)); // Assuming Field(int) initializes an integer Field
-                hash_table[group_keys] = aggr_values;
+    // Estimated fraction of the rows with column values <= x
+    static double cumulativeFraction(const ColumnStats& column, double x) {
+        const auto& bounds = column.histogram;
+        if (bounds.size() < 2) {
+            return x >= column.max ? 1 : 0;
+        }
+        double fraction = 0;
+        for (size_t b = 0; b + 1 < bounds.size(); ++b) {
+            if (x >= bounds[b + 1]) {
+                fraction += 1;
+            } else if (x >= bounds[b]) {
+                fraction += (x - bounds[b] + 1) / (bounds[b + 1] - bounds[b] + 1);
             }
+        }
+        return fraction / (bounds.size() - 1);
+    }
 
-            // Update aggregate values
-            auto& aggr_values = hash_table[group_keys];
-            for (size_t i = 0; i < aggr_funcs.size(); ++i) {
-                // Simplified update logic for demonstration
-                // You'll need to implement actual aggregation logic here
-                aggr_values[i] = updateAggregate(aggr_funcs[i], aggr_values[i], *tuple[aggr_funcs[i].attr_index]);
+    double selectivity(const ConditionNode& node) const {
+        if (node.kind != ConditionNode::COMPARISON) {
+            double combined = node.kind == ConditionNode::AND ? 1 : 0;
+            for (const auto& child : node.children) {
+                double s = selectivity(*child);
+                combined = node.kind == ConditionNode::AND ? combined * s : combined + s - combined * s;
             }
+            return combined;
         }
-
-        // Prepare output tuples from the hash table
-        for (const auto& entry : hash_table) {
-            const auto& group_keys = entry.first;
-            const auto& aggr_values = entry.second;
-            Tuple output_tuple;
-            // Assuming Tuple has a method to add Fields
-            for (const auto& key : group_keys) {
-                output_tuple.addField(std::make_unique<Field>(key)); // Add group keys to the tuple
+        if (node.other_attr) {
+            double equal = 1 / std::max(distinct(node.attr), distinct(*node.other_attr));
+            return node.op == SimplePredicate::EQ ? equal
+                   : node.op == SimplePredicate::NE ? 1 - equal : DEFAULT_RANGE_SELECTIVITY;
+        }
+        const ColumnStats* column = columnStats(node.attr);
+        double equal = 1 / distinct(node.attr);
+        if (column && node.constant && column->type == INT && node.constant->getType() == INT && !column->histogram.empty()) {
+            double v = node.constant->asInt();
+            if (v < column->min || v > column->max) {
+                equal = 0;
             }
-            for (const auto& value : aggr_values) {
-                output_tuple.addField(std::make_unique<Field>(value)); // Add aggregated values to the tuple
+            switch (node.op) {
+                case SimplePredicate::EQ: return equal;
+                case SimplePredicate::NE: return 1 - equal;
+                case SimplePredicate::LT: return cumulativeFraction(*column, v - 1);
+                case SimplePredicate::LE: return cumulativeFraction(*column, v);
+                case SimplePredicate::GT: return 1 - cumulativeFraction(*column, v);
+                case SimplePredicate::GE: return 1 - cumulativeFraction(*column, v - 1);
             }
-            output_tuples.push_back(std::move(output_tuple));
         }
+        return node.op == SimplePredicate::EQ ? equal
+               : node.op == SimplePredicate::NE ? 1 - equal : DEFAULT_RANGE_SELECTIVITY;
     }
 
-    bool next() override {
-        if (output_tuples_index < output_tuples.size()) {
-            output_tuples_index++;
+    // Whether a page with the given column ranges may hold a matching row
+    static bool mayMatch(const ConditionNode& node, const std::vector<std::pair<int, int>>& ranges) {
+        if (node.kind != ConditionNode::COMPARISON) {
+            for (const auto& child : node.children) {
+                bool match = mayMatch(*child, ranges);
+                if (match != (node.kind == ConditionNode::AND)) {
+                    return match;
+                }
+            }
+            return node.kind == ConditionNode::AND;
+        }
+        if (!node.constant || node.constant->getType() != INT || node.attr >= ranges.size()) {
             return true;
         }
-        return false;
+        auto [lo, hi] = ranges[node.attr];
+        int v = node.constant->asInt();
+        switch (node.op) {
+            case SimplePredicate::EQ: return lo <= v && v <= hi;
+            case SimplePredicate::NE: return lo <= hi && !(lo == v && hi == v);
+            case SimplePredicate::GT: return hi > v;
+            case SimplePredicate::GE: return hi >= v;
+            case SimplePredicate::LT: return lo < v;
+            case SimplePredicate::LE: return lo <= v;
+        }
+        return true;
     }
 
-    void close() override {
-        input->close();
+    // Pages that may hold rows satisfying `where`; every page unless the
+    // zone maps are current
+    std::vector<size_t> candidatePages(const ConditionNode* where) const {
+        std::vector<size_t> pages;
+        size_t num_pages = manager.getNumPages();
+        for (size_t page = 0; page < num_pages; ++page) {
+            if (!where || !fresh || page >= stats->page_ranges.size() || mayMatch(*where, stats->page_ranges[page])) {
+                pages.push_back(page);
+            }
+        }
+        return pages;
     }
 
-    std::vector<std::unique_ptr<Field>> getOutput() override {
-        std::vector<std::unique_ptr<Field>> outputCopy;
+    // Scan of the table filtered by `where`, which is pushed into the
+    // scan, and decoding `attrs` (all fields if empty). EXPLAIN shows the
+    // filter as `shown_where` when given. A full scan is shared with the
+    // concurrent ones unless the rows must come in page order.
+    std::unique_ptr<PlanNode> planScan(const ConditionNode* where, const std::vector<size_t>& attrs,
+                                       const std::string& label = "Scan",
+                                       const ConditionNode* shown_where = nullptr,
+                                       bool in_page_order = false) {
+        size_t num_pages = manager.getNumPages();
+        std::vector<size_t> pages = candidatePages(where);
+        size_t pages_read = pages.size();
+        double rows_read = num_pages > 0 ? tableRows() * pages_read / num_pages : 0;
+
+        auto& scan = add<ScanOperator>(manager);
+        std::string description = label;
+        if (pages_read < num_pages) {
+            plan.version_dependent = true;
+            description += " of " + std::to_string(pages_read) + "/" + std::to_string(num_pages) + " pages by zone maps";
+            scan.setPages(std::move(pages));
+        } else if (!in_page_order) {
+            description += " (shared)";
+            scan.setShared(true);
+        }
+        if (where) {
+            scan.pushPredicate(makePredicate(*where, &plan.parameters));
+            description += " filter " + (shown_where ? shown_where : where)->toString();
+        }
+        if (!attrs.empty()) {
+            scan.setProjection(attrs);
+            description += " columns " + describeColumns(attrs);
+        }
+        double rows = tableRows() * (where ? selectivity(*where) : 1);
+        return makeNode(description, rows, pages_read * PAGE_COST + rows_read * ROW_COST);
+    }
 
-        if (output_tuples_index == 0 || output_tuples_index > output_tuples.size()) {
-            // If there is no current tuple because next() hasn't been called yet or we're past the last tuple,
-            // return an empty vector.
-            return outputCopy; // This will be an empty vector
+    std::unique_ptr<PlanNode> planAggregation(const QueryComponents& components, std::unique_ptr<PlanNode> input) {
+        static const char* const aggregateNames[] = {"COUNT", "MAX", "MIN", "SUM", "AVG",
+                                                     "APPROX_COUNT_DISTINCT", "APPROX_QUANTILE"};
+        std::vector<size_t> groupByAttrs = components.groupByAttributes;
+        std::vector<AggrFunc> aggrFuncs = components.aggregates;
+        std::string description = "HashAggregate";
+        for (const auto& aggr : aggrFuncs) {
+            description += std::string(" ") + aggregateNames[static_cast<int>(aggr.func)] + "{" +
+                           std::to_string(aggr.attr_index + 1) + "}";
+        }
+        if (!groupByAttrs.empty()) {
+            description += " group by " + describeColumns(groupByAttrs);
         }
 
-        // Assuming that output_tuples stores Tuple objects and each Tuple has a vector of Field objects or similar
-        const auto& currentTuple = output_tuples[output_tuples_index - 1]; // Adjust for 0-based indexing after increment in next()
+        double input_rows = input ? input->rows : tableRows() * (components.where ? selectivity(*components.where) : 1);
+        double groups = 1;
+        for (auto attr : groupByAttrs) {
+            groups *= distinct(attr);
+        }
+        groups = groupByAttrs.empty() ? 1 : std::max(1.0, std::min(groups, input_rows));
 
-        // Assuming the Tuple class provides a way to access its fields, e.g., a method or a public member
-        for (const auto& field : currentTuple.fields) {
-            outputCopy.push_back(field->clone()); // Use the clone method to create a deep copy of each field
+        if (input) {
+            // Above a join
+            add<HashAggregationOperator>(*plan.root, groupByAttrs, aggrFuncs);
+            return wrap(std::move(input), description, groups, input_rows * HASH_ROW_COST);
         }
 
-        return outputCopy;
+        // The alternatives read the whole table, except for the interpreted
+        // plan, whose scan may skip pages by zone maps
+        double rows = tableRows();
+        double num_pages = static_cast<double>(manager.getNumPages());
+        double workers = static_cast<double>(defaultScheduler().getNumWorkers());
+        // Compiled filters bake their constants in, so placeholders rule them out
+        std::unique_ptr<Operator> compiled;
+        if (components.numParameters == 0) {
+            compiled = compileAggregation(manager, makeWherePredicate(components), groupByAttrs, aggrFuncs);
+        }
+        double compiled_cost = num_pages * PAGE_COST + rows * COMPILED_ROW_COST;
+        double parallel_cost = (num_pages * PAGE_COST + rows * ROW_COST + input_rows * HASH_ROW_COST) / workers;
+        size_t pages_read = candidatePages(components.where.get()).size();
+        double interpreted_cost = num_pages > 0 ? pages_read * PAGE_COST + rows * pages_read / num_pages * ROW_COST +
+                                                      input_rows * HASH_ROW_COST : 0;
+
+        std::string filter = components.where ? " filter " + components.where->toString() : "";
+        if (compiled && compiled_cost <= interpreted_cost && (workers <= 1 || compiled_cost <= parallel_cost)) {
+            // Fused loop for a known query shape
+            plan.operators.push_back(std::move(compiled));
+            place(*plan.operators.back());
+            return makeNode("Compiled " + description + filter, groups, compiled_cost);
+        }
+        if (workers > 1 && parallel_cost < interpreted_cost) {
+            // Scan, filter and aggregation run together on all cores
+            add<ParallelHashAggregationOperator>(
+                manager, components.where ? makePredicate(*components.where, &plan.parameters) : nullptr,
+                groupByAttrs, aggrFuncs);
+            return makeNode("Parallel " + description + " on " + std::to_string(static_cast<size_t>(workers)) +
+                            " workers" + filter, groups, parallel_cost);
+        }
+
+        // The scan decodes only the grouped and aggregated fields
+        std::vector<size_t> scanAttrs;
+        auto scanColumn = [&scanAttrs](size_t attr) {
+            auto it = std::find(scanAttrs.begin(), scanAttrs.end(), attr);
+            if (it != scanAttrs.end()) {
+                return static_cast<size_t>(it - scanAttrs.begin());
+            }
+            scanAttrs.push_back(attr);
+            return scanAttrs.size() - 1;
+        };
+        for (auto& attr : groupByAttrs) {
+            attr = scanColumn(attr);
+        }
+        for (auto& aggrFunc : aggrFuncs) {
+            aggrFunc.attr_index = scanColumn(aggrFunc.attr_index);
+        }
+        auto scan = planScan(components.where.get(), scanAttrs);
+        add<HashAggregationOperator>(*plan.root, groupByAttrs, aggrFuncs);
+        return wrap(std::move(scan), description, groups, input_rows * HASH_ROW_COST);
     }
 
+    // Rejects {n} references past the end of the rows they address: the
+    // stored rows, the joined rows, or for ORDER BY after aggregation the
+    // group keys and aggregates. Nothing is known of an empty table.
+    void checkColumns(const QueryComponents& components) const {
+        size_t arity = storedArity();
+        if (arity == 0) {
+            return;
+        }
+        size_t width = components.join ? 2 * arity : arity;
+        auto check = [](size_t attr, size_t limit, const std::string& clause) {
+            if (attr >= limit) {
+                throw std::runtime_error("Column {" + std::to_string(attr + 1) + "} in " + clause +
+                                         " does not exist; rows have " + std::to_string(limit) + " columns.");
+            }
+        };
+        for (auto attr : components.selectAttributes) {
+            check(attr, width, "SELECT");
+        }
+        for (const auto& aggr : components.aggregates) {
+            check(aggr.attr_index, width, "an aggregate");
+        }
+        for (auto attr : components.groupByAttributes) {
+            check(attr, width, "GROUP BY");
+        }
+        if (components.where) {
+            std::vector<size_t> attrs;
+            components.where->collectAttributes(attrs);
+            for (auto attr : attrs) {
+                check(attr, width, "WHERE");
+            }
+        }
+        if (components.join) {
+            for (size_t k = 0; k < components.join->left_keys.size(); ++k) {
+                check(components.join->left_keys[k], arity, "JOIN");
+                check(components.join->right_keys[k], arity, "JOIN");
+            }
+        }
+        size_t sorted_width = components.isAggregation()
+            ? components.groupByAttributes.size() + components.aggregates.size() : width;
+        for (const auto& key : components.orderBy) {
+            check(key.attr_index, sorted_width, "ORDER BY");
+        }
+    }
 
-private:
+    // Number of fields of the first stored row, or 0 for an empty table
+    size_t storedArity() const {
+        if (stats && !stats->columns.empty()) {
+            return stats->columns.size();
+        }
+        std::vector<char> page(PAGE_SIZE);
+        for (size_t page_id = 0; page_id < manager.getNumPages(); ++page_id) {
+            manager.readPage(static_cast<int>(page_id), page.data());
+            const Slot* slot_array = reinterpret_cast<const Slot*>(page.data());
+            for (size_t slot = 0; slot < MAX_SLOTS; ++slot) {
+                if (!slot_array[slot].empty) {
+                    std::istringstream iss(std::string(page.data() + slot_array[slot].offset, slot_array[slot].length));
+                    return Tuple::deserialize(iss)->fields.size();
+                }
+            }
+        }
+        return 0;
+    }
 
-    Field updateAggregate(const AggrFunc& aggrFunc, const Field& currentAggr, const Field& newValue) {
-        if (currentAggr.getType() != newValue.getType()) {
-            throw std::runtime_error("Mismatched Field types in aggregation.");
+    static std::unique_ptr<ConditionNode> conjunction(const std::vector<const ConditionNode*>& conjuncts) {
+        if (conjuncts.empty()) {
+            return nullptr;
+        }
+        if (conjuncts.size() == 1) {
+            return conjuncts[0]->clone();
         }
+        auto node = std::make_unique<ConditionNode>();
+        node->kind = ConditionNode::AND;
+        for (const auto* conjunct : conjuncts) {
+            node->children.push_back(conjunct->clone());
+        }
+        return node;
+    }
 
-        switch (aggrFunc.func) {
-            case AggrFuncType::COUNT: {
-                if (currentAggr.getType() == FieldType::INT) {
-                    // For COUNT, simply increment the integer value
-                    int count = currentAggr.asInt() + 1;
-                    return Field(count);
+    // Self-join. WHERE conjuncts over the columns of one side are pushed
+    // into that side's scan, except into the padded side of an outer join;
+    // the rest is evaluated above the join.
+    std::unique_ptr<PlanNode> planJoin(const QueryComponents& components) {
+        const JoinClause& join = *components.join;
+        size_t arity = storedArity();
+        std::vector<const ConditionNode*> conjuncts;
+        if (components.where) {
+            if (components.where->kind == ConditionNode::AND) {
+                for (const auto& child : components.where->children) {
+                    conjuncts.push_back(child.get());
                 }
-                break;
+            } else {
+                conjuncts.push_back(components.where.get());
             }
-            case AggrFuncType::SUM: {
-                if (currentAggr.getType() == FieldType::INT) {
-                    int sum = currentAggr.asInt() + newValue.asInt();
-                    return Field(sum);
-                } else if (currentAggr.getType() == FieldType::FLOAT) {
-                    float sum = currentAggr.asFloat() + newValue.asFloat();
-                    return Field(sum);
-                }
-                break;
+        }
+        std::vector<const ConditionNode*> left_conjuncts, right_conjuncts, join_conjuncts;
+        for (const auto* conjunct : conjuncts) {
+            std::vector<size_t> attrs;
+            conjunct->collectAttributes(attrs);
+            bool left_only = std::all_of(attrs.begin(), attrs.end(), [arity](size_t a) { return a < arity; });
+            bool right_only = std::all_of(attrs.begin(), attrs.end(), [arity](size_t a) { return a >= arity; });
+            if (left_only) {
+                left_conjuncts.push_back(conjunct);
+            } else if (right_only && join.type == JoinType::INNER) {
+                right_conjuncts.push_back(conjunct);
+            } else {
+                join_conjuncts.push_back(conjunct);
             }
-            case AggrFuncType::MAX: {
-                if (currentAggr.getType() == FieldType::INT) {
-                    int max = std::max(currentAggr.asInt(), newValue.asInt());
-                    return Field(max);
-                } else if (currentAggr.getType() == FieldType::FLOAT) {
-                    float max = std::max(currentAggr.asFloat(), newValue.asFloat());
-                    return Field(max);
-                }
-                break;
+        }
+        auto left_where = conjunction(left_conjuncts);
+        auto right_where = conjunction(right_conjuncts);
+        auto shown_right_where = right_where ? right_where->clone() : nullptr;
+        if (right_where) {
+            right_where->shiftAttributes(arity);
+        }
+        auto above_where = conjunction(join_conjuncts);
+
+        double key_distinct = 1;
+        bool int_keys = true;
+        bool ordered = fresh;
+        for (size_t k = 0; k < join.left_keys.size(); ++k) {
+            key_distinct *= std::max(distinct(join.left_keys[k]), distinct(join.right_keys[k]));
+            for (size_t attr : {join.left_keys[k], join.right_keys[k]}) {
+                const ColumnStats* column = columnStats(attr);
+                int_keys &= column && column->type == INT;
+                ordered &= column && column->sorted;
             }
-            case AggrFuncType::MIN: {
-                if (currentAggr.getType() == FieldType::INT) {
-                    int min = std::min(currentAggr.asInt(), newValue.asInt());
-                    return Field(min);
-                } else if (currentAggr.getType() == FieldType::FLOAT) {
-                    float min = std::min(currentAggr.asFloat(), newValue.asFloat());
-                    return Field(min);
+        }
+        // Merge joins compare every key column in order; sorted columns
+        // only make their combination sorted for a single key
+        ordered &= join.left_keys.size() == 1;
+
+        // Sorted keys are only sorted when the scans read pages in order
+        auto left = planScan(left_where.get(), {}, "Scan (left)", nullptr, ordered);
+        Operator* left_op = plan.root;
+        auto right = planScan(right_where.get(), {}, "Scan (right)", shown_right_where.get(), ordered);
+        Operator* right_op = plan.root;
+
+        double l = left->rows;
+        double r = right->rows;
+
+        double matched = l * r / std::max(1.0, key_distinct);
+        double semi = l * std::min(1.0, std::min(distinct(join.right_keys[0]), r) / distinct(join.left_keys[0]));
+        double rows = join.type == JoinType::INNER ? matched
+                      : join.type == JoinType::LEFT_OUTER ? std::max(matched, l)
+                      : join.type == JoinType::SEMI ? semi : l - semi;
+
+        double workers = static_cast<double>(defaultScheduler().getNumWorkers());
+        double hash_cost = (l + r) * HASH_ROW_COST;
+        double merge_cost = (l + r) * MERGE_ROW_COST + (ordered ? 0 : sortCost(l) + sortCost(r));
+        double radix_cost = (l + r) * (ROW_COST + HASH_ROW_COST / workers);
+        bool radix_possible = join.type == JoinType::INNER && join.left_keys.size() == 1 && int_keys && workers > 1;
+
+        std::string keys;
+        for (size_t k = 0; k < join.left_keys.size(); ++k) {
+            keys += (k ? " AND {" : "{") + std::to_string(join.left_keys[k] + 1) + "} = {" +
+                    std::to_string(join.right_keys[k] + 1) + "}";
+        }
+        static const char* const joinTypes[] = {"", " left outer", " semi", " anti"};
+        std::string type = joinTypes[static_cast<int>(join.type)];
+
+        std::unique_ptr<PlanNode> node;
+        if (merge_cost < hash_cost && (!radix_possible || merge_cost < radix_cost)) {
+            if (!ordered) {
+                std::vector<SortKey> left_sort, right_sort;
+                for (size_t k = 0; k < join.left_keys.size(); ++k) {
+                    left_sort.push_back({join.left_keys[k]});
+                    right_sort.push_back({join.right_keys[k]});
                 }
-                break;
+                add<SortOperator>(*left_op, left_sort);
+                left_op = plan.root;
+                left = wrap(std::move(left), "Sort by " + describeSortKeys(left_sort), l, sortCost(l));
+                add<SortOperator>(*right_op, right_sort);
+                right_op = plan.root;
+                right = wrap(std::move(right), "Sort by " + describeSortKeys(right_sort), r, sortCost(r));
             }
-            default:
-                throw std::runtime_error("Unsupported aggregation function.");
+            plan.version_dependent |= ordered;
+            add<MergeJoinOperator>(*left_op, *right_op, join.left_keys, join.right_keys, join.type, arity);
+            node = makeNode("Merge" + type + " join on " + keys, rows, (l + r) * MERGE_ROW_COST);
+        } else if (radix_possible && radix_cost < hash_cost) {
+            add<RadixHashJoinOperator>(*left_op, *right_op, join.left_keys[0], join.right_keys[0]);
+            node = makeNode("Radix hash join on " + keys + ", build " + (l <= r ? "left" : "right"), rows, radix_cost);
+        } else {
+            add<HashJoinOperator>(*left_op, *right_op, join.left_keys, join.right_keys, join.type, arity);
+            node = makeNode("Hash" + type + " join on " + keys + ", build " + (l <= r ? "left" : "right"), rows, hash_cost);
         }
-
-        // Default case for unsupported operations or types
-        throw std::runtime_error(
-            "Invalid operation or unsupported Field type.");
+        node->cost += left->cost + right->cost;
+        node->children.push_back(std::move(left));
+        node->children.push_back(std::move(right));
+
+        if (above_where) {
+            add<SelectOperator>(*plan.root, makePredicate(*above_where, &plan.parameters));
+            node = wrap(std::move(node), "Filter " + above_where->toString(), rows * selectivity(*above_where),
+                        rows * ROW_COST);
+        }
+        return node;
     }
-
 };
 
-struct QueryComponents {
-    std::vector<int> selectAttributes;
-    bool sumOperation = false;
-    int sumAttributeIndex = -1;
-    bool groupBy = false;
-    int groupByAttributeIndex = -1;
-    bool whereCondition = false;
-    int whereAttributeIndex = -1;
-    int lowerBound = std::numeric_limits<int>::min();
-    int upperBound = std::numeric_limits<int>::max();
-};
+// Results of recent queries, keyed by the query text with whitespace
+// normalized. Each entry remembers the table version it was computed at
+// and is only served while that version is current, so any insert or
+// delete invalidates it. The least recently used entry is evicted once
+// `capacity` entries exist; results with more than MAX_CACHED_ROWS rows
+// are not cached.
+class QueryResultCache {
+public:
+    static constexpr size_t MAX_CACHED_ROWS = 10000;
 
-QueryComponents parseQuery(const std::string& query) {
-    QueryComponents components;
+private:
+    struct Entry {
+        uint64_t table_version;
+        std::vector<Tuple> rows;
+        std::list<std::string>::iterator lru_position;
+    };
 
-    // Parse selected attributes
-    std::regex selectRegex("\\{(\\d+)\\}(, \\{(\\d+)\\})?");
-    std::smatch selectMatches;
-    std::string::const_iterator queryStart(query.cbegin());
-    while (std::regex_search(queryStart, query.cend(), selectMatches, selectRegex)) {
-        for (size_t i = 1; i < selectMatches.size(); i += 2) {
-            if (!selectMatches[i].str().empty()) {
-                components.selectAttributes.push_back(std::stoi(selectMatches[i]) - 1);
-            }
-        }
-        queryStart = selectMatches.suffix().first;
-    }
-
-    // Check for SUM operation
-    std::regex sumRegex("SUM\\{(\\d+)\\}");
-    std::smatch sumMatches;
-    if (std::regex_search(query, sumMatches, sumRegex)) {
-        components.sumOperation = true;
-        components.sumAttributeIndex = std::stoi(sumMatches[1]) - 1;
-    }
-
-    // Check for GROUP BY clause
-    std::regex groupByRegex("GROUP BY \\{(\\d+)\\}");
-    std::smatch groupByMatches;
-    if (std::regex_search(query, groupByMatches, groupByRegex)) {
-        components.groupBy = true;
-        components.groupByAttributeIndex = std::stoi(groupByMatches[1]) - 1;
-    }
-
-    // Extract WHERE conditions more accurately
-    std::regex whereRegex("\\{(\\d+)\\} > (\\d+) and \\{(\\d+)\\} < (\\d+)");
-    std::smatch whereMatches;
-    if (std::regex_search(query, whereMatches, whereRegex)) {
-        components.whereCondition = true;
-        // Correctly identify the attribute index for the WHERE condition
-        components.whereAttributeIndex = std::stoi(whereMatches[1]) - 1;
-        components.lowerBound = std::stoi(whereMatches[2]);
-        // Ensure the same attribute is used for both conditions
-        if (std::stoi(whereMatches[3]) - 1 == components.whereAttributeIndex) {
-            components.upperBound = std::stoi(whereMatches[4]);
-        } else {
-            std::cerr << "Error: WHERE clause conditions apply to different attributes." << std::endl;
-            // Handle error or set components.whereCondition = false;
+    size_t capacity;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru; // Most recently used first
+    size_t hits = 0;
+    size_t misses = 0;
+
+public:
+    explicit QueryResultCache(size_t capacity = 64) : capacity(capacity) {}
+
+    // Trims the query and collapses runs of whitespace into one space
+    static std::string normalize(const std::string& query) {
+        std::string normalized;
+        normalized.reserve(query.size());
+        for (char c : query) {
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                if (!normalized.empty() && normalized.back() != ' ') {
+                    normalized.push_back(' ');
+                }
+            } else {
+                normalized.push_back(c);
+            }
         }
+        if (!normalized.empty() && normalized.back() == ' ') {
+            normalized.pop_back();
+        }
+        return normalized;
     }
 
-    return components;
-}
-
-void prettyPrint(const QueryComponents& components) {
-    std::cout << "Query Components:\n";
-    std::cout << "  Selected Attributes: ";
-    for (auto attr : components.selectAttributes) {
-        std::cout << "{" << attr + 1 << "} "; // Convert back to 1-based indexing for display
+    // Cached rows of a normalized query if they are still valid
+    const std::vector<Tuple>* lookup(const std::string& key, uint64_t table_version) {
+        auto it = entries.find(key);
+        if (it == entries.end() || it->second.table_version != table_version) {
+            if (it != entries.end()) {
+                lru.erase(it->second.lru_position);
+                entries.erase(it);
+            }
+            misses++;
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second.lru_position);
+        hits++;
+        return &it->second.rows;
     }
-    std::cout << "\n  SUM Operation: " << (components.sumOperation ? "Yes" : "No");
-    if (components.sumOperation) {
-        std::cout << " on {" << components.sumAttributeIndex + 1 << "}";
+
+    void insert(const std::string& key, uint64_t table_version, std::vector<Tuple> rows) {
+        if (capacity == 0 || rows.size() > MAX_CACHED_ROWS) {
+            return;
+        }
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            lru.erase(it->second.lru_position);
+            entries.erase(it);
+        }
+        if (entries.size() >= capacity) {
+            entries.erase(lru.back());
+            lru.pop_back();
+        }
+        lru.push_front(key);
+        entries.emplace(key, Entry{table_version, std::move(rows), lru.begin()});
     }
-    std::cout << "\n  GROUP BY: " << (components.groupBy ? "Yes" : "No");
-    if (components.groupBy) {
-        std::cout << " on {" << components.groupByAttributeIndex + 1 << "}";
+
+    void clear() {
+        entries.clear();
+        lru.clear();
     }
-    std::cout << "\n  WHERE Condition: " << (components.whereCondition ? "Yes" : "No");
-    if (components.whereCondition) {
-        std::cout << " on {" << components.whereAttributeIndex + 1 << "} > " << components.lowerBound << " and < " << components.upperBound;
+
+    size_t getHits() const { return hits; }
+    size_t getMisses() const { return misses; }
+};
+
+void printRow(const std::vector<std::unique_ptr<Field>>& fields) {
+    for (const auto& field : fields) {
+        if (field) {
+            field->print();
+        } else {
+            std::cout << "NULL";
+        }
+        std::cout << " ";
     }
     std::cout << std::endl;
 }
 
+// Prints the result rows of the query; with `results`, also collects
+// them there, up to one row more than the result cache accepts. The plan
+// is costed with `stats` when given.
 void executeQuery(const QueryComponents& components, 
-                  BufferManager& buffer_manager) {
-    // Stack allocation of ScanOperator
-    ScanOperator scanOp(buffer_manager);
-
-    // Using a pointer to Operator to handle polymorphism
-    Operator* rootOp = &scanOp;
-
-    // Buffer for optional operators to ensure lifetime
-    std::optional<SelectOperator> selectOpBuffer;
-    std::optional<HashAggregationOperator> hashAggOpBuffer;
-
-    // Apply WHERE conditions
-    if (components.whereAttributeIndex != -1) {
-        // Create simple predicates with comparison operators
-        auto predicate1 = std::make_unique<SimplePredicate>(
-            SimplePredicate::Operand(components.whereAttributeIndex),
-            SimplePredicate::Operand(std::make_unique<Field>(components.lowerBound)),
-            SimplePredicate::ComparisonOperator::GT
-        );
-
-        auto predicate2 = std::make_unique<SimplePredicate>(
-            SimplePredicate::Operand(components.whereAttributeIndex),
-            SimplePredicate::Operand(std::make_unique<Field>(components.upperBound)),
-            SimplePredicate::ComparisonOperator::LT
-        );
-
-        // Combine simple predicates into a complex predicate with logical AND operator
-        auto complexPredicate = std::make_unique<ComplexPredicate>(ComplexPredicate::LogicOperator::AND);
-        complexPredicate->addPredicate(std::move(predicate1));
-        complexPredicate->addPredicate(std::move(predicate2));
-
-        // Using std::optional to manage the lifetime of SelectOperator
-        selectOpBuffer.emplace(*rootOp, std::move(complexPredicate));
-        rootOp = &*selectOpBuffer;
-    }
-
-    // Apply SUM or GROUP BY operation
-    if (components.sumOperation || components.groupBy) {
-        std::vector<size_t> groupByAttrs;
-        if (components.groupBy) {
-            groupByAttrs.push_back(static_cast<size_t>(components.groupByAttributeIndex));
-        }
-        std::vector<AggrFunc> aggrFuncs{
-            {AggrFuncType::SUM, static_cast<size_t>(components.sumAttributeIndex)}
-        };
-
-        // Using std::optional to manage the lifetime of HashAggregationOperator
-        hashAggOpBuffer.emplace(*rootOp, groupByAttrs, aggrFuncs);
-        rootOp = &*hashAggOpBuffer;
+                  BufferManager& buffer_manager,
+                  std::vector<Tuple>* results = nullptr,
+                  const TableStats* stats = nullptr) {
+    if (components.numParameters > 0) {
+        throw std::runtime_error("Queries with ? placeholders must be prepared.");
     }
+    QueryPlan plan = QueryPlanner(buffer_manager, stats).build(components);
+    Operator* rootOp = plan.root;
 
     // Execute the Root Operator
     rootOp->open();
     while (rootOp->next()) {
         // Retrieve and print the current tuple
-        const auto& output = rootOp->getOutput();
-        for (const auto& field : output) {
-            field->print();
-            std::cout << " ";
+        auto output = rootOp->getOutput();
+        printRow(output);
+        if (results && results->size() <= QueryResultCache::MAX_CACHED_ROWS) {
+            results->emplace_back();
+            results->back().fields = std::move(output);
         }
-        std::cout << std::endl;
     }
     rootOp->close();
 }
 
+// Query parsed and planned once and then executed any number of times,
+// with values bound to its ? placeholders in between. Executing only
+// swaps the bound constants into the plan's comparisons and reopens the
+// operators, which reset their state in open(). A plan that relies on
+// zone maps or sort orders is rebuilt once the table has changed.
+class PreparedStatement {
+private:
+    BufferManager& manager;
+    const TableStats* stats; // May be null
+    QueryComponents components;
+    QueryPlan plan;
+    uint64_t planned_version = 0;
+    std::vector<std::unique_ptr<Field>> values; // Bound values, null until bound
+
+public:
+    PreparedStatement(BufferManager& manager, const std::string& query, const TableStats* stats = nullptr)
+        : manager(manager), stats(stats), components(parseQuery(query)) {
+        if (components.analyze || components.explain) {
+            throw std::runtime_error("Only queries can be prepared.");
+        }
+        values.resize(components.numParameters);
+        replan();
+    }
+
+    PreparedStatement(const PreparedStatement&) = delete;
+    PreparedStatement& operator=(const PreparedStatement&) = delete;
+
+    size_t getNumParameters() const { return values.size(); }
+
+    // Binds the placeholder `index`, counted from 0 in query order
+    void bind(size_t index, const Field& value) {
+        if (index >= values.size()) {
+            throw std::runtime_error("Placeholder index out of range.");
+        }
+        values[index] = value.clone();
+        apply(index);
+    }
+
+    // Runs the statement and appends its rows to `results`
+    void execute(std::vector<Tuple>& results) {
+        for (const auto& value : values) {
+            if (!value) {
+                throw std::runtime_error("Not every placeholder is bound.");
+            }
+        }
+        if (plan.version_dependent && manager.getTableVersion() != planned_version) {
+            replan();
+        }
+        plan.root->open();
+        while (plan.root->next()) {
+            results.emplace_back();
+            results.back().fields = plan.root->getOutput();
+        }
+        plan.root->close();
+    }
+
+    void explain(std::ostream& out) const {
+        plan.explain->print(out);
+    }
+
+private:
+    void apply(size_t index) {
+        if (index < plan.parameters.size()) {
+            for (auto* predicate : plan.parameters[index]) {
+                predicate->right_operand.directValue = values[index]->clone();
+            }
+        }
+    }
+
+    void replan() {
+        plan = QueryPlanner(manager, stats).build(components);
+        planned_version = manager.getTableVersion();
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (values[i]) {
+                apply(i);
+            }
+        }
+    }
+};
+
 class InsertOperator : public Operator {
 private:
     BufferManager& bufferManager;
@@ -1306,6 +8766,7 @@ public:
             if (page->addTuple(tupleToInsert->clone())) { 
                 // Flush the page to disk after insertion
                 bufferManager.flushPage(pageId); 
+                bufferManager.tupleInserted(*tupleToInsert);
                 return true; // Insertion successful
             }
         }
@@ -1315,6 +8776,7 @@ public:
         auto& newPage = bufferManager.getPage(bufferManager.getNumPages() - 1);
         if (newPage->addTuple(tupleToInsert->clone())) {
             bufferManager.flushPage(bufferManager.getNumPages() - 1);
+            bufferManager.tupleInserted(*tupleToInsert);
             return true; // Insertion successful after extending the database
         }
 
@@ -1351,8 +8813,20 @@ public:
             return false;
         }
 
+        // Keep the row for the observers; deleting an empty slot changes nothing
+        std::unique_ptr<Tuple> deleted;
+        Slot* slot_array = reinterpret_cast<Slot*>(page->page_data.get());
+        if (tupleId < MAX_SLOTS && !slot_array[tupleId].empty) {
+            const Slot& slot = slot_array[tupleId];
+            std::istringstream iss(std::string(page->page_data.get() + slot.offset, slot.length));
+            deleted = Tuple::deserialize(iss);
+        }
+
         page->deleteTuple(tupleId); // Perform deletion
         bufferManager.flushPage(pageId); // Flush the page to disk after deletion
+        if (deleted) {
+            bufferManager.tupleDeleted(*deleted);
+        }
         return true;
     }
 
@@ -1370,6 +8844,10 @@ class BuzzDB {
 public:
     HashIndex hash_index;
     BufferManager buffer_manager;
+    QueryResultCache result_cache;
+    // Aggregation queries kept up to date, keyed by normalized query text
+    std::unordered_map<std::string, std::unique_ptr<MaterializedAggregate>> materialized_views;
+    std::optional<TableStats> table_stats; // Set by ANALYZE
 
 public:
     size_t max_number_of_tuples = 5000;
@@ -1379,6 +8857,8 @@ public:
         // Storage Manager automatically created
     }
 
+    explicit BuzzDB(const std::string& scratch_filename) : buffer_manager(scratch_filename) {}
+
     // insert function
     void insert(int key, int value) {
         tuple_insertion_attempt_counter += 1;
@@ -1421,16 +8901,533 @@ public:
         };
 
         for (const auto& query : test_queries) {
-            auto components = parseQuery(query);
-            //prettyPrint(components);
-            executeQuery(components, buffer_manager);
+            executeQuery(query);
+        }
+
+    }
+
+    // Keeps the result of an aggregation query (aggregates and/or GROUP
+    // BY with an optional WHERE) materialized; executeQuery() then reads
+    // it instead of scanning the table
+    MaterializedAggregate& materialize(const std::string& query) {
+        auto components = parseQuery(query);
+        if (!components.isAggregation() || components.join || !components.orderBy.empty() || components.limit >= 0) {
+            throw std::runtime_error("Only aggregation queries without JOIN, ORDER BY or LIMIT can be materialized.");
+        }
+        auto& view = materialized_views[QueryResultCache::normalize(query)];
+        view = std::make_unique<MaterializedAggregate>(buffer_manager, components.groupByAttributes,
+                                                       components.aggregates, makeWherePredicate(components));
+        return *view;
+    }
+
+    void explainAnalyze(const QueryComponents& components, const TableStats* stats) {
+        if (components.numParameters > 0) {
+            throw std::runtime_error("Queries with ? placeholders must be prepared.");
         }
+        QueryPlan plan = QueryPlanner(buffer_manager, stats, true).build(components);
+        auto start = std::chrono::steady_clock::now();
+        size_t rows = 0;
+        plan.root->open();
+        while (plan.root->next()) {
+            plan.root->getOutput();
+            rows++;
+        }
+        plan.root->close();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        plan.explain->print(std::cout);
+        std::cout << "Execution time: " << std::fixed << std::setprecision(3) << elapsed.count()
+                  << " ms, " << rows << " rows\n" << std::defaultfloat;
+    }
 
+    // Parses and plans a query with ? placeholders for repeated execution
+    std::unique_ptr<PreparedStatement> prepare(const std::string& query) {
+        return std::make_unique<PreparedStatement>(buffer_manager, query, table_stats ? &*table_stats : nullptr);
+    }
+
+    // Runs a query, answering it from a materialized view or from the
+    // result cache when the table has not changed since it last ran.
+    // ANALYZE collects statistics for the planner and EXPLAIN prints the
+    // plan it chooses. EXPLAIN ANALYZE also runs the plan and annotates
+    // each operator with its rows, times and buffer traffic.
+    void executeQuery(const std::string& query) {
+        std::string key = QueryResultCache::normalize(query);
+        auto view = materialized_views.find(key);
+        if (view != materialized_views.end()) {
+            for (const auto& row : view->second->getRows()) {
+                printRow(row.fields);
+            }
+            return;
+        }
+        uint64_t version = buffer_manager.getTableVersion();
+        if (const auto* rows = result_cache.lookup(key, version)) {
+            for (const auto& row : *rows) {
+                printRow(row.fields);
+            }
+            return;
+        }
+        auto components = parseQuery(query);
+        //prettyPrint(components);
+        if (components.analyze) {
+            AnalyzeOperator analyzeOp(buffer_manager);
+            analyzeOp.open();
+            while (analyzeOp.next()) {
+                printRow(analyzeOp.getOutput());
+            }
+            analyzeOp.close();
+            table_stats = analyzeOp.getStats();
+            return;
+        }
+        const TableStats* stats = table_stats ? &*table_stats : nullptr;
+        if (components.explainAnalyze) {
+            explainAnalyze(components, stats);
+            return;
+        }
+        if (components.explain) {
+            QueryPlanner(buffer_manager, stats).build(components).explain->print(std::cout);
+            return;
+        }
+        std::vector<Tuple> rows;
+        ::executeQuery(components, buffer_manager, &rows, stats);
+        result_cache.insert(key, version, std::move(rows));
     }
     
 };
 
-int main() {
+// Joins `build_rows` unique keys with `probe_rows` foreign keys using
+// RadixJoin at increasing thread counts, next to a single-threaded join
+// on one global hash table.
+void benchmarkRadixJoin(size_t build_rows, size_t probe_rows) {
+    std::mt19937 gen(42);
+    std::vector<RadixJoin::Entry> build(build_rows);
+    for (size_t i = 0; i < build_rows; ++i) {
+        build[i] = {static_cast<int32_t>(i), static_cast<uint32_t>(i)};
+    }
+    std::shuffle(build.begin(), build.end(), gen);
+    std::uniform_int_distribution<int32_t> keys(0, static_cast<int32_t>(build_rows) - 1);
+    std::vector<RadixJoin::Entry> probe(probe_rows);
+    for (size_t i = 0; i < probe_rows; ++i) {
+        probe[i] = {keys(gen), static_cast<uint32_t>(i)};
+    }
+    std::cout << "Radix join benchmark: " << build_rows << " x " << probe_rows << " rows\n";
+
+    auto report = [&](const std::string& name, size_t matches, std::chrono::duration<double> elapsed) {
+        std::cout << "  " << name << ": " << matches << " matches in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms ("
+                  << (build_rows + probe_rows) / elapsed.count() / 1e6 << " M tuples/s)\n";
+    };
+
+    {
+        // Non-partitioned baseline: one hash table over the whole build side
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t buckets = 1;
+        while (buckets < build_rows) {
+            buckets <<= 1;
+        }
+        std::vector<uint32_t> directory(buckets, std::numeric_limits<uint32_t>::max());
+        std::vector<uint32_t> chain(build_rows);
+        for (size_t i = 0; i < build_rows; ++i) {
+            size_t bucket = RadixJoin::hashKey(build[i].key) & (buckets - 1);
+            chain[i] = directory[bucket];
+            directory[bucket] = static_cast<uint32_t>(i);
+        }
+        size_t matches = 0;
+        for (const auto& entry : probe) {
+            size_t bucket = RadixJoin::hashKey(entry.key) & (buckets - 1);
+            for (uint32_t e = directory[bucket]; e != std::numeric_limits<uint32_t>::max(); e = chain[e]) {
+                matches += build[e].key == entry.key;
+            }
+        }
+        report("no partitioning, 1 thread", matches, std::chrono::high_resolution_clock::now() - start);
+    }
+
+    for (size_t threads = 1; threads <= defaultThreadCount(); threads *= 2) {
+        std::vector<size_t> counts(threads, 0);
+        RadixJoin radix_join(threads);
+        auto start = std::chrono::high_resolution_clock::now();
+        radix_join.join(build, probe, [&](size_t thread_id, uint32_t, uint32_t) { counts[thread_id]++; });
+        auto elapsed = std::chrono::high_resolution_clock::now() - start;
+        size_t matches = std::accumulate(counts.begin(), counts.end(), size_t(0));
+        report("radix (" + std::to_string(radix_join.getTotalBits()) + " bits, " +
+               std::to_string(radix_join.getNumPasses()) + " passes), " + std::to_string(threads) + " threads",
+               matches, elapsed);
+    }
+}
+
+// Query checks on a scratch table, run with `self-test`. The table holds
+// 30 rows (i % 10, 100 + i, 132.04, 'buzzdb'); `LEFT JOIN ON {1} = {2}`
+// finds no partner for any of them, so all right columns are NULL.
+class SelfTest {
+private:
+    BuzzDB db{temporaryFilename()};
+    size_t checks = 0;
+    size_t failures = 0;
+
+public:
+    SelfTest() {
+        for (int i = 0; i < 30; ++i) {
+            auto tuple = std::make_unique<Tuple>();
+            tuple->addField(std::make_unique<Field>(i % 10));
+            tuple->addField(std::make_unique<Field>(100 + i));
+            tuple->addField(std::make_unique<Field>(132.04f));
+            tuple->addField(std::make_unique<Field>("buzzdb"));
+            insert(db, std::move(tuple));
+        }
+    }
+
+    // Returns the number of failed checks
+    size_t run() {
+        // NULL padding of LEFT JOIN through every batch consumer
+        expect("COUNT(*) LEFT JOIN ON {1} = {2}", {"30"});
+        expect("COUNT{6}, SUM{6}, MIN{6}, AVG{6} LEFT JOIN ON {1} = {2}", {"0 NULL NULL NULL"});
+        expect("SELECT {1}, COUNT(*), SUM{6} LEFT JOIN ON {1} = {2} WHERE {1} < 2 GROUP BY {1}",
+               {"0 3 NULL", "1 3 NULL"});
+        expect("{5}, COUNT(*) LEFT JOIN ON {1} = {2} GROUP BY {5}", {"NULL 30"});
+        expect("SELECT {2}, {6} LEFT JOIN ON {1} = {2} ORDER BY {1}, {2} LIMIT 2",
+               {"100 NULL", "110 NULL"}, true);
+        expect("SELECT {2}, {6} LEFT JOIN ON {1} = {2} ORDER BY {6}, {2} DESC LIMIT 2",
+               {"129 NULL", "128 NULL"}, true);
+        expect("SELECT {2}, {6} LEFT JOIN ON {1} = {2} WHERE {2} > 126 ORDER BY {6} DESC, {2}",
+               {"127 NULL", "128 NULL", "129 NULL"}, true);
+
+        // WHERE on the padded side: comparisons with NULL fail silently
+        expect("SELECT * LEFT JOIN ON {1} = {2} WHERE {6} > 5", {});
+        expect("SELECT {2} LEFT JOIN ON {1} = {2} WHERE {6} > 5 OR {2} = 100", {"100"});
+
+        // Outer join padding does not depend on seeing a right row
+        for (bool merge : {false, true}) {
+            ScanOperator left(db.buffer_manager), right_scan(db.buffer_manager);
+            SelectOperator right(right_scan, std::make_unique<SimplePredicate>(
+                SimplePredicate::Operand(1), SimplePredicate::Operand(std::make_unique<Field>(0)), SimplePredicate::LT));
+            std::unique_ptr<Operator> join;
+            if (merge) {
+                join = std::make_unique<MergeJoinOperator>(left, right, std::vector<size_t>{0}, std::vector<size_t>{0},
+                                                           JoinType::LEFT_OUTER, 4);
+            } else {
+                join = std::make_unique<HashJoinOperator>(left, right, std::vector<size_t>{0}, std::vector<size_t>{0},
+                                                          JoinType::LEFT_OUTER, 4);
+            }
+            size_t rows = 0, padded = 0;
+            std::ostringstream out;
+            auto* cout_buffer = std::cout.rdbuf(out.rdbuf());
+            join->open();
+            while (join->next()) {
+                auto row = join->getOutput();
+                rows++;
+                padded += row.size() == 8 && std::count(row.begin() + 4, row.end(), nullptr) == 4;
+            }
+            join->close();
+            std::cout.rdbuf(cout_buffer);
+            check(std::string(merge ? "Merge" : "Hash") + " left outer join with an empty right input",
+                  rows == 30 && padded == 30);
+        }
+
+        // Aggregates without GROUP BY over no rows still give one row
+        expect("COUNT(*) WHERE {2} > 5000", {"0"});
+        expect("SUM{2} WHERE {2} > 5000", {"NULL"});
+        expect("COUNT(*), SUM{2}, MIN{2}, AVG{2} WHERE {2} > 5000", {"0 NULL NULL NULL"});
+        expect("COUNT(*) GROUP BY {1} WHERE {2} > 5000", {});
+
+        // Out-of-range column references are rejected while planning
+        expectError("SELECT {9}");
+        expectError("SUM{9}");
+        expectError("{1} ORDER BY {9}");
+        expectError("{1} WHERE {5} > 3");
+        expectError("COUNT(*) GROUP BY {1} ORDER BY {3}");
+        expectError("SELECT {9} JOIN ON {1} = {1}");
+        expectError("COUNT(*) JOIN ON {1} = {5}");
+        expect("SELECT {8} JOIN ON {1} = {1} WHERE {2} = 100", {"buzzdb", "buzzdb", "buzzdb"});
+
+        // A row at a time scan requests each page once, and the traffic
+        // of scans on other threads is not counted on this one
+        {
+            std::ostringstream out;
+            auto* cout_buffer = std::cout.rdbuf(out.rdbuf());
+            BufferTraffic before = threadBufferTraffic();
+            ScanOperator scan(db.buffer_manager);
+            size_t rows = 0;
+            scan.open();
+            while (scan.next()) {
+                rows++;
+            }
+            scan.close();
+            BufferTraffic after = threadBufferTraffic();
+            check("page requests of a row at a time scan",
+                  rows == 30 && after.hits + after.misses - before.hits - before.misses == db.buffer_manager.getNumPages());
+            std::thread([&]() {
+                ScanOperator other(db.buffer_manager);
+                other.open();
+                while (other.next()) {
+                }
+                other.close();
+            }).join();
+            std::cout.rdbuf(cout_buffer);
+            check("page requests of other threads", threadBufferTraffic().hits == after.hits &&
+                                                    threadBufferTraffic().misses == after.misses);
+        }
+
+        // Compiled aggregation: SUM fails rather than wrap around, and a
+        // non-INT row after the first makes it fall back to the interpreted
+        // plan, which reads that row in a batch of its own
+        {
+            std::ostringstream out;
+            auto* cout_buffer = std::cout.rdbuf(out.rdbuf());
+            BuzzDB scratch(temporaryFilename());
+            for (size_t i = 0; i < BATCH_SIZE; ++i) {
+                auto tuple = std::make_unique<Tuple>();
+                tuple->addField(std::make_unique<Field>(1));
+                tuple->addField(std::make_unique<Field>(2000000000));
+                tuple->addField(std::make_unique<Field>("overflows"));
+                insert(scratch, std::move(tuple));
+            }
+            auto sum = compileAggregation(scratch.buffer_manager, nullptr, {}, {{AggrFuncType::SUM, 1}});
+            bool overflow = false;
+            try {
+                drain(*sum);
+            } catch (const std::runtime_error&) {
+                overflow = true;
+            }
+
+            auto tuple = std::make_unique<Tuple>();
+            tuple->addField(std::make_unique<Field>(2));
+            tuple->addField(std::make_unique<Field>(2.5f));
+            tuple->addField(std::make_unique<Field>("not an int value"));
+            insert(scratch, std::move(tuple));
+            auto count = compileAggregation(scratch.buffer_manager, nullptr, {0}, {{AggrFuncType::COUNT, 1}});
+            std::vector<std::string> counts = count ? drain(*count) : std::vector<std::string>();
+            std::sort(counts.begin(), counts.end());
+            std::cout.rdbuf(cout_buffer);
+            check("compiled SUM overflow", sum && overflow);
+            check("compiled aggregation over a non-INT row",
+                  count && counts == std::vector<std::string>{"1 " + std::to_string(BATCH_SIZE), "2 1"});
+        }
+
+        // Hash join build rows hold every field type, and NULL keys on
+        // either side match nothing. Of two inputs of the same size, the
+        // left one becomes the build side.
+        for (size_t key : {0, 2, 3}) {
+            for (std::string nulls : {"", "build", "probe"}) {
+                ScanOperator scan(db.buffer_manager), padded_scan(db.buffer_manager), empty_scan(db.buffer_manager);
+                SelectOperator empty(empty_scan, std::make_unique<SimplePredicate>(
+                    SimplePredicate::Operand(1), SimplePredicate::Operand(std::make_unique<Field>(0)), SimplePredicate::LT));
+                HashJoinOperator padded(padded_scan, empty, {0}, {0}, JoinType::LEFT_OUTER, 4);
+                std::unique_ptr<HashJoinOperator> join;
+                if (nulls == "build") {
+                    join = std::make_unique<HashJoinOperator>(padded, scan, std::vector<size_t>{4 + key}, std::vector<size_t>{key});
+                } else if (nulls == "probe") {
+                    join = std::make_unique<HashJoinOperator>(scan, padded, std::vector<size_t>{key}, std::vector<size_t>{4 + key});
+                } else {
+                    join = std::make_unique<HashJoinOperator>(scan, padded_scan, std::vector<size_t>{key}, std::vector<size_t>{key});
+                }
+                std::ostringstream out;
+                auto* cout_buffer = std::cout.rdbuf(out.rdbuf());
+                size_t rows = drain(*join).size();
+                std::cout.rdbuf(cout_buffer);
+                size_t expected = !nulls.empty() ? 0 : key == 0 ? 90 : 900;
+                check("hash join on {" + std::to_string(key + 1) + "}" + (nulls.empty() ? "" : " with NULL " + nulls + " keys"),
+                      rows == expected);
+            }
+        }
+
+        // Window functions over LEFT JOIN padding: the NULL partition keys
+        // form one partition and the aggregates skip NULL inputs
+        for (bool buffered : {false, true}) {
+            ScanOperator left(db.buffer_manager), right_scan(db.buffer_manager);
+            SelectOperator right(right_scan, std::make_unique<SimplePredicate>(
+                SimplePredicate::Operand(1), SimplePredicate::Operand(std::make_unique<Field>(0)), SimplePredicate::LT));
+            HashJoinOperator join(left, right, {0}, {0}, JoinType::LEFT_OUTER, 4);
+            WindowFrame frame{std::nullopt, buffered ? std::nullopt : std::optional<size_t>(0)};
+            WindowOperator window(join, {4}, {}, {{WindowFuncType::SUM, 5, frame}, {WindowFuncType::COUNT, 1, frame}});
+            std::ostringstream out;
+            auto* cout_buffer = std::cout.rdbuf(out.rdbuf());
+            std::vector<std::string> result = drain(window);
+            std::cout.rdbuf(cout_buffer);
+            bool ok = result.size() == 30;
+            for (size_t i = 0; ok && i < result.size(); ++i) {
+                std::string suffix = " NULL " + std::to_string(buffered ? 30 : i + 1);
+                ok = result[i].size() >= suffix.size() &&
+                     result[i].compare(result[i].size() - suffix.size(), suffix.size(), suffix) == 0;
+            }
+            check(std::string(buffered ? "Buffered" : "Streaming") + " window over a left outer join", ok);
+        }
+
+        // CAST to the type its computed input already has, and INT results
+        // that do not fit
+        {
+            auto column_times = [](int factor) {
+                return std::make_unique<ArithmeticExpression>(ArithmeticOperator::MUL, std::make_unique<ColumnExpression>(1),
+                                                              std::make_unique<ConstantExpression>(Field(factor)));
+            };
+            std::vector<std::string> doubled, expected;
+            for (int i = 0; i < 30; ++i) {
+                expected.push_back(std::to_string(2 * (100 + i)));
+            }
+            check("CAST of a computed INT to INT",
+                  project(std::make_unique<CastExpression>(column_times(2), INT), doubled) && doubled == expected);
+            std::vector<std::string> ignored;
+            check("INT product overflow", !project(column_times(std::numeric_limits<int>::max()), ignored));
+            std::vector<std::unique_ptr<Expression>> args;
+            args.push_back(std::make_unique<ConstantExpression>(Field(std::numeric_limits<int>::min())));
+            check("ABS of the smallest INT", !project(std::make_unique<FunctionExpression>(ScalarFunction::ABS, std::move(args)),
+                                                      ignored));
+        }
+
+        // Spill files get distinct names and are removed with their manager
+        {
+            std::string first_name, second_name;
+            {
+                StorageManager first(temporaryFilename()), second(temporaryFilename());
+                first_name = first.filename;
+                second_name = second.filename;
+            }
+            check("temporary files", first_name != second_name && !std::ifstream(first_name) && !std::ifstream(second_name));
+        }
+
+        // Every morsel runs exactly once, also while workers steal
+        {
+            MorselScheduler scheduler(8);
+            bool once = true;
+            for (size_t n = 1; n <= 2000; ++n) {
+                std::vector<std::atomic<int>> runs(n % 40 + 1);
+                scheduler.run(runs.size(), [&](size_t, size_t morsel) { runs[morsel]++; });
+                once = once && std::all_of(runs.begin(), runs.end(), [](const auto& r) { return r == 1; });
+            }
+            check("morsels run once", once);
+        }
+
+        std::cout << checks - failures << " of " << checks << " checks passed\n";
+        return failures;
+    }
+
+private:
+    static std::string format(const Field* field) {
+        if (!field) {
+            return "NULL";
+        }
+        std::ostringstream out;
+        switch (field->getType()) {
+            case INT: out << field->asInt(); break;
+            case FLOAT: out << field->asFloat(); break;
+            case STRING: out << field->asString(); break;
+        }
+        return out.str();
+    }
+
+    // Rows of `query`, fields separated by spaces; what the query writes
+    // to std::cout is dropped and what it writes to std::cerr is returned
+    // in `errors`
+    std::vector<std::string> rows(const std::string& query, std::string& errors) {
+        std::ostringstream out, err;
+        auto* cout_buffer = std::cout.rdbuf(out.rdbuf());
+        auto* cerr_buffer = std::cerr.rdbuf(err.rdbuf());
+        std::vector<std::string> result;
+        try {
+            QueryPlan plan = QueryPlanner(db.buffer_manager, nullptr).build(parseQuery(query));
+            result = drain(*plan.root);
+        } catch (const std::exception& e) {
+            err << "exception: " << e.what() << "\n";
+        }
+        std::cout.rdbuf(cout_buffer);
+        std::cerr.rdbuf(cerr_buffer);
+        errors = err.str();
+        return result;
+    }
+
+    // Rows of `op`, fields separated by spaces
+    static std::vector<std::string> drain(Operator& op) {
+        std::vector<std::string> result;
+        op.open();
+        while (op.next()) {
+            std::string row;
+            for (const auto& field : op.getOutput()) {
+                row += (row.empty() ? "" : " ") + format(field.get());
+            }
+            result.push_back(row);
+        }
+        op.close();
+        return result;
+    }
+
+    // Rows of the table projected to `expression`; false if evaluating it threw
+    bool project(std::unique_ptr<Expression> expression, std::vector<std::string>& result) {
+        std::vector<std::unique_ptr<Expression>> expressions;
+        expressions.push_back(std::move(expression));
+        ScanOperator scan(db.buffer_manager);
+        ProjectionOperator projection(scan, std::move(expressions));
+        std::ostringstream out;
+        auto* cout_buffer = std::cout.rdbuf(out.rdbuf());
+        bool ok = true;
+        try {
+            result = drain(projection);
+        } catch (const std::runtime_error&) {
+            ok = false;
+        }
+        std::cout.rdbuf(cout_buffer);
+        return ok;
+    }
+
+    static void insert(BuzzDB& target, std::unique_ptr<Tuple> tuple) {
+        InsertOperator insert(target.buffer_manager);
+        insert.setTupleToInsert(std::move(tuple));
+        insert.next();
+    }
+
+    // Planning `query` must fail with a runtime_error
+    void expectError(const std::string& query) {
+        bool failed = false;
+        try {
+            QueryPlanner(db.buffer_manager, nullptr).build(parseQuery(query));
+        } catch (const std::runtime_error&) {
+            failed = true;
+        }
+        check("error for " + query, failed);
+    }
+
+    void check(const std::string& name, bool ok) {
+        checks++;
+        if (!ok) {
+            failures++;
+            std::cout << "FAILED: " << name << "\n";
+        }
+    }
+
+    // The query must return `expected`, in that order if `ordered`, and
+    // write nothing to std::cerr
+    void expect(const std::string& query, std::vector<std::string> expected, bool ordered = false) {
+        std::string errors;
+        std::vector<std::string> actual = rows(query, errors);
+        if (!ordered) {
+            std::sort(actual.begin(), actual.end());
+            std::sort(expected.begin(), expected.end());
+        }
+        checks++;
+        if (actual != expected || !errors.empty()) {
+            failures++;
+            std::cout << "FAILED: " << query << "\n";
+            for (const auto& row : actual) {
+                std::cout << "  got: " << row << "\n";
+            }
+            for (const auto& row : expected) {
+                std::cout << "  expected: " << row << "\n";
+            }
+            if (!errors.empty()) {
+                std::cout << "  errors: " << errors;
+            }
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+
+    if (argc > 1 && std::string(argv[1]) == "self-test") {
+        return SelfTest().run() == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "bench-radix-join") {
+        size_t build_rows = argc > 2 ? std::stoul(argv[2]) : 10 * 1000 * 1000;
+        size_t probe_rows = argc > 3 ? std::stoul(argv[3]) : 100 * 1000 * 1000;
+        benchmarkRadixJoin(build_rows, probe_rows);
+        return 0;
+    }
 
     BuzzDB db;
 